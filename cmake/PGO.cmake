@@ -0,0 +1,60 @@
+# Profile-guided optimization driver, run by "make pgo" in a normal build tree
+#
+# GCC only finds the profiles of an object file built at the same path, so the
+# instrumented and the optimized build share the tree pgo/ and everything is
+# recompiled in between. The training workload of the normal build is the baseline.
+#
+# Variables: SOURCE_DIR, BINARY_DIR, BUILD_TYPE, GENERATOR, TRAIN (target name)
+
+set(PGO_TREE "${BINARY_DIR}/pgo")
+set(PGO_WORK "${PGO_TREE}/training")
+set(PGO_ROUNDS 3)
+
+macro(pgo_run)
+	execute_process(COMMAND ${ARGN} RESULT_VARIABLE pgo_result)
+	if(NOT pgo_result EQUAL 0)
+		message(FATAL_ERROR "PGO step failed: ${ARGN}")
+	endif(NOT pgo_result EQUAL 0)
+endmacro(pgo_run)
+
+# Configure the PGO tree for the given stage and rebuild the target from scratch
+macro(pgo_build stage target)
+	file(MAKE_DIRECTORY "${PGO_TREE}")
+	execute_process(COMMAND ${CMAKE_COMMAND} -G "${GENERATOR}" -DCMAKE_BUILD_TYPE=${BUILD_TYPE} -DPGO=${stage} "${SOURCE_DIR}"
+	  WORKING_DIRECTORY "${PGO_TREE}" RESULT_VARIABLE pgo_result)
+	if(NOT pgo_result EQUAL 0)
+		message(FATAL_ERROR "Configuring the ${stage} build failed")
+	endif(NOT pgo_result EQUAL 0)
+	pgo_run(${CMAKE_COMMAND} --build "${PGO_TREE}" --target clean)
+	pgo_run(${CMAKE_COMMAND} --build "${PGO_TREE}" --target ${target})
+endmacro(pgo_build)
+
+# Run the training workload and store its total time (ms) in var
+macro(pgo_measure exe rounds var)
+	execute_process(COMMAND "${exe}" "${PGO_WORK}" ${rounds} OUTPUT_VARIABLE pgo_output RESULT_VARIABLE pgo_result)
+	if(NOT pgo_result EQUAL 0)
+		message(FATAL_ERROR "Training workload ${exe} failed")
+	endif(NOT pgo_result EQUAL 0)
+	string(REGEX MATCH "total: ([0-9]+) ms" pgo_match "${pgo_output}")
+	set(${var} ${CMAKE_MATCH_1})
+endmacro(pgo_measure)
+
+message(STATUS "PGO: building the instrumented training workload")
+pgo_build(GENERATE ${TRAIN})
+file(GLOB_RECURSE pgo_profiles "${PGO_TREE}/*.gcda")
+if(pgo_profiles)
+	file(REMOVE ${pgo_profiles})
+endif(pgo_profiles)
+message(STATUS "PGO: training")
+pgo_measure("${PGO_TREE}/${TRAIN}" 1 pgo_instrumented)
+
+message(STATUS "PGO: building with the profiles")
+pgo_build(USE all)
+
+pgo_measure("${BINARY_DIR}/${TRAIN}" ${PGO_ROUNDS} pgo_before)
+pgo_measure("${PGO_TREE}/${TRAIN}" ${PGO_ROUNDS} pgo_after)
+if(pgo_before AND pgo_after)
+	math(EXPR pgo_gain "(${pgo_before} - ${pgo_after}) * 100 / ${pgo_before}")
+	message(STATUS "PGO: training workload ${pgo_before} ms -> ${pgo_after} ms (${pgo_gain}% faster)")
+endif(pgo_before AND pgo_after)
+message(STATUS "PGO: optimized binaries are in ${PGO_TREE}")
@@ -0,0 +1,278 @@
+#include "analysis.hh"
+#include "pitch.hh"
+#include "notes.hh"
+#include "timeline.hh"
+#include "loudness.hh"
+#include "libda/fastmath.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+namespace {
+	/// Variable length quantity, seven bits per byte (like in MIDI files but least significant first)
+	void writeVarLen(std::ostream& os, unsigned value) {
+		while (value >= 0x80) { os.put(0x80 | (value & 0x7F)); value >>= 7; }
+		os.put(value);
+	}
+
+	unsigned readVarLen(std::istream& is) {
+		unsigned value = 0;
+		for (unsigned shift = 0; shift < 32; shift += 7) {
+			int c = is.get();
+			if (c == EOF) throw std::runtime_error("Unexpected end of pitch path data");
+			value |= unsigned(c & 0x7F) << shift;
+			if (!(c & 0x80)) return value;
+		}
+		throw std::runtime_error("Invalid pitch path data");
+	}
+
+	/// Signed numbers are zigzag encoded so that small negative deltas also take one byte
+	void writeDelta(std::ostream& os, int delta) { writeVarLen(os, delta < 0 ? ~(unsigned(delta) << 1) : unsigned(delta) << 1); }
+	int readDelta(std::istream& is) { unsigned value = readVarLen(is); return value & 1 ? ~int(value >> 1) : int(value >> 1); }
+}
+
+void PitchPath::push_back(float note, float level) {
+	m_cents.push_back(clamp<int>(round(100.0f * note), -32768, 32767));  // Tones below note 0 are negative
+	m_levels.push_back(clamp<int>(round(level), -128, 127));
+}
+
+void PitchPath::write(std::ostream& os) const {
+	writeVarLen(os, channel);
+	writeVarLen(os, m_begin);
+	writeVarLen(os, size());
+	int cents = 0, level = 0;
+	for (unsigned i = 0; i < size(); ++i) {
+		writeDelta(os, m_cents[i] - cents);
+		writeDelta(os, m_levels[i] - level);
+		cents = m_cents[i];
+		level = m_levels[i];
+	}
+}
+
+PitchPath PitchPath::read(std::istream& is, float hopTime) {
+	unsigned channel = readVarLen(is);
+	unsigned begin = readVarLen(is);
+	PitchPath path(channel, begin, hopTime);
+	unsigned count = readVarLen(is);
+	path.m_cents.reserve(count);
+	path.m_levels.reserve(count);
+	int cents = 0, level = 0;
+	for (unsigned i = 0; i < count; ++i) {
+		cents += readDelta(is);
+		level += readDelta(is);
+		path.m_cents.push_back(cents);
+		path.m_levels.push_back(level);
+	}
+	return path;
+}
+
+
+bool PitchAnalysis::analyze(QString const& fileName, Progress& progress) {
+	Timeline timeline(fileName);
+	return analyze(timeline, progress);
+}
+
+bool PitchAnalysis::analyze(Timeline& timeline, Progress& progress) {
+	duration = timeline.duration(); // Estimation
+	unsigned rate = timeline.getRate();
+	unsigned channels = timeline.getChannels();
+	// Interpolated peaks are as precise as reassignment with half the frame size (a fraction of a cent)
+	std::vector<Analyzer> analyzers(channels, Analyzer(rate, "", Analyzer::INTERPOLATION, 2048));
+	// Process the entire song
+	bool complete = true;
+	std::vector<float> data;
+	data.reserve((duration + 1.0) * rate * channels);
+	unsigned x = 0;
+	LoudnessMeter meter(rate, channels);
+	std::size_t metered = 0;
+	while (complete && timeline.output(data)) {
+		// Loudness is measured from the same decoded samples
+		if (metered < data.size()) meter.process(&data[0] + metered, &data[0] + data.size());
+		metered = data.size();
+		// Process as much as can be processed at this point
+		while (data.size() / channels - x >= analyzers[0].processSize()) {
+			// Pitch detection
+			for (unsigned ch = 0; ch < channels; ++ch) {
+				analyzers[ch].process(da::step_iterator<float>(&data[x * channels + ch], channels));
+			}
+			x += analyzers[0].processStep();
+			// Update progress and check for cancellation
+			double t = analyzers[0].getTime();
+			duration = std::max(duration, t + 0.01);
+			if (!progress.update(t, duration)) { complete = false; break; }
+		}
+	}
+	loudness = meter.integrated();
+	loudnessRange = meter.range();
+	truePeak = meter.truePeak();
+	// DEBUG: std::ofstream("audio.raw", std::ios::binary).write(reinterpret_cast<char*>(&data[0]), data.size() * sizeof(float));
+	// Filter the analyzer output data into PitchPaths.
+	MusicalScale scale;
+	std::vector<Analyzer::Moments::const_iterator> mit(channels), mend(channels);
+	for (unsigned ch = 0; ch < channels; ++ch) {
+		Analyzer::Moments const& moments = analyzers[ch].getMoments();
+		mit[ch] = moments.begin();
+		mend[ch] = moments.end();
+	}
+	paths.clear();
+	voicing.clear();
+	hopTime = double(analyzers[0].processStep()) / rate;
+	std::vector<float> notes, levels;
+	for (unsigned hop = 0; mit[0] != mend[0]; ++hop) {
+		float v = 0.0f;
+		for (unsigned ch = 0; ch < channels; ++ch) v = std::max(v, mit[ch]->m_voicing);
+		voicing.push_back(v);
+		for (unsigned ch = 0; ch < channels; ++mit[ch++]) {
+			Moment::Tones const& tones = mit[ch]->m_tones;  // Take tones then move forward the iterator
+			for (Moment::Tones::const_iterator it2 = tones.begin(), it2end = tones.end(); it2 != it2end; ++it2) {
+				if (it2->prev) continue;  // The tone doesn't begin at this moment, skip
+				// Copy the linked list into vector for easier access and calculate max level
+				std::vector<Tone const*> tones;
+				for (Tone const* n = &*it2; n; n = n->next) { tones.push_back(n); }
+				if (tones.size() < 3) continue;  // Too short tone, ignored
+				double score = 0.0;
+				notes.resize(tones.size());
+				levels.resize(tones.size());
+				for (unsigned i = 0; i < tones.size(); ++i) {
+					notes[i] = tones[i]->freq;
+					levels[i] = tones[i]->level;
+					score += tones[i]->level;
+				}
+				if (score <= 1.0) continue;
+				// Convert the whole path at once (frequency to note, level to dB)
+				scale.getNotes(&notes[0], &notes[0] + notes.size(), &notes[0]);
+				da::fast_log2(&levels[0], &levels[0] + levels.size(), &levels[0], 20.0f * std::log10(2.0f));
+				// Store path used for rendering
+				PitchPath path(ch, hop, hopTime);
+				for (unsigned i = 0; i < tones.size(); ++i) path.push_back(notes[i], levels[i]);
+				paths.push_back(path);
+			}
+		}
+	}
+	return complete;
+}
+
+namespace {
+	static const char CACHE_MAGIC[4] = { 'C', 'P', 'A', '5' };  // Change the last char when the format or the analysis changes
+}
+
+QString PitchAnalysis::cacheFile(QString const& fileName) {
+	// The same file modified or replaced gets a different key
+	QFileInfo finfo(fileName);
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	hash.addData(finfo.absoluteFilePath().toUtf8());
+	hash.addData(QByteArray::number(finfo.size()));
+	hash.addData(QByteArray::number(finfo.lastModified().toMSecsSinceEpoch()));
+	QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/analysis/";
+	return dir + hash.result().toHex();
+}
+
+bool PitchAnalysis::isCached(QString const& fileName) {
+	return QFileInfo(cacheFile(fileName)).exists();
+}
+
+bool PitchAnalysis::load(QString const& fileName) {
+	QFile f(cacheFile(fileName));
+	if (!f.open(QIODevice::ReadOnly)) return false;
+	QByteArray data = f.readAll();
+	std::istringstream is(std::string(data.constData(), data.size()), std::ios::binary);
+	char magic[sizeof(CACHE_MAGIC)];
+	is.read(magic, sizeof(magic));
+	if (!is || !std::equal(magic, magic + sizeof(magic), CACHE_MAGIC)) return false;
+	try {
+		read(is);
+	} catch (std::exception& e) {
+		std::cerr << "Ignoring broken analysis cache file " << f.fileName().toStdString() << ": " << e.what() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void PitchAnalysis::read(std::istream& is) {
+	PitchAnalysis result;
+	is.read(reinterpret_cast<char*>(&result.hopTime), sizeof(result.hopTime));
+	is.read(reinterpret_cast<char*>(&result.duration), sizeof(result.duration));
+	is.read(reinterpret_cast<char*>(&result.loudness), sizeof(result.loudness));
+	is.read(reinterpret_cast<char*>(&result.loudnessRange), sizeof(result.loudnessRange));
+	is.read(reinterpret_cast<char*>(&result.truePeak), sizeof(result.truePeak));
+	if (!is) throw std::runtime_error("Truncated analysis data");
+	unsigned hops = readVarLen(is);
+	for (unsigned i = 0; i < hops; ++i) result.voicing.push_back(readVarLen(is) / 255.0f);
+	unsigned count = readVarLen(is);
+	for (unsigned i = 0; i < count; ++i) result.paths.push_back(PitchPath::read(is, result.hopTime));
+	swap(result);
+}
+
+void PitchAnalysis::write(std::ostream& os) const {
+	os.write(reinterpret_cast<char const*>(&hopTime), sizeof(hopTime));
+	os.write(reinterpret_cast<char const*>(&duration), sizeof(duration));
+	os.write(reinterpret_cast<char const*>(&loudness), sizeof(loudness));
+	os.write(reinterpret_cast<char const*>(&loudnessRange), sizeof(loudnessRange));
+	os.write(reinterpret_cast<char const*>(&truePeak), sizeof(truePeak));
+	writeVarLen(os, voicing.size());
+	for (std::size_t i = 0; i < voicing.size(); ++i) writeVarLen(os, clamp<int>(round(255.0f * voicing[i]), 0, 255));
+	writeVarLen(os, paths.size());
+	for (Paths::const_iterator it = paths.begin(); it != paths.end(); ++it) it->write(os);
+}
+
+void PitchAnalysis::save(QString const& fileName) const {
+	std::ostringstream os(std::ios::binary);
+	os.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	write(os);
+	// Write atomically, another thread may be caching the same file
+	QString cache = cacheFile(fileName);
+	QDir().mkpath(QFileInfo(cache).path());
+	QSaveFile f(cache);
+	std::string const& data = os.str();
+	if (!f.open(QIODevice::WriteOnly) || f.write(data.data(), data.size()) != qint64(data.size()) || !f.commit())
+		std::cerr << "Could not write analysis cache file " << cache.toStdString() << std::endl;
+}
+
+void PitchAnalysis::swap(PitchAnalysis& other) {
+	paths.swap(other.paths);
+	voicing.swap(other.voicing);
+	std::swap(hopTime, other.hopTime);
+	std::swap(duration, other.duration);
+	std::swap(loudness, other.loudness);
+	std::swap(loudnessRange, other.loudnessRange);
+	std::swap(truePeak, other.truePeak);
+}
+
+PitchIndex::PitchIndex(PitchAnalysis const& analysis): m_hopTime(analysis.hopTime) {
+	// The loudest voiced path point of each hop (as ChartLint scores against)
+	std::size_t hops = analysis.voicing.size();
+	std::vector<PitchPath const*> dominant(hops);
+	std::vector<float> level(hops, -getInf());
+	for (PitchAnalysis::Paths::const_iterator it = analysis.paths.begin(); it != analysis.paths.end(); ++it) {
+		for (unsigned i = 0; i < it->size(); ++i) {
+			std::size_t hop = it->beginHop() + i;
+			if (hop >= hops || analysis.voicing[hop] < 0.5f) continue;
+			PitchFragment const fragment = (*it)[i];
+			if (fragment.level <= level[hop]) continue;
+			level[hop] = fragment.level;
+			dominant[hop] = &*it;
+		}
+	}
+	for (std::size_t hop = 0; hop < hops; ++hop) {
+		if (!dominant[hop]) continue;
+		if (!m_runs.empty() && m_runs.back().end == hop && m_runs.back().path == dominant[hop]) { ++m_runs.back().end; continue; }
+		Run run = { unsigned(hop), unsigned(hop) + 1, dominant[hop] };
+		m_runs.push_back(run);
+	}
+}
+
+float PitchIndex::pitchAt(double time) const {
+	if (m_runs.empty() || !(time >= 0.0)) return getNaN();
+	unsigned hop = time / m_hopTime + 0.5;
+	std::vector<Run>::const_iterator it = std::upper_bound(m_runs.begin(), m_runs.end(), hop, beginsAfter);
+	if (it == m_runs.begin() || hop >= (--it)->end) return getNaN();
+	return (*it->path)[hop - it->path->beginHop()].note;
+}
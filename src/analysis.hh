@@ -0,0 +1,109 @@
+#pragma once
+
+#include "types.hh"
+#include "util.hh"
+#include <QString>
+#include <iosfwd>
+#include <vector>
+
+/// A single point of PitchPath (decoded)
+struct PitchFragment {
+	float time, note, level;  // seconds, MIDI note, dB
+	PitchFragment(float time, float note, float level): time(time), note(note), level(level) {}
+};
+
+/// A continuous pitch path on the analyzer's hop grid
+/** The time is implied by the first hop index, pitch is stored in cents (int16) and level
+  * in whole dB (int8), so that a point takes 3 bytes instead of three floats.
+  * Points are decoded on access with operator[].
+ */
+class PitchPath {
+public:
+	unsigned channel;
+	/// @param hopTime seconds between the analyzer's moments
+	PitchPath(unsigned channel, unsigned beginHop, float hopTime): channel(channel), m_begin(beginHop), m_hopTime(hopTime) {}
+	void push_back(float note, float level);  ///< Append a point (MIDI note, dB) at the next hop
+	unsigned size() const { return m_cents.size(); }
+	bool empty() const { return m_cents.empty(); }
+	unsigned beginHop() const { return m_begin; }
+	float time(unsigned i) const { return (m_begin + i) * m_hopTime; }
+	float beginTime() const { return time(0); }
+	float endTime() const { return time(size() - 1); }
+	PitchFragment operator[](unsigned i) const { return PitchFragment(time(i), 0.01f * m_cents[i], m_levels[i]); }
+	/// Write into a binary stream, delta encoded (typically 2 bytes per point)
+	void write(std::ostream& os) const;
+	/// Read a path stored by write()
+	static PitchPath read(std::istream& is, float hopTime);
+private:
+	unsigned m_begin;  ///< Hop index of the first point
+	float m_hopTime;
+	std::vector<int16_t> m_cents;  ///< MIDI note * 100 (negative for tones below note 0)
+	std::vector<int8_t> m_levels;  ///< dB
+};
+
+class Timeline;
+
+/// Pitch analysis results of a music file
+struct PitchAnalysis {
+	typedef std::vector<PitchPath> Paths;
+	Paths paths;
+	std::vector<float> voicing;  ///< Voice activity per hop (the most active channel)
+	float hopTime;  ///< Seconds per hop
+	double duration;  ///< Seconds
+	float loudness;  ///< Integrated loudness in LUFS (NaN if silent)
+	float loudnessRange;  ///< LU
+	float truePeak;  ///< dBTP
+
+	PitchAnalysis(): hopTime(), duration(), loudness(getNaN()), loudnessRange(), truePeak(-getInf()) {}
+
+	/// Progress reporting and cancellation of analyze()
+	class Progress {
+	public:
+		virtual ~Progress() {}
+		/// Called regularly while analyzing, return false to stop (the results so far are kept)
+		virtual bool update(double position, double duration) = 0;
+	};
+
+	/// Decode and analyze a music file (throws on errors)
+	/// @return true if the whole file was analyzed
+	bool analyze(QString const& fileName, Progress& progress);
+	/// Decode and analyze a timeline of several music files (not cached)
+	bool analyze(Timeline& timeline, Progress& progress);
+	/// Load the results from the persistent analysis cache
+	/// @return false if the file (with the same size and modification time) has not been analyzed
+	bool load(QString const& fileName);
+	/// Store the results into the persistent analysis cache
+	void save(QString const& fileName) const;
+	/// Serialize the results (as in the cache, without the version)
+	void write(std::ostream& os) const;
+	/// Read the results stored by write(), throws std::runtime_error if the data is broken
+	void read(std::istream& is);
+	static bool isCached(QString const& fileName);
+	void swap(PitchAnalysis& other);
+
+private:
+	static QString cacheFile(QString const& fileName);
+};
+
+/// Lookup of the dominant pitch (the loudest voiced path) at any moment of an analysis
+/** The dominant path of each hop is stored as runs of consecutive hops, which are far fewer
+  * than the hops (a run typically lasts a sung note), and found with a binary search.
+  * The index refers to the paths of the analysis, which must stay unchanged while it is used.
+ */
+class PitchIndex {
+public:
+	PitchIndex(): m_hopTime() {}
+	explicit PitchIndex(PitchAnalysis const& analysis);
+	/// The dominant pitch (note number) at a time in seconds, NaN if nothing is voiced
+	float pitchAt(double time) const;
+	bool empty() const { return m_runs.empty(); }
+private:
+	struct Run {
+		unsigned begin, end;  ///< Hops (end not included)
+		PitchPath const* path;
+	};
+	static bool beginsAfter(unsigned hop, Run const& run) { return hop < run.begin; }
+	std::vector<Run> m_runs;  ///< In time order, not overlapping
+	float m_hopTime;
+};
+
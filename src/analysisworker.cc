@@ -0,0 +1,299 @@
+#include "analysisworker.hh"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QProcess>
+#include <QSharedMemory>
+#include <QThread>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace {
+	static const int startTimeout = 10000;  ///< Milliseconds for a worker to start and greet
+	static const int stopTimeout = 2000;  ///< Milliseconds for a worker to exit after its input is closed
+	static const int progressInterval = 100;  ///< Milliseconds between progress reports of a worker
+	static const int pollInterval = 500;  ///< Milliseconds between asking the client whether to go on while a worker is silent
+	static const int hangTimeout = 60000;  ///< Milliseconds without any report before a worker is considered hung
+
+	/// Remove the results that a worker left behind by dying after sharing them
+	/** SysV shared memory outlives its processes, but it is removed when its last user detaches.
+	  * On other systems it is gone with the worker and attaching fails harmlessly.
+	 */
+	void removeStale(QString const& key) {
+		QSharedMemory memory(key);
+		if (memory.attach(QSharedMemory::ReadOnly)) memory.detach();
+	}
+
+	/// Stream buffer reading memory in place
+	class MemoryBuffer: public std::streambuf {
+	public:
+		MemoryBuffer(char const* data, std::size_t size) {
+			char* p = const_cast<char*>(data);  // Only read
+			setg(p, p, p + size);
+		}
+	};
+
+	/// Progress of a worker, reported to the client which decides whether to go on
+	class WorkerProgress: public PitchAnalysis::Progress {
+	public:
+		WorkerProgress() { m_timer.start(); }
+		bool update(double position, double duration) {
+			if (m_timer.elapsed() < progressInterval) return true;
+			std::cout << "PROGRESS " << position << ' ' << duration << std::endl;
+			std::string reply;
+			bool more = std::getline(std::cin, reply) && reply == "CONTINUE";
+			m_timer.restart();  // The client may have been waiting for the user
+			return more;
+		}
+	private:
+		QElapsedTimer m_timer;
+	};
+
+	/// Analysis that never stops (for batch use)
+	struct NoProgress: public PitchAnalysis::Progress {
+		bool update(double, double) { return true; }
+	};
+
+	/// Files shared by the batch threads
+	class BatchQueue {
+	public:
+		BatchQueue(QStringList const& files): m_files(files), m_failed(), m_analyzed(), m_audio() {}
+		bool take(QString& file) {
+			QMutexLocker locker(&m_mutex);
+			if (m_files.isEmpty()) return false;
+			file = m_files.takeFirst();
+			return true;
+		}
+		/// @param duration seconds of music analyzed (zero if cached or failed)
+		void report(QString const& file, std::string const& result, bool ok, double duration = 0.0) {
+			QMutexLocker locker(&m_mutex);
+			std::cout << file.toStdString() << ": " << result << std::endl;
+			if (!ok) ++m_failed;
+			if (duration > 0.0) { ++m_analyzed; m_audio += duration; }
+		}
+		unsigned failed() const { return m_failed; }
+		unsigned analyzed() const { return m_analyzed; }
+		double audio() const { return m_audio; }
+	private:
+		QMutex m_mutex;
+		QStringList m_files;
+		unsigned m_failed;
+		unsigned m_analyzed;
+		double m_audio;
+	};
+
+	/// A batch thread with a worker process of its own
+	class BatchThread: public QThread {
+	public:
+		BatchThread(BatchQueue& queue): m_queue(queue) {}
+	protected:
+		void run() {
+			AnalysisWorker worker;
+			QString file;
+			while (m_queue.take(file)) {
+				if (PitchAnalysis::isCached(file)) { m_queue.report(file, "cached", true); continue; }
+				QElapsedTimer timer;
+				timer.start();
+				try {
+					PitchAnalysis analysis;
+					NoProgress progress;
+					worker.analyze(file, analysis, progress);
+					analysis.save(file);
+					std::ostringstream oss;
+					oss << analysis.paths.size() << " paths in " << timer.elapsed() / 1000.0 << " s";
+					m_queue.report(file, oss.str(), true, analysis.duration);
+				} catch (std::exception& e) {
+					m_queue.report(file, std::string("failed: ") + e.what(), false);
+				}
+			}
+		}
+	private:
+		BatchQueue& m_queue;
+	};
+}
+
+AnalysisWorker::AnalysisWorker(): m_jobs(), m_unavailable() {}
+
+AnalysisWorker::~AnalysisWorker() { stop(); }
+
+bool AnalysisWorker::start()
+{
+	m_process.reset(new QProcess);
+	m_process->setProcessChannelMode(QProcess::ForwardedErrorChannel);  // Decoder messages go to our standard error
+	m_process->start(QCoreApplication::applicationFilePath(), QStringList() << "--analysis-worker");
+	// Something else than a worker (e.g. when linked into a tool) would not greet
+	QByteArray line;
+	if (m_process->waitForStarted(startTimeout) && readLine(line, startTimeout) && line == "READY") return true;
+	std::cerr << "Could not start an analysis worker, analyzing in the editor instead" << std::endl;
+	kill();
+	m_unavailable = true;
+	return false;
+}
+
+void AnalysisWorker::kill()
+{
+	if (!m_process) return;
+	m_process->kill();
+	m_process->waitForFinished();
+	m_process.reset();
+}
+
+void AnalysisWorker::stop()
+{
+	if (!m_process) return;
+	m_process->closeWriteChannel();  // The worker exits at the end of its input
+	if (!m_process->waitForFinished(stopTimeout)) {
+		m_process->kill();
+		m_process->waitForFinished();
+	}
+	m_process.reset();
+}
+
+bool AnalysisWorker::readLine(QByteArray& line, int timeout)
+{
+	while (!m_process->canReadLine()) {
+		if (!m_process->waitForReadyRead(timeout)) return false;  // Died or timed out
+	}
+	line = m_process->readLine().trimmed();
+	return true;
+}
+
+void AnalysisWorker::send(QByteArray const& line)
+{
+	m_process->write(line + '\n');
+	m_process->waitForBytesWritten();
+}
+
+bool AnalysisWorker::analyze(QString const& fileName, PitchAnalysis& result, PitchAnalysis::Progress& progress)
+{
+	for (unsigned attempt = 1; attempt <= maxAttempts; ++attempt) {
+		if (!m_process && (m_unavailable || !start())) return result.analyze(fileName, progress);
+		QString key = QString("composer-analysis-%1-%2-%3").arg(QCoreApplication::applicationPid()).arg(quintptr(this)).arg(++m_jobs);
+		bool complete;
+		if (job(key, fileName, result, progress, complete)) return complete;
+		std::cerr << "Analysis worker died or hung while analyzing " << fileName.toStdString() << " (attempt " << attempt << ")" << std::endl;
+		kill();  // A new one is started for the next attempt
+		removeStale(key);
+	}
+	throw std::runtime_error("Analysis failed repeatedly on " + fileName.toStdString());
+}
+
+bool AnalysisWorker::job(QString const& key, QString const& fileName, PitchAnalysis& result, PitchAnalysis::Progress& progress, bool& complete)
+{
+	send("ANALYZE " + key.toUtf8());
+	send(fileName.toUtf8());
+	QByteArray line;
+	QElapsedTimer silence;
+	silence.start();
+	double position = 0.0, duration = 0.0;
+	for (;;) {
+		if (!readLine(line, pollInterval)) {
+			if (m_process->state() != QProcess::Running || silence.elapsed() > hangTimeout) return false;
+			// The client must be able to stop (e.g. when the editor is closed) even if the worker does not ask
+			if (progress.update(position, duration)) continue;
+			kill();
+			removeStale(key);
+			complete = false;
+			return true;
+		}
+		silence.restart();
+		QList<QByteArray> fields = line.split(' ');
+		if (fields[0] == "PROGRESS" && fields.size() == 3) {
+			position = fields[1].toDouble();
+			duration = fields[2].toDouble();
+			send(progress.update(position, duration) ? "CONTINUE" : "STOP");
+		} else if (fields[0] == "ERROR") {
+			throw std::runtime_error(line.mid(6).constData());
+		} else if (fields[0] == "DONE" && fields.size() == 3) {
+			// The results are parsed right where the worker wrote them
+			QSharedMemory memory(key);
+			std::string error;
+			if (memory.attach(QSharedMemory::ReadOnly)) {
+				MemoryBuffer buffer(static_cast<char const*>(memory.constData()), std::min<qint64>(fields[2].toLongLong(), memory.size()));
+				std::istream is(&buffer);
+				try {
+					result.read(is);
+				} catch (std::exception& e) {
+					error = std::string("Invalid analysis results: ") + e.what();
+				}
+				memory.detach();
+			} else error = "Cannot read the analysis results: " + memory.errorString().toStdString();
+			send("RELEASE");
+			if (!error.empty()) throw std::runtime_error(error);
+			complete = fields[1] == "1";
+			return true;
+		}
+		// Other output is not from the protocol and gets ignored
+	}
+}
+
+int AnalysisWorker::serve()
+{
+	std::cout << "READY" << std::endl;
+	std::string command, path, reply;
+	while (std::getline(std::cin, command)) {
+		if (command.compare(0, 8, "ANALYZE ") != 0) continue;
+		QString key = QString::fromUtf8(command.substr(8).c_str());
+		if (!std::getline(std::cin, path)) break;
+		PitchAnalysis analysis;
+		bool complete;
+		try {
+			WorkerProgress progress;
+			complete = analysis.analyze(QString::fromUtf8(path.c_str()), progress);
+		} catch (std::exception& e) {
+			std::string message = e.what();
+			std::replace(message.begin(), message.end(), '\n', ' ');
+			std::cout << "ERROR " << message << std::endl;
+			continue;
+		}
+		std::ostringstream os(std::ios::binary);
+		analysis.write(os);
+		std::string const& data = os.str();
+		// Kept until the client has read it
+		QSharedMemory memory(key);
+		if (!memory.create(data.size())) {
+			std::cout << "ERROR Cannot share the analysis results: " << memory.errorString().toStdString() << std::endl;
+			continue;
+		}
+		std::memcpy(memory.data(), data.data(), data.size());
+		std::cout << "DONE " << complete << ' ' << data.size() << std::endl;
+		if (!std::getline(std::cin, reply)) break;
+	}
+	return EXIT_SUCCESS;
+}
+
+int AnalysisWorker::batch(QStringList const& files, int workers)
+{
+	QElapsedTimer timer;
+	timer.start();
+	BatchQueue queue(files);
+	// Separate processes share no allocator or locks, so throughput grows with the cores
+	if (workers <= 0) workers = QThread::idealThreadCount();
+	std::vector<BatchThread*> threads(std::max(1, std::min(workers, files.size())));
+	for (std::size_t i = 0; i < threads.size(); ++i) {
+		threads[i] = new BatchThread(queue);
+		threads[i]->start();
+	}
+	for (std::size_t i = 0; i < threads.size(); ++i) {
+		threads[i]->wait();
+		delete threads[i];
+	}
+	double seconds = timer.elapsed() / 1000.0;
+	std::cout << files.size() << " files with " << threads.size() << " workers in " << seconds << " s, "
+	  << queue.failed() << " failed" << std::endl;
+	// Compare runs with different --workers counts to see how the analysis scales
+	if (queue.analyzed() && seconds > 0.0) {
+		double speed = queue.audio() / seconds;
+		std::cout << "Throughput: " << queue.analyzed() / seconds << " files/s, " << speed << "x realtime ("
+		  << speed / threads.size() << "x per worker)" << std::endl;
+	}
+	return queue.failed() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "analysis.hh"
+#include <QByteArray>
+#include <QScopedPointer>
+#include <QString>
+#include <QStringList>
+
+class QProcess;
+
+/// Pitch analysis in a worker process, so that a decoder crashing on a broken file cannot take the editor down
+/** The worker is this program started with --analysis-worker. It takes jobs (a shared memory
+  * key and a music file) from its standard input, reports the progress on its standard output
+  * (the client replies whether to go on) and writes the results into a shared memory segment,
+  * which the client parses in place before telling the worker to release it.
+  * The worker is kept running for the next jobs. If it dies during a job or stays silent for a
+  * minute, it is killed, a new one is started and the job is tried again. While the worker is
+  * silent, the client is still asked regularly whether to go on, so that it can stop at any time.
+  * Use each AnalysisWorker from a single thread only.
+ */
+class AnalysisWorker {
+public:
+	static const unsigned maxAttempts = 3;  ///< Crashes or hangs on the same file before giving up
+
+	AnalysisWorker();
+	~AnalysisWorker();
+	/// Analyze a music file in the worker (or in this process if no worker can be started)
+	/// @return as PitchAnalysis::analyze, throws std::runtime_error on errors and repeated crashes
+	bool analyze(QString const& fileName, PitchAnalysis& result, PitchAnalysis::Progress& progress);
+
+	/// The main loop of a worker process (for the --analysis-worker command line option)
+	/// @return the process exit code
+	static int serve();
+	/// Analyze music files into the analysis cache (for the --analyze command line option)
+	/// @param workers the number of worker processes, zero for one per core
+	/// @return the process exit code
+	static int batch(QStringList const& files, int workers = 0);
+
+private:
+	bool start();
+	void stop();
+	void kill();
+	/// @return false if the worker died or hung
+	bool job(QString const& key, QString const& fileName, PitchAnalysis& result, PitchAnalysis::Progress& progress, bool& complete);
+	bool readLine(QByteArray& line, int timeout);
+	void send(QByteArray const& line);
+
+	QScopedPointer<QProcess> m_process;
+	unsigned m_jobs;  ///< For unique shared memory keys
+	bool m_unavailable;  ///< Starting a worker has failed, so it is not tried again
+};
+
@@ -0,0 +1,155 @@
+#include "audiodevice.hh"
+#include <QAudioOutput>
+#include <QAudioDeviceInfo>
+#include <QAudioFormat>
+#include <QDebug>
+#include <QIODevice>
+#include <algorithm>
+
+
+// QtAudioDevice
+
+namespace {
+	/// The only format that the mixer produces
+	QAudioFormat playbackFormat(unsigned rate) {
+		QAudioFormat format;
+		format.setChannelCount(AudioDevice::channels);
+		format.setSampleRate(rate);
+		format.setSampleSize(16);
+		format.setSampleType(QAudioFormat::SignedInt);
+		format.setByteOrder(QAudioFormat::LittleEndian);
+		format.setCodec("audio/pcm");
+		return format;
+	}
+}
+
+void QtAudioDevice::probe()
+{
+	// The backend plugin gets loaded and cached by the first query, the formats come from the device itself
+	QAudioDeviceInfo device = QAudioDeviceInfo::defaultOutputDevice();
+	if (device.isNull()) qWarning() << "No audio output device found";
+	else device.supportedSampleRates();
+}
+
+unsigned QtAudioDevice::nearestRate(unsigned rate) const
+{
+	QAudioDeviceInfo device = QAudioDeviceInfo::defaultOutputDevice();
+	QAudioFormat format = playbackFormat(rate);
+	if (device.isNull() || device.isFormatSupported(format)) return rate;
+	// Only the rate is taken, the mixer resamples to any rate but always produces 16-bit stereo
+	int nearest = device.nearestFormat(format).sampleRate();
+	return nearest > 0 ? nearest : rate;
+}
+
+void QtAudioDevice::start(QIODevice *source, unsigned rate, unsigned bufferFrames)
+{
+	stop();
+	QAudioFormat format = playbackFormat(rate);
+	if (!QAudioDeviceInfo::defaultOutputDevice().isFormatSupported(format))
+		qWarning() << "Playback format not supported by the audio device: 16-bit stereo at" << rate << "Hz";
+	m_output = new QAudioOutput(format, this);
+	m_output->setBufferSize(bufferFrames * bytesPerFrame);
+	connect(m_output, SIGNAL(stateChanged(QAudio::State)), this, SLOT(handleStateChanged(QAudio::State)));
+	m_output->start(source);
+}
+
+void QtAudioDevice::stop()
+{
+	if (!m_output) return;
+	m_output->stop();
+	delete m_output;
+	m_output = NULL;
+}
+
+unsigned QtAudioDevice::buffered() const
+{
+	return m_output ? (m_output->bufferSize() - m_output->bytesFree()) / bytesPerFrame : 0;
+}
+
+void QtAudioDevice::handleStateChanged(QAudio::State state)
+{
+	if (state == QAudio::StoppedState && m_output->error() != QAudio::NoError) {
+		qWarning() << "Playback audio error code" << m_output->error();
+		emit error(tr("Audio output error %1").arg(m_output->error()));
+	}
+}
+
+
+// VirtualAudioDevice
+
+VirtualAudioDevice::VirtualAudioDevice(unsigned periodFrames, unsigned seed, QObject *parent):
+  AudioDevice(parent), m_source(), m_period(std::max(1u, periodFrames)), m_seed(seed), m_jitter(), m_fixedRate(), m_rate(), m_bufferFrames(),
+  m_clock(), m_nextCallback(), m_callbacks(), m_stallEnd(), m_underruns(), m_starved()
+{}
+
+void VirtualAudioDevice::start(QIODevice *source, unsigned rate, unsigned bufferFrames)
+{
+	m_source = source;
+	m_rate = rate;
+	m_bufferFrames = std::max(bufferFrames, m_period);
+	m_buffer.clear();
+	m_clock = m_callbacks = m_stallEnd = 0;
+	m_underruns = 0;
+	m_starved = false;
+	m_recording.clear();
+	callback();  // Filled before the first frame is played, as a sound card does
+}
+
+void VirtualAudioDevice::stop()
+{
+	m_source = NULL;
+	m_buffer.clear();
+}
+
+void VirtualAudioDevice::stall(unsigned frames)
+{
+	m_stallEnd = std::max(m_stallEnd, m_clock + frames);
+}
+
+void VirtualAudioDevice::advance(unsigned frames)
+{
+	unsigned long long end = m_clock + frames;
+	while (m_source && m_clock < end) {
+		// Play until the next callback (or the end)
+		unsigned long long until = std::min(end, m_nextCallback);
+		for (; m_clock < until; ++m_clock) {
+			if (m_buffer.empty()) {
+				// Silence until the buffer gets filled again
+				if (!m_starved) ++m_underruns;
+				m_starved = true;
+				m_recording.insert(m_recording.end(), channels, 0);
+				continue;
+			}
+			m_starved = false;
+			for (unsigned ch = 0; ch < channels; ++ch) {
+				m_recording.push_back(m_buffer.front());
+				m_buffer.pop_front();
+			}
+		}
+		if (m_clock == m_nextCallback) callback();
+	}
+}
+
+void VirtualAudioDevice::callback()
+{
+	if (m_clock >= m_stallEnd) {
+		// Fill the free space in whole periods
+		unsigned frames = (m_bufferFrames - buffered()) / m_period * m_period;
+		if (frames) {
+			m_pull.resize(frames * bytesPerFrame);
+			qint64 bytes = m_source->read(&m_pull[0], m_pull.size());
+			short const* samples = reinterpret_cast<short const*>(&m_pull[0]);
+			m_buffer.insert(m_buffer.end(), samples, samples + std::max<qint64>(0, bytes) / sizeof(short));
+		}
+	}
+	schedule();
+}
+
+void VirtualAudioDevice::schedule()
+{
+	// Due once per period, late by up to the jitter (but never before the previous one)
+	++m_callbacks;
+	m_seed = m_seed * 1103515245 + 12345;
+	unsigned late = m_jitter ? (m_seed >> 16) % (m_jitter + 1) : 0;
+	m_nextCallback = std::max(m_clock + 1, m_callbacks * m_period + late);
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <QObject>
+#include <QAudio>
+#include <QString>
+#include <deque>
+#include <set>
+#include <vector>
+
+class QIODevice;
+class QAudioOutput;
+
+/// Where the playback goes: pulls 16-bit stereo samples from a source device
+class AudioDevice: public QObject
+{
+	Q_OBJECT
+public:
+	static const unsigned channels = 2;
+	static const unsigned bytesPerFrame = channels * 2;
+
+	AudioDevice(QObject *parent = NULL): QObject(parent) {}
+	virtual ~AudioDevice() {}
+	/// Load the backend and find the device (the slow part of the first start), may be called from any thread
+	virtual void probe() {}
+	/// The rate that the device plays at when asked for the given one (the nearest it supports)
+	virtual unsigned nearestRate(unsigned rate) const { return rate; }
+	/// Start pulling from the source (which must stay open and never run out)
+	/// @param bufferFrames how much the device may buffer ahead of what is heard
+	virtual void start(QIODevice *source, unsigned rate, unsigned bufferFrames) = 0;
+	virtual void stop() = 0;
+	/// Frames pulled from the source but not heard yet
+	virtual unsigned buffered() const = 0;
+
+signals:
+	void error(QString const& message);
+};
+
+
+/// The sound card through QAudioOutput
+class QtAudioDevice: public AudioDevice
+{
+	Q_OBJECT
+public:
+	QtAudioDevice(QObject *parent = NULL): AudioDevice(parent), m_output() {}
+	~QtAudioDevice() { stop(); }
+	void probe();
+	unsigned nearestRate(unsigned rate) const;
+	void start(QIODevice *source, unsigned rate, unsigned bufferFrames);
+	void stop();
+	unsigned buffered() const;
+
+private slots:
+	void handleStateChanged(QAudio::State state);
+
+private:
+	QAudioOutput *m_output;
+};
+
+
+/// A sound card simulated in frames instead of real time, for measuring timing without sound hardware
+/** Nothing happens until advance() is called. The device plays a frame per frame of its clock
+  * and refills its buffer in callbacks once per period, which can be made late by a
+  * deterministic pseudo-random jitter or skipped altogether (stalls) to cause underruns.
+  * Everything played is recorded, so the sample at recording()[2 * n] was heard at frame n.
+ */
+class VirtualAudioDevice: public AudioDevice
+{
+	Q_OBJECT
+public:
+	VirtualAudioDevice(unsigned periodFrames = 256, unsigned seed = 1, QObject *parent = NULL);
+	unsigned nearestRate(unsigned rate) const { return m_fixedRate ? m_fixedRate : rate; }
+	void start(QIODevice *source, unsigned rate, unsigned bufferFrames);
+	void stop();
+	unsigned buffered() const { return m_buffer.size() / channels; }
+
+	/// Play at this rate only (zero for any), as sound cards that cannot change their rate do
+	void setFixedRate(unsigned rate) { m_fixedRate = rate; }
+	/// Make each callback late by up to this many frames
+	void setJitter(unsigned frames) { m_jitter = frames; }
+	/// Skip the callbacks due in the given range of frames (from now on)
+	void stall(unsigned frames);
+	/// Run the clock forward, playing and calling back as a sound card would
+	void advance(unsigned frames);
+
+	unsigned rate() const { return m_rate; }
+	unsigned long long clock() const { return m_clock; }  ///< Frames played since start
+	unsigned underruns() const { return m_underruns; }  ///< Times the buffer ran out
+	std::vector<short> const& recording() const { return m_recording; }
+
+private:
+	void callback();
+	void schedule();
+
+	QIODevice *m_source;
+	unsigned m_period;
+	unsigned m_seed;
+	unsigned m_jitter;
+	unsigned m_fixedRate;
+	unsigned m_rate;
+	unsigned m_bufferFrames;
+	unsigned long long m_clock;
+	unsigned long long m_nextCallback;  ///< Clock of the next callback
+	unsigned long long m_callbacks;  ///< Callbacks due so far (also the period of the next one)
+	unsigned long long m_stallEnd;  ///< Callbacks due before this clock are skipped
+	unsigned m_underruns;
+	bool m_starved;  ///< Playing silence as the buffer has run out
+	std::deque<short> m_buffer;
+	std::vector<char> m_pull;
+	std::vector<short> m_recording;
+};
@@ -0,0 +1,140 @@
+#include "chartlint.hh"
+#include "song.hh"
+#include <QFileInfo>
+#include <QStringList>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+	static const double maxCents = 50.0;  ///< Pitch differences beyond this are reported
+	static const double minCoverage = 0.3;  ///< Notes voiced less than this are reported
+	static const double maxOnsetOffset = 0.15;  ///< Seconds of timing difference to the nearest onset that is still fine
+	static const double onsetSearch = 0.5;  ///< Onsets further than this from the note begin are not considered
+	static const float onsetJump = 0.5f;  ///< A pitch jump of this many semitones starts a new note
+
+	/// Analysis that never stops (for headless use)
+	struct NoProgress: public PitchAnalysis::Progress {
+		bool update(double, double) { return true; }
+	};
+}
+
+QString NoteCheck::problems() const
+{
+	QStringList list;
+	if (octaves != 0) list << QString("octave %1%2").arg(octaves > 0 ? "+" : "").arg(octaves);
+	if (std::abs(cents) > maxCents) list << QString("pitch %1%2 cents").arg(cents > 0 ? "+" : "").arg(qRound(cents));
+	if (coverage < minCoverage) list << QString("voiced %1 %").arg(qRound(100.0 * coverage));
+	if (std::abs(onsetOffset) > maxOnsetOffset) list << QString("begins %1 s %2").arg(QString::number(std::abs(onsetOffset), 'f', 2)).arg(onsetOffset > 0 ? "late" : "early");
+	return list.join(", ");
+}
+
+ChartLint::ChartLint(PitchAnalysis const& analysis): m_hopTime(analysis.hopTime)
+{
+	// Dense pitch track: the loudest voiced path point of each hop
+	std::size_t hops = analysis.voicing.size();
+	m_pitch.assign(hops, getNaN());
+	std::vector<float> level(hops, -getInf());
+	for (PitchAnalysis::Paths::const_iterator it = analysis.paths.begin(); it != analysis.paths.end(); ++it) {
+		PitchPath const& path = *it;
+		for (unsigned i = 0; i < path.size(); ++i) {
+			std::size_t hop = path.beginHop() + i;
+			if (hop >= hops || analysis.voicing[hop] < 0.5f) continue;
+			PitchFragment const fragment = path[i];
+			if (fragment.level <= level[hop]) continue;
+			level[hop] = fragment.level;
+			m_pitch[hop] = fragment.note;
+		}
+	}
+	// Onsets where voiced pitch begins or jumps to another note
+	for (std::size_t hop = 0; hop < hops; ++hop) {
+		if (m_pitch[hop] != m_pitch[hop]) continue;
+		if (hop == 0 || !(std::abs(m_pitch[hop] - m_pitch[hop - 1]) < onsetJump)) m_onsets.push_back(hop * m_hopTime);
+	}
+}
+
+NoteCheck ChartLint::check(Note const& note) const
+{
+	NoteCheck result;
+	if (!(m_hopTime > 0.0)) return result;
+	// Differences to the charted note at the voiced hops of the note
+	int first = std::max(0, int(std::ceil(note.begin / m_hopTime)));
+	int last = std::min(int(m_pitch.size()) - 1, int(std::floor(note.end / m_hopTime)));
+	std::vector<float> diffs;
+	for (int hop = first; hop <= last; ++hop) {
+		if (m_pitch[hop] == m_pitch[hop]) diffs.push_back(m_pitch[hop] - note.note);
+	}
+	if (last >= first) result.coverage = double(diffs.size()) / (last - first + 1);
+	if (!diffs.empty()) {
+		std::vector<float>::iterator mid = diffs.begin() + diffs.size() / 2;
+		std::nth_element(diffs.begin(), mid, diffs.end());
+		// Only count it as an octave error if the pitch class is about right
+		int octaves = round(*mid / 12.0);
+		if (std::abs(*mid - 12.0 * octaves) < 1.0) result.octaves = octaves;
+		result.cents = 100.0 * (*mid - 12.0 * result.octaves);
+	}
+	// The nearest onset
+	std::vector<double>::const_iterator it = std::lower_bound(m_onsets.begin(), m_onsets.end(), note.begin);
+	double best = onsetSearch;
+	if (it != m_onsets.end() && *it - note.begin < best) { best = *it - note.begin; result.onsetOffset = -best; }
+	if (it != m_onsets.begin() && note.begin - *(it - 1) < best) result.onsetOffset = note.begin - *(it - 1);
+	return result;
+}
+
+std::vector<NoteCheck> ChartLint::check(Notes const& notes) const
+{
+	std::vector<NoteCheck> result;
+	result.reserve(notes.size());
+	for (Notes::const_iterator it = notes.begin(); it != notes.end(); ++it) {
+		NoteCheck c;
+		if (it->type == Note::FREESTYLE || it->type == Note::SLEEP) c.coverage = 1.0;  // Not sung at any particular pitch or time
+		else c = check(*it);
+		result.push_back(c);
+	}
+	return result;
+}
+
+unsigned ChartLint::report(std::ostream& os, Notes const& notes, std::vector<NoteCheck> const& checks)
+{
+	unsigned count = 0;
+	for (std::size_t i = 0; i < notes.size() && i < checks.size(); ++i) {
+		QString problems = checks[i].problems();
+		if (problems.isEmpty()) continue;
+		++count;
+		os << QString("%1 s  note %2  \"%3\": %4")
+		  .arg(QString::number(notes[i].begin, 'f', 3))
+		  .arg(notes[i].note)
+		  .arg(notes[i].syllable.trimmed())
+		  .arg(problems).toStdString() << '\n';
+	}
+	os << count << " of " << notes.size() << " notes have problems" << std::endl;
+	return count;
+}
+
+int checkChart(QString const& songFile)
+{
+	try {
+		QFileInfo finfo(songFile);
+		Song song(finfo.path() + "/", finfo.fileName());
+		// Vocals only track gives the most reliable pitch
+		QString music = song.music.value("vocals");
+		if (music.isEmpty() || !QFileInfo(music).exists()) music = song.music.value("background");
+		if (music.isEmpty()) throw std::runtime_error("The song has no music file");
+		PitchAnalysis analysis;
+		NoProgress progress;
+		if (!analysis.load(music)) {
+			analysis.analyze(music, progress);
+			analysis.save(music);
+		}
+		ChartLint lint(analysis);
+		VocalTrack const& track = song.getVocalTrack();
+		unsigned problems = ChartLint::report(std::cout, track.notes, lint.check(track.notes));
+		return problems ? EXIT_FAILURE : EXIT_SUCCESS;
+	} catch (std::exception& e) {
+		std::cerr << "Error checking " << songFile.toStdString() << ": " << e.what() << std::endl;
+	}
+	return EXIT_FAILURE;
+}
+
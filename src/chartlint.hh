@@ -0,0 +1,42 @@
+#pragma once
+
+#include "notes.hh"
+#include "analysis.hh"
+#include "util.hh"
+#include <iosfwd>
+#include <vector>
+
+/// Result of checking a single note against the analysed pitch
+struct NoteCheck {
+	double cents;  ///< Median pitch difference (analysed - charted) in cents, octave errors removed (NaN if nothing voiced)
+	int octaves;  ///< The analysed pitch is this many octaves away from the charted note
+	double coverage;  ///< Share of the note's duration with a voiced pitch (0..1)
+	double onsetOffset;  ///< Note begin minus the nearest onset in seconds (NaN if no onset nearby)
+	NoteCheck(): cents(getNaN()), octaves(), coverage(), onsetOffset(getNaN()) {}
+	/// Human readable description of the problems found, empty if the note looks good
+	QString problems() const;
+};
+
+/// Chart quality checking, the chart is scored against the pitch analysis like a singer would be
+/** The analysis is indexed once into a dense per-hop pitch track (the strongest voiced path
+  * at each hop) and a sorted list of onsets, after which each note is checked by a short
+  * linear pass over its own hops and a binary search for the nearest onset.
+ */
+class ChartLint {
+public:
+	ChartLint(PitchAnalysis const& analysis);
+	NoteCheck check(Note const& note) const;
+	std::vector<NoteCheck> check(Notes const& notes) const;
+	/// Write a report of the problematic notes, returns the number of notes with problems
+	static unsigned report(std::ostream& os, Notes const& notes, std::vector<NoteCheck> const& checks);
+
+private:
+	double m_hopTime;
+	std::vector<float> m_pitch;  ///< The strongest voiced pitch of each hop (NaN if none)
+	std::vector<double> m_onsets;  ///< Times where a voiced pitch starts or jumps (sorted)
+};
+
+/// Headless mode: analyse the music of a song file and report problems on standard output
+/// @return the process exit code
+int checkChart(QString const& songFile);
+
@@ -3,25 +3,33 @@
 #include <QScrollBar>
 #include <QMessageBox>
 #include <QFileDialog>
+#include <QDir>
 #include <QDesktopServices>
 #include <QClipboard>
 #include <QMimeData>
+#include <QProgressDialog>
 #include <QWhatsThis>
-#include <QUrl>
 #include <QCloseEvent>
 #include <QPainter>
 #include <QSettings>
 #include <QTimer>
-#include <QMediaPlayer>
+#include <algorithm>
 #include <iostream>
+#include <cmath>
 #include "config.hh"
 #include "editorapp.hh"
 #include "notelabel.hh"
 #include "songparser.hh"
 #include "songwriter.hh"
+#include "pitchmidi.hh"
 #include "textcodecselector.hh"
 #include "gettingstarted.hh"
 #include "busydialog.hh"
+#include "prewarmer.hh"
+#include "timeline.hh"
+#include "timelinedialog.hh"
+#include "startuptrace.hh"
+#include "renderstats.hh"
 
 namespace {
 	static const QString PROJECT_SAVE_FILE_EXTENSION = "songproject"; // FIXME: Nice extension here
@@ -43,8 +51,8 @@ namespace {
 }
 
 EditorApp::EditorApp(QWidget *parent)
-	: QMainWindow(parent), gettingStarted(), noteGraph(), player(), synth(), statusbarProgress(),
-	projectFileName(), latestPath(QDir::homePath()), currentBufferPlayer()
+	: QMainWindow(parent), gettingStarted(), noteGraph(), player(), synth(), prewarmer(), statusbarProgress(),
+	medleyWriter(), medleyDialog(), projectFileName(), latestPath(QDir::homePath()), painted()
 {
 	ui.setupUi(this);
 	readSettings();
@@ -92,43 +100,16 @@ EditorApp::EditorApp(QWidget *parent)
 	setWindowModified(false);
 	updateMenuStates();
 
-	// Audio stuff
-	player = new QMediaPlayer(this);
-	player->setNotifyInterval(100);
-	bufferPlayers[0] = new BufferPlayer(this);
-	bufferPlayers[1] = new BufferPlayer(this);
-
-	// Audio info
-	QAudioDeviceInfo info(QAudioDeviceInfo::defaultOutputDevice());
-	qDebug() << "QAudioDevice info";
-	qDebug() << "Supported codecs:";
-	foreach (const QString& codec, info.supportedCodecs())
-		qDebug() << codec;
-	qDebug() << "Supported sample rates:";
-	foreach (const int& num, info.supportedSampleRates())
-		qDebug() << num;
-	qDebug() << "Supported sample sizes:";
-	foreach (const int& num, info.supportedSampleSizes())
-		qDebug() << num;
-	qDebug() << "Supported sample types:";
-	foreach (const int& num, info.supportedSampleTypes())
-		qDebug() << num;
-	qDebug() << "Supported byte orders:";
-	foreach (const int& num, info.supportedByteOrders())
-		qDebug() << num;
-	qDebug() << "Supported channel counts:";
-	foreach (const int& num, info.supportedChannelCounts())
-		qDebug() << num;
-
-
-	// Audio signals
+	// Audio stuff (the output is opened after the window is shown, see deferredInit)
+	player = new PlaybackEngine(this);
 	connect(player, SIGNAL(positionChanged(qint64)), this, SLOT(audioTick(qint64)));
-	connect(player, SIGNAL(stateChanged(QMediaPlayer::State)), this, SLOT(playerStateChanged(QMediaPlayer::State)));
-	connect(player, SIGNAL(error(QMediaPlayer::Error)), this, SLOT(playerError(QMediaPlayer::Error)));
+	connect(player, SIGNAL(stateChanged(PlaybackEngine::State)), this, SLOT(playerStateChanged(PlaybackEngine::State)));
+	connect(player, SIGNAL(error(QString)), this, SLOT(playerError(QString)));
 	connect(player, SIGNAL(metaDataChanged()), this, SLOT(metaDataChanged()));
+	prewarmer = new AnalysisPrewarmer(this);
 
 	// The piano keys
-	piano = new Piano(ui.topFrame);
+	piano = new Piano(player, ui.topFrame);
 	QHBoxLayout *hl = new QHBoxLayout(ui.topFrame);
 	hl->addWidget(piano);
 	hl->addWidget(ui.noteGraphScroller);
@@ -139,19 +120,53 @@ EditorApp::EditorApp(QWidget *parent)
 	setupNoteGraph();
 	updateNoteInfo(NULL);
 
-	piano->updatePixmap(noteGraph);
+	piano->updateSelection(noteGraph);
 
 	song.reset(new Song);
 
 	// Set status tips to tool tips
 	handleTips(ui.tabGeneral);
 	handleTips(ui.tabSong);
+}
+
+bool EditorApp::event(QEvent *event)
+{
+	bool ret = QMainWindow::event(event);
+	// The whole window gets painted on its first update request
+	if (event->type() == QEvent::UpdateRequest && !painted) {
+		painted = true;
+		StartupTrace::mark("first paint");
+		QTimer::singleShot(0, this, SLOT(deferredInit()));
+	}
+	return ret;
+}
+
+void EditorApp::deferredInit()
+{
+	// Loading the audio backend and finding the device may take seconds on some systems, so it is
+	// done in the background once the window is visible (the first playback would do it otherwise)
+	connect(player, SIGNAL(ready()), this, SLOT(audioReady()));
+	player->initInBackground();
 
 	QSettings settings;
 	if (settings.value("showhelp", true).toBool())
 		on_actionGettingStarted_triggered();
 }
 
+void EditorApp::audioReady()
+{
+	// The device was probed in the background, but the output is opened here on the GUI thread
+	// (QAudioOutput belongs to the thread that creates it), so this includes the time it took
+	StartupTrace::mark("audio ready");
+	// Input gets handled once the events queued meanwhile (paints, the getting started help) are done
+	QTimer::singleShot(0, this, SLOT(traceInteractive()));
+}
+
+void EditorApp::traceInteractive()
+{
+	StartupTrace::mark("interactive");
+}
+
 void EditorApp::setupNoteGraph()
 {
 	noteGraph = new NoteGraphWidget(NULL);
@@ -176,8 +191,10 @@ void EditorApp::setupNoteGraph()
 	connect(ui.chkGrabSeekHandle, SIGNAL(toggled(bool)), noteGraph, SLOT(setSeekHandleWrapToViewport(bool)));
 	connect(ui.cmdMusicFile, SIGNAL(clicked()), this, SLOT(on_actionMusicFile_triggered()));
 	noteGraph->setSeekHandleWrapToViewport(ui.chkGrabSeekHandle->isChecked());
+	noteGraph->setLanguage(song ? song->language : QString());
 	connect(noteGraph, SIGNAL(analyzeProgress(int, int)), this, SLOT(analyzeProgress(int, int)));
-	connect(noteGraph, SIGNAL(seeked(qint64)), player, SLOT(setPosition(qint64)));
+	if (player) connect(noteGraph, SIGNAL(seeked(qint64)), player, SLOT(setPosition(qint64)));
+	if (piano) connect(noteGraph, SIGNAL(playbackPitch(float)), piano, SLOT(setLivePitch(float)));
 }
 
 void EditorApp::operationDone(const Operation &op)
@@ -260,6 +277,8 @@ void EditorApp::updateMenuStates()
 	ui.actionSelectAllAfter->setEnabled(hasSelectedNotes);
 	bool zoom = (noteGraph && noteGraph->getZoomLevel() != 100);
 	ui.actionResetZoom->setEnabled(zoom);
+	// Insert menu
+	ui.actionMusicTimeline->setEnabled(!medleyWriter);
 	// Window title
 	updateTitle();
 }
@@ -309,8 +328,22 @@ void EditorApp::updateNoteInfo(NoteLabel *note)
 	updateMenuStates();
 	// Update piano
 	if (piano && noteGraph) {
-		piano->updatePixmap(noteGraph);
+		piano->updateSelection(noteGraph);
+	}
+}
+
+void EditorApp::updateLevels()
+{
+	// Guide tones and note previews follow the loudness of the music (measured while analyzing),
+	// but their peaks stay below those of the music so that they do not push the mix into clipping
+	PitchAnalysis const* analysis = noteGraph ? noteGraph->analysis() : NULL;
+	qreal volume = 1.0;
+	if (analysis && analysis->loudness == analysis->loudness) {
+		double gain = analysis->loudness - Synth::loudness();
+		if (analysis->truePeak > -getInf()) gain = std::min(gain, double(analysis->truePeak) - Synth::truePeak());
+		volume = clamp(std::pow(10.0, gain / 20.0), 0.05, 1.0);
 	}
+	player->setVoiceVolume(volume);
 }
 
 void EditorApp::analyzeProgress(int value, int maximum)
@@ -319,6 +352,7 @@ void EditorApp::analyzeProgress(int value, int maximum)
 		if (value == maximum) {
 			statusbarProgress->hide();
 			statusbarButton->hide();
+			updateLevels();
 		} else {
 			statusbarProgress->setMaximum(maximum);
 			statusbarProgress->setValue(value);
@@ -345,6 +379,7 @@ void EditorApp::on_actionNew_triggered()
 		updateNoteInfo(NULL);
 		statusbarProgress->hide();
 		ui.txtTitle->clear(); ui.txtArtist->clear(); ui.txtGenre->clear(); ui.txtYear->clear();
+		ui.spinVideoGap->setValue(0.0); ui.spinVideoGap->setEnabled(false);
 		ui.valMusicFile->clear();
 		setWindowModified(false);
 	}
@@ -410,8 +445,11 @@ void EditorApp::openFile(QString fileName)
 				QString musicfile = song->music["EDITOR"]; // Preserve the music file
 				song.reset(new Song(QString(finfo.path()+"/"), finfo.fileName()));
 				song->music["EDITOR"] = musicfile;
-				noteGraph->setLyrics(song->getVocalTrack());
+				noteGraph->setLanguage(song->language);
+				noteGraph->setLyrics(song->getVocalTracks());
 				updateSongMeta(true);
+				updateVideo(); // Also clears the video of the previous song
+				prewarmer->prewarm(fileName); // Get the neighbouring songs ready
 			}
 		} catch (const std::exception& e) {
 			QMessageBox::critical(this, tr("Error loading file!"), e.what());
@@ -492,7 +530,7 @@ void EditorApp::exportSong(QString format, QString dialogTitle)
 	if (!path.isNull()) {
 		latestPath = path;
 		// Sync notes
-		if (noteGraph) song->insertVocalTrack(TrackName::LEAD_VOCAL, noteGraph->getVocalTrack());
+		if (noteGraph) song->setVocalTracks(noteGraph->getVocalTracks());
 		// Pick exporter
 		try {
 			if (format == "XML") SingStarXMLWriter(*song.data(), path);
@@ -511,6 +549,25 @@ void EditorApp::on_actionUltraStarTXT_triggered() { exportSong("TXT", tr("Export
 
 void EditorApp::on_actionFoFMIDI_triggered() { exportSong("INI", tr("Export Frets on Fire MIDI")); }
 
+void EditorApp::on_actionPitchMIDI_triggered()
+{
+	PitchAnalysis const* analysis = noteGraph ? noteGraph->analysis() : NULL;
+	if (!analysis) {
+		QMessageBox::warning(this, tr("No pitch to export"), tr("Open a music file and wait for its analysis to finish first."));
+		return;
+	}
+	QString fileName = QFileDialog::getSaveFileName(this, tr("Export pitch as MIDI"), latestPath, tr("MIDI files (*.mid)"));
+	if (fileName.isNull()) return;
+	latestPath = QFileInfo(fileName).path();
+	PitchMIDIExport exporter;
+	if (song && song->bpm > 0) exporter.tempo = song->bpm;
+	try {
+		exporter.write(*analysis, fileName);
+	} catch (const std::exception& e) {
+		QMessageBox::critical(this, tr("Error exporting pitch!"), e.what());
+	}
+}
+
 void EditorApp::on_actionLRC_triggered() { exportSong("LRC", tr("Export LRC")); }
 
 void EditorApp::on_actionLyricsToFile_triggered()
@@ -615,7 +672,7 @@ void EditorApp::on_actionAntiAliasing_toggled(bool checked)
 // Insert menu
 
 
-void EditorApp::setMusic(QString filepath, bool primary)
+void EditorApp::setMusic(QString filepath, bool primary, bool load)
 {
 	ui.valMusicFile->setText(filepath);
 	song->music[primary ? "EDITOR" : "ADDITIONAL"] = filepath;
@@ -623,10 +680,17 @@ void EditorApp::setMusic(QString filepath, bool primary)
 	updateMenuStates();
 	if (primary) {
 		// Metadata is updated when it becomes available (signal)
-		player->setMedia(QMediaContent(QUrl::fromLocalFile(filepath)));
-		noteGraph->updateMusicPos(0, false);
+		if (load) {
+			try {
+				player->setMedia(filepath);
+			} catch (std::exception& e) {
+				QMessageBox::critical(this, tr("Error loading music!"), e.what());
+			}
+			noteGraph->updateMusicPos(0, false);
+		}
 		// Fire up analyzer
 		noteGraph->analyzeMusic(filepath);
+		prewarmer->prewarm(filepath);
 	} else noteGraph->analyzeMusic(filepath, 1);
 }
 
@@ -656,6 +720,98 @@ void EditorApp::on_actionAdditionalMusicFile_triggered()
 	}
 }
 
+void EditorApp::on_actionMusicTimeline_triggered()
+{
+	if (medleyWriter) return;
+	MusicTimelineDialog dialog(latestPath, this);
+	if (dialog.exec() != QDialog::Accepted) return;
+	latestPath = dialog.path();
+	Timeline::Segments segments = dialog.segments();
+	// The song and the analysis need a single file, the player takes the files meanwhile
+	QString outName = QFileDialog::getSaveFileName(this, tr("Save joined music"),
+			QDir(song->path.isEmpty() ? latestPath : song->path).filePath("music.wav"),
+			tr("WAV files") + " (*.wav)");
+	if (outName.isNull()) return;
+	try {
+		player->setMedia(segments);
+	} catch (const std::exception& e) {
+		QMessageBox::critical(this, tr("Error joining music!"), e.what());
+		return;
+	}
+	noteGraph->updateMusicPos(0, false);
+	medleyDialog = new QProgressDialog(tr("Writing the joined music..."), tr("Cancel"), 0, 1000, this);
+	medleyDialog->setWindowTitle(tr("Music timeline"));
+	QTimer *timer = new QTimer(medleyDialog);
+	connect(timer, SIGNAL(timeout()), this, SLOT(medleyProgress()));
+	timer->start(100);
+	medleyWriter.reset(new MedleyWriter(segments, outName));
+	connect(medleyWriter.data(), SIGNAL(finished()), this, SLOT(medleyFinished()));
+	medleyWriter->start();
+	updateMenuStates();
+}
+
+void EditorApp::medleyProgress()
+{
+	if (!medleyWriter || !medleyDialog) return;
+	if (medleyDialog->wasCanceled()) medleyWriter->cancel();
+	else medleyDialog->setValue(1000 * medleyWriter->progress());
+}
+
+void EditorApp::medleyFinished()
+{
+	if (!medleyWriter) return;
+	QString fileName = medleyWriter->fileName();
+	QString error = medleyWriter->error();
+	bool written = medleyWriter->written();
+	medleyWriter.reset();
+	if (medleyDialog) medleyDialog->deleteLater();
+	medleyDialog = NULL;
+	updateMenuStates();
+	// The player keeps the files either way, only the song is left without them
+	if (!error.isEmpty()) QMessageBox::critical(this, tr("Error joining music!"), error);
+	else if (!written) statusBarMessage(tr("Joining music cancelled, the song still has its previous music."));
+	else setMusic(fileName, true, false);
+}
+
+MedleyWriter::MedleyWriter(Timeline::Segments const& segments, QString const& fileName):
+  m_segments(segments), m_fileName(fileName), m_progress(), m_cancelled(), m_written()
+{}
+
+MedleyWriter::~MedleyWriter()
+{
+	cancel();
+	wait();
+}
+
+void MedleyWriter::cancel()
+{
+	QMutexLocker locker(&m_mutex);
+	m_cancelled = true;
+}
+
+double MedleyWriter::progress() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_progress;
+}
+
+void MedleyWriter::run()
+{
+	try {
+		Timeline timeline(m_segments);
+		m_written = timeline.writeWav(m_fileName, *this);
+	} catch (std::exception& e) {
+		m_error = QString::fromUtf8(e.what());
+	}
+}
+
+bool MedleyWriter::update(double position, double duration)
+{
+	QMutexLocker locker(&m_mutex);
+	m_progress = (duration > 0.0 ? clamp(position / duration, 0.0, 1.0) : 0.0);
+	return !m_cancelled;
+}
+
 void EditorApp::on_actionLyricsFromFile_triggered()
 {
 	if ((noteGraph && noteGraph->noteLabels().empty())
@@ -683,7 +839,7 @@ void EditorApp::on_actionLyricsFromFile_triggered()
 					== QMessageBox::Yes)
 				{
 					openFile(fileName);
-				} else noteGraph->setLyrics(text);
+				} else noteGraph->setLyrics(text, song ? song->language : QString());
 			}
 		}
 	}
@@ -702,7 +858,7 @@ void EditorApp::on_actionLyricsFromClipboard_triggered()
 				QMessageBox::Ok | QMessageBox::Cancel)
 			== QMessageBox::Ok)
 		{
-			noteGraph->setLyrics(text);
+			noteGraph->setLyrics(text, song ? song->language : QString());
 		}
 	} else {
 		QMessageBox::warning(this, tr("No text to paste"), tr("No suitable data on the clipboard."));
@@ -785,34 +941,47 @@ void EditorApp::updateSongMeta(bool readFromSongToUI)
 		if (ui.txtYear->text() != song->year) {
 			song->year = ui.txtYear->text();
 		}
+		if (ui.spinVideoGap->value() != song->videoGap) {
+			song->videoGap = ui.spinVideoGap->value();
+			updateVideo();
+		}
 	} else {
 		if (!song->title.isEmpty()) ui.txtTitle->setText(song->title);
 		if (!song->artist.isEmpty()) ui.txtArtist->setText(song->artist);
 		if (!song->genre.isEmpty()) ui.txtGenre->setText(song->genre);
 		if (!song->year.isEmpty()) ui.txtYear->setText(song->year);
+		ui.spinVideoGap->setValue(song->videoGap);
+		ui.spinVideoGap->setEnabled(!song->video.isEmpty());
 	}
 }
 
+void EditorApp::updateVideo()
+{
+	if (song->video.isEmpty()) noteGraph->setVideo(QString(), 0.0);
+	else noteGraph->setVideo(song->path + song->video, song->videoGap);
+}
+
 void EditorApp::metaDataChanged()
 {
 	if (player) {
-		//foreach (const QString& str, player->availableMetaData())
-		//	qDebug() << str;
-		if (!player->metaData("Title").toString().isEmpty())
-			song->title = player->metaData("Title").toString();
-		if (!player->metaData("AlbumArtist").toString().isEmpty())
-			song->artist = player->metaData("AlbumArtist").toString();
-		if (!player->metaData("Genre").toString().isEmpty())
-			song->genre = player->metaData("Genre").toString();
-		if (!player->metaData("Year").toString().isEmpty())
-			song->year = player->metaData("Year").toString();
+		// The tags as named by FFmpeg
+		if (!player->metaData("title").isEmpty())
+			song->title = player->metaData("title");
+		if (!player->metaData("album_artist").isEmpty())
+			song->artist = player->metaData("album_artist");
+		else if (!player->metaData("artist").isEmpty())
+			song->artist = player->metaData("artist");
+		if (!player->metaData("genre").isEmpty())
+			song->genre = player->metaData("genre");
+		if (!player->metaData("date").isEmpty())
+			song->year = player->metaData("date").left(4);
 		updateSongMeta(true);
 	}
 }
 
 void EditorApp::playButton()
 {
-	if (player && player->state() == QMediaPlayer::PlayingState) {
+	if (player && player->state() == PlaybackEngine::PLAYING) {
 		ui.cmdPlay->setText(tr("Pause"));
 		ui.cmdPlay->setIcon(QIcon::fromTheme("media-playback-pause", QIcon(":/icons/media-playback-pause.png")));
 		if (ui.chkSynth->isChecked()) on_chkSynth_clicked(true);
@@ -825,23 +994,23 @@ void EditorApp::playButton()
 
 void EditorApp::on_chkSynth_clicked(bool checked)
 {
-	if (checked && player && player->state() == QMediaPlayer::PlayingState) {
+	if (checked && player && player->state() == PlaybackEngine::PLAYING) {
 		synth.reset(new Synth);
 		connect(synth.data(), SIGNAL(playBuffer(QByteArray)), this, SLOT(playBuffer(QByteArray)));
-		if (player) player->setVolume(66);
+		if (player) player->setMusicVolume(0.66);
 	} else if (!checked) {
 		synth.reset();
-		if (player) player->setVolume(100);
+		if (player) player->setMusicVolume(1.0);
 	}
 }
 
 void EditorApp::on_cmdPlay_clicked()
 {
 	if (player) {
-		if (player->currentMedia().isNull()) {
+		if (!player->hasMedia()) {
 			on_actionMusicFile_triggered();
 		} else {
-			if (player && player->state() == QMediaPlayer::PlayingState) player->pause();
+			if (player && player->state() == PlaybackEngine::PLAYING) player->pause();
 			else player->play();
 		}
 	}
@@ -850,7 +1019,7 @@ void EditorApp::on_cmdPlay_clicked()
 void EditorApp::audioTick(qint64 time)
 {
 	if (noteGraph && player)
-		noteGraph->updateMusicPos(time, (player->state() == QMediaPlayer::PlayingState ? true : false));
+		noteGraph->updateMusicPos(time, (player->state() == PlaybackEngine::PLAYING ? true : false));
 
 	if (noteGraph && synth) {
 		// Here we create some notes for the synthesizer to use.
@@ -869,27 +1038,27 @@ void EditorApp::audioTick(qint64 time)
 	}
 }
 
-void EditorApp::playerStateChanged(QMediaPlayer::State state)
+void EditorApp::playerStateChanged(PlaybackEngine::State state)
 {
 	playButton();
-	if (state != QMediaPlayer::PlayingState) {
+	if (state != PlaybackEngine::PLAYING) {
 		noteGraph->stopMusic();
 	} else if (!noteGraph->selectedNote() && !noteGraph->noteLabels().isEmpty()) {
 		noteGraph->selectNote(noteGraph->noteLabels().front());
 	}
 }
 
-void EditorApp::playerError(QMediaPlayer::Error)
+void EditorApp::playerError(QString const& message)
 {
 	QString errst(tr("Error playing audio!"));
-	if (player) errst += " " + player->errorString();
+	errst += " " + message;
 	QMessageBox::critical(this, tr("Playback error"), errst);
 }
 
 void EditorApp::playBuffer(const QByteArray& buffer)
 {
-	if (bufferPlayers[currentBufferPlayer]->play(buffer))
-		currentBufferPlayer = (currentBufferPlayer+1) % 2;
+	// Mixed with the music, so that notes never wait for the previous one to finish
+	player->mix(buffer, Synth::SampleRate);
 }
 
 
@@ -897,6 +1066,7 @@ void EditorApp::on_txtTitle_editingFinished() { updateSongMeta(); }
 void EditorApp::on_txtArtist_editingFinished() { updateSongMeta(); }
 void EditorApp::on_txtGenre_editingFinished() { updateSongMeta(); }
 void EditorApp::on_txtYear_editingFinished() { updateSongMeta(); }
+void EditorApp::on_spinVideoGap_editingFinished() { updateSongMeta(); }
 
 void EditorApp::on_cmdSplit_clicked()
 {
@@ -1021,6 +1191,9 @@ AboutDialog::AboutDialog(QWidget* parent)
 
 
 namespace {
+	static const int pianoNotes = 12 * 4;  // Four octaves
+	static const int pianoKeyHeight = 16;
+
 	bool selectionMatches(int n, NoteGraphWidget *ngw) {
 		if (!ngw) return false;
 		const NoteLabels& nls = ngw->selectedNotes();
@@ -1036,74 +1209,138 @@ void EditorApp::updatePiano(int y)
 	piano->move(piano->x(), ui.noteGraphScroller->y() - y);
 }
 
-Piano::Piano(QWidget *parent): QLabel(parent), m_player(new BufferPlayer(this))
+Piano::Piano(PlaybackEngine *player, QWidget *parent): QWidget(parent), m_player(player), m_selected(pianoNotes), m_mouseNote(-1), m_livePitch(getNaN())
 {
 	setMouseTracking(true);
+	setFixedSize(50, pianoNotes * pianoKeyHeight);
+	renderLayers();
 }
 
-void Piano::updatePixmap(NoteGraphWidget *ngw)
+void Piano::renderLayers()
 {
-	const int notes = 12 * 4; // Four octaves
-	const QColor borderColor = QColor("#c0c0c0");
-	const QColor selectionColor = QColor("#a00");
-	const QColor mouseColor = QColor("#090");
-	int noteHeight = 16;
-	int mousen = round((NoteGraphWidget::Height - mapFromGlobal(QCursor::pos()).y()) / 16.0);
-
-	QImage image(50, notes * noteHeight, QImage::Format_ARGB32_Premultiplied);
-	image.fill(qRgba(0, 0, 0, 0));
-	setFixedSize(image.width(), image.height());
-	{
+	const QColor borderColors[LAYERS] = { QColor("#c0c0c0"), QColor("#a00"), QColor("#06c"), QColor("#090") };
+	MusicalScale scale;
+	m_keyRegions.assign(pianoNotes, QRegion());
+	for (int layer = 0; layer < LAYERS; ++layer) {
+		QImage image(size(), QImage::Format_ARGB32_Premultiplied);
+		image.fill(qRgba(0, 0, 0, 0));
 		QPainter painter(&image);
-		MusicalScale scale;
-		QPen pen; pen.setWidth(2);
+		QPen pen(borderColors[layer]); pen.setWidth(2);
+		painter.setPen(pen);
 		int y;
 		int w = image.width();
 		// Render only the white keys first
-		for (int i = -1; i < notes; ++i) {
+		for (int i = -1; i < pianoNotes; ++i) {
 			if (scale.isSharp(i)) continue;
-			int y2 = image.height() - i * noteHeight;  // Note center y
-			y2 -= (scale.isSharp(i + 1) ? 1.0 : 0.5) * noteHeight;  // Key top y
-			// Pick border color according to selection status
-			if (i == mousen) pen.setColor(mouseColor);
-			else if (selectionMatches(i, ngw)) pen.setColor(selectionColor);
-			else pen.setColor(borderColor);
-			painter.setPen(pen);
+			int y2 = image.height() - i * pianoKeyHeight;  // Note center y
+			y2 -= (scale.isSharp(i + 1) ? 1.0 : 0.5) * pianoKeyHeight;  // Key top y
 			// Skip the first key because y hasn't been calculated yet
 			if (i > -1) {
 				painter.fillRect(0, y2, w, y - y2, QColor("#ffffff"));
 				painter.drawRect(0, y2 + 2, w-1, y - y2 - 2);
+				m_keyRegions[i] = QRegion(0, y2, w, y - y2 + 2);
 			}
 			y = y2;  // The next key bottom y
 		}
 		// Now render the black keys
 		w *= 0.6;
-		for (int i = 0; i < notes; ++i) {
+		for (int i = 0; i < pianoNotes; ++i) {
 			if (!scale.isSharp(i)) continue;
-			y = image.height() - i*noteHeight - noteHeight / 2;
-			// Pick border color according to selection status
-			if (i == mousen) pen.setColor(mouseColor);
-			else if (selectionMatches(i, ngw)) pen.setColor(selectionColor);
-			else pen.setColor(borderColor);
-			painter.setPen(pen);
-			painter.fillRect(0, y, w, noteHeight, QColor("#000000"));
-			painter.drawRect(0, y, w, noteHeight);
+			y = image.height() - i * pianoKeyHeight - pianoKeyHeight / 2;
+			painter.fillRect(0, y, w, pianoKeyHeight, QColor("#000000"));
+			painter.drawRect(0, y, w, pianoKeyHeight);
+			m_keyRegions[i] = QRegion(0, y - 1, w + 2, pianoKeyHeight + 2);
 		}
+		painter.end();
+		m_layers[layer] = QPixmap::fromImage(image);
+		RENDER_STATS_IMAGE(image.width(), image.height());
+	}
+	// The black keys cover parts of their white neighbours
+	for (int i = 0; i < pianoNotes; ++i) {
+		if (scale.isSharp(i)) continue;
+		if (i > 0 && scale.isSharp(i - 1)) m_keyRegions[i] -= m_keyRegions[i - 1];
+		if (i + 1 < pianoNotes && scale.isSharp(i + 1)) m_keyRegions[i] -= m_keyRegions[i + 1];
+	}
+}
+
+void Piano::paintEvent(QPaintEvent *)
+{
+	QPainter painter(this);
+	painter.drawPixmap(0, 0, m_layers[KEYS]);
+	for (int i = 0; i < pianoNotes; ++i) if (m_selected[i]) paintKey(painter, SELECTION, i);
+	if (m_livePitch == m_livePitch) {
+		paintKey(painter, LIVE, round(m_livePitch));
+		// The exact pitch as a line across the keys
+		painter.fillRect(0, liveY() - 1, width(), 2, QColor("#06c"));
+	}
+	paintKey(painter, MOUSE, m_mouseNote);
+}
+
+void Piano::paintKey(QPainter& painter, Layer layer, int n) const
+{
+	if (n < 0 || n >= pianoNotes) return;
+	painter.setClipRegion(m_keyRegions[n]);
+	painter.drawPixmap(0, 0, m_layers[layer]);
+	painter.setClipping(false);
+}
+
+void Piano::updateKey(int n)
+{
+	if (n >= 0 && n < pianoNotes) update(m_keyRegions[n]);
+}
+
+int Piano::noteAt(int y) const { return round((height() - y) / double(pianoKeyHeight)); }
+
+int Piano::liveY() const { return height() - round(m_livePitch * pianoKeyHeight); }
+
+void Piano::updateSelection(NoteGraphWidget *ngw)
+{
+	for (int i = 0; i < pianoNotes; ++i) {
+		bool selected = selectionMatches(i, ngw);
+		if (selected == m_selected[i]) continue;
+		m_selected[i] = selected;
+		updateKey(i);
+	}
+}
+
+void Piano::setLivePitch(float note)
+{
+	bool live = note == note, wasLive = m_livePitch == m_livePitch;
+	if (!live && !wasLive) return;
+	if (live && wasLive && liveY() == height() - round(note * pianoKeyHeight)) return;
+	// Only the keys and the marker lines that change are repainted
+	if (wasLive) {
+		updateKey(round(m_livePitch));
+		update(0, liveY() - 1, width(), 2);
+	}
+	m_livePitch = note;
+	if (live) {
+		updateKey(round(m_livePitch));
+		update(0, liveY() - 1, width(), 2);
 	}
-	setPixmap(QPixmap::fromImage(image));
 }
 
 void Piano::mousePressEvent(QMouseEvent *event)
 {
 	if (!m_player) return;
 	QByteArray ba;
-	int n = round((NoteGraphWidget::Height - event->pos().y()) / 16.0);
+	int n = noteAt(event->pos().y());
 	Synth::createBuffer(ba, n % 12, 0.4);
-	m_player->play(ba);
+	m_player->mix(ba, Synth::SampleRate);
 }
 
 void Piano::mouseMoveEvent(QMouseEvent *event)
 {
-	updatePixmap(NULL);
+	int n = noteAt(event->pos().y());
+	if (n == m_mouseNote) return;
+	updateKey(m_mouseNote);
+	m_mouseNote = n;
+	updateKey(m_mouseNote);
+}
+
+void Piano::leaveEvent(QEvent *)
+{
+	updateKey(m_mouseNote);
+	m_mouseNote = -1;
 }
 
@@ -6,14 +6,16 @@
 #include "song.hh"
 #include "synth.hh"
 #include "notegraphwidget.hh"
-#include <QMediaPlayer>
+#include "playback.hh"
 
 class QProgressBar;
+class QProgressDialog;
 class QPushButton;
 class QCloseEvent;
 class NoteLabel;
 class NoteGraphWidget;
 class GettingStartedDialog;
+class AnalysisPrewarmer;
 
 
 class AboutDialog: public QDialog, private Ui::AboutDialog
@@ -24,18 +26,65 @@ public:
 };
 
 
-class Piano: public QLabel
+/// The piano keys next to the note graph
+/** The keyboard is rendered once into layers (the plain keys and a copy of all keys in each
+  * highlight colour) and painting a highlighted key only copies its outline from a layer,
+  * so following the mouse or the sung pitch while playing costs next to nothing.
+ */
+class Piano: public QWidget
 {
 	Q_OBJECT
 public:
-	Piano(QWidget *parent = 0);
+	Piano(PlaybackEngine *player, QWidget *parent = 0);
 public slots:
-	void updatePixmap(NoteGraphWidget *ngw);
+	void updateSelection(NoteGraphWidget *ngw);
+	void setLivePitch(float note);  ///< Highlight the analysed pitch being played (NaN for none)
 protected:
 	void mousePressEvent(QMouseEvent *event);
 	void mouseMoveEvent(QMouseEvent *event);
+	void leaveEvent(QEvent *event);
+	void paintEvent(QPaintEvent *event);
 private:
-	BufferPlayer *m_player;
+	enum Layer { KEYS, SELECTION, LIVE, MOUSE, LAYERS };
+	void renderLayers();
+	void paintKey(QPainter& painter, Layer layer, int n) const;
+	void updateKey(int n);
+	int noteAt(int y) const;
+	int liveY() const;  ///< Position of the live pitch marker
+	PlaybackEngine *m_player;  ///< Plays the keys over the music
+	QPixmap m_layers[LAYERS];
+	std::vector<QRegion> m_keyRegions;  ///< The visible part of each key with its border
+	std::vector<bool> m_selected;
+	int m_mouseNote;
+	float m_livePitch;
+};
+
+
+/// Joins music files into a WAV file (see Timeline) in a thread of its own
+class MedleyWriter: public QThread, public Timeline::Progress
+{
+public:
+	MedleyWriter(Timeline::Segments const& segments, QString const& fileName);
+	~MedleyWriter();  ///< Cancels and waits for the thread
+	QString fileName() const { return m_fileName; }
+	void cancel();
+	/// Part written so far (0 to 1)
+	double progress() const;
+	/// The file was written completely (once finished)
+	bool written() const { return m_written; }
+	/// Why writing failed (once finished, empty if it did not)
+	QString error() const { return m_error; }
+protected:
+	void run();
+	bool update(double position, double duration);
+private:
+	Timeline::Segments m_segments;
+	QString m_fileName;
+	mutable QMutex m_mutex;
+	double m_progress;
+	bool m_cancelled;
+	bool m_written;
+	QString m_error;
 };
 
 
@@ -49,13 +98,16 @@ public:
 	void openFile(QString fileName);
 	void updateSongMeta(bool readFromSongToUI = false);
 	void updateMenuStates();
+	void updateLevels();
 	void updateTitle();
 	void highlightLabel(QString id);
 	void showExportMenu() { ui.menuExport->exec(pos() + QPoint(0, ui.menubar->height())); }
 
 private:
 	void setupNoteGraph();
-	void setMusic(QString filepath, bool primary = true);
+	/// @param load give the file to the player (false if it already plays the same music)
+	void setMusic(QString filepath, bool primary = true, bool load = true);
+	void updateVideo();
 	bool promptSaving();
 	void saveProject(QString fileName);
 	void exportSong(QString format, QString dialogTitle);
@@ -70,12 +122,17 @@ public slots:
 	void analyzeProgress(int value, int maximum);
 	void metaDataChanged();
 	void audioTick(qint64 time);
-	void playerStateChanged(QMediaPlayer::State state);
-	void playerError(QMediaPlayer::Error error);
+	void playerStateChanged(PlaybackEngine::State state);
+	void playerError(QString const& message);
 	void playBuffer(const QByteArray& buffer);
 	void statusBarMessage(const QString& message);
 	void updatePiano(int y);
 	void clearLabelHighlights();
+	void deferredInit();
+	void audioReady();
+	void traceInteractive();
+	void medleyProgress();
+	void medleyFinished();
 
 	// Automatic slots
 
@@ -90,6 +147,7 @@ public slots:
 	void on_actionSingStarXML_triggered();
 	void on_actionUltraStarTXT_triggered();
 	void on_actionFoFMIDI_triggered();
+	void on_actionPitchMIDI_triggered();
 	void on_actionLRC_triggered();
 	void on_actionLyricsToFile_triggered();
 	void on_actionLyricsToClipboard_triggered();
@@ -106,6 +164,7 @@ public slots:
 	// Insert menu
 	void on_actionMusicFile_triggered();
 	void on_actionAdditionalMusicFile_triggered();
+	void on_actionMusicTimeline_triggered();
 	void on_actionLyricsFromFile_triggered();
 	void on_actionLyricsFromClipboard_triggered();
 	void on_actionLyricsFromLRCFile_triggered();
@@ -126,6 +185,7 @@ public slots:
 	void on_txtArtist_editingFinished();
 	void on_txtGenre_editingFinished();
 	void on_txtYear_editingFinished();
+	void on_spinVideoGap_editingFinished();
 	void on_cmdSplit_clicked();
 	void on_cmdInsert_clicked();
 	void on_cmbNoteType_activated(int state);
@@ -133,6 +193,7 @@ public slots:
 	void on_chkLineBreak_clicked(bool checked);
 
 protected:
+	bool event(QEvent *event);
 	void closeEvent(QCloseEvent *event);
 
 
@@ -143,13 +204,15 @@ private:
 	OperationStack opStack;
 	OperationStack redoStack;
 	QScopedPointer<Song> song;
-	QMediaPlayer *player;
-	BufferPlayer *bufferPlayers[2];
+	PlaybackEngine *player;
 	QScopedPointer<Synth> synth;
+	AnalysisPrewarmer *prewarmer;
 	Piano *piano;
 	QProgressBar *statusbarProgress;
 	QPushButton *statusbarButton;
+	QScopedPointer<MedleyWriter> medleyWriter;  ///< Writing the joined music (null when not)
+	QProgressDialog *medleyDialog;
 	QString projectFileName;
 	QString latestPath;
-	int currentBufferPlayer;
+	bool painted; ///< First paint done (the rest of the startup work follows it)
 };
@@ -1,6 +1,7 @@
 #include "ffmpeg.hh"
 #include "config.hh"
 #include "util.hh"
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 #include <QtGlobal>
@@ -12,6 +13,7 @@
 extern "C" {
 #include AVCODEC_INCLUDE
 #include AVFORMAT_INCLUDE
+#include SWSCALE_INCLUDE
 }
 
 /// A custom allocator that uses av_malloc for aligned buffers
@@ -32,9 +34,9 @@ private:
 /*static*/ QMutex FFmpeg::s_avcodec_mutex;
 
 FFmpeg::FFmpeg(std::string const& _filename):
-  m_filename(_filename), m_quit(), m_running(), m_eof(),
+  m_filename(_filename), m_quit(), m_running(), m_eof(), m_seekTarget(getNaN()),
   pFormatCtx(), pAudioCodecCtx(), pAudioCodec(),
-  audioStream(-1), m_position()
+  audioStream(-1), m_position(), m_trimUntil(getNaN())
 {
 	open(); // Throws on error
 	m_running = true;
@@ -57,6 +59,11 @@ double FFmpeg::duration() const {
 	return d >= 0.0 ? d : getInf();
 }
 
+std::string FFmpeg::metadata(std::string const& key) const {
+	AVDictionaryEntry* tag = av_dict_get(pFormatCtx->metadata, key.c_str(), NULL, 0);
+	return tag ? tag->value : std::string();
+}
+
 // FFMPEG has fluctuating API
 #if LIBAVCODEC_VERSION_INT < ((52<<16)+(64<<8)+0)
 #define AVMEDIA_TYPE_VIDEO CODEC_TYPE_VIDEO
@@ -86,6 +93,27 @@ void FFmpeg::open() {
 	pAudioCodecCtx = cc;
 }
 
+FFmpeg::Format FFmpeg::probe(std::string const& file) {
+	QMutexLocker l(&s_avcodec_mutex);  // Finding the stream information may open codecs
+	av_register_all();
+	av_log_set_level(AV_LOG_ERROR);
+	AVFormatContext* formatCtx = NULL;
+	if (avformat_open_input(&formatCtx, file.c_str(), NULL, NULL)) throw std::runtime_error("Cannot open input file");
+	Format format = { 0, 0, getInf() };
+	bool found = avformat_find_stream_info(formatCtx, NULL) >= 0;
+	for (unsigned int i = 0; found && i < formatCtx->nb_streams; i++) {
+		AVCodecContext* cc = formatCtx->streams[i]->codec;
+		if (cc->codec_type != AVMEDIA_TYPE_AUDIO) continue;
+		format.rate = cc->sample_rate;
+		format.channels = cc->channels;
+		break;
+	}
+	if (found && formatCtx->duration >= 0) format.duration = formatCtx->duration / double(AV_TIME_BASE);
+	avformat_close_input(&formatCtx);
+	if (!found) throw std::runtime_error("Cannot find stream information");
+	return format;
+}
+
 void FFmpeg::run() {
 	int errors = 0;
 	while (!m_quit) {
@@ -97,7 +125,7 @@ void FFmpeg::run() {
 		} catch (eof_error&) {
 			audioQueue.setEof();
 			m_eof = true;
-			msleep(100);
+			msleep(10);  // Not long, so that seeking back from the end is quick
 		} catch (std::exception& e) {
 			std::cerr << "FFMPEG error: " << e.what() << std::endl;
 			if (++errors > 2) { std::cerr << "FFMPEG terminating due to errors" << std::endl; m_quit = true; }
@@ -126,6 +154,10 @@ void FFmpeg::seek_internal() {
 	//const AVRational time_base_q = { 1, AV_TIME_BASE };  // AV_TIME_BASE_Q is the same thing with C99 struct literal (not supported by MSVC)
 	//if (stream != -1) target = av_rescale_q(target, time_base_q, pFormatCtx->streams[stream]->time_base);
 	av_seek_frame(pFormatCtx, stream, target, flags);
+	if (pAudioCodecCtx) avcodec_flush_buffers(pAudioCodecCtx);
+	audioQueue.setEof(false);
+	m_trimUntil = m_seekTarget;  // The demuxer lands on a packet at or before the target
+	m_position = getNaN();  // Nothing is trimmed unless the packets have timestamps
 	m_seekTarget = getNaN(); // Signal that seeking is done
 }
 
@@ -179,7 +211,7 @@ void FFmpeg::decodeNextFrame() {
 	{\
 		outsize /= sizeof(TYPE); /* Convert bytes into samples */ \
 		TYPE* samples = reinterpret_cast<TYPE*>(&decodedBuffer[0]);\
-		audioQueue.input(samples, samples + outsize, 1.0 / MAX_VALUE);\
+		audioQueue.input(samples + trim(outsize), samples + outsize, 1.0 / MAX_VALUE);\
 	}
 				switch (pAudioCodecCtx->sample_fmt) {
 					case AV_SAMPLE_FMT_S16: OUTPUT_SAMPLES(short, 32767.0); break;
@@ -189,7 +221,7 @@ void FFmpeg::decodeNextFrame() {
 					default: throw std::runtime_error("Unsupported sample format");
 				}
 #undef OUTPUT_SAMPLES
-				m_position += outsize / audioQueue.samplesPerSecond();  // New position in case the next packet doesn't have packet.time()
+				m_position += double(outsize) / audioQueue.samplesPerSecond();  // New position in case the next packet doesn't have packet.time()
 			}
 			// Audio frames are always finished
 			frameFinished = 1;
@@ -197,3 +229,102 @@ void FFmpeg::decodeNextFrame() {
 	}
 }
 
+
+/// Samples to drop from the beginning of a decoded frame, so that the output begins at the seek target
+unsigned FFmpeg::trim(unsigned samples) {
+	if (m_trimUntil != m_trimUntil) return 0;
+	if (m_position != m_position) { m_trimUntil = getNaN(); return 0; }  // No timestamps to trim by
+	unsigned channels = std::max(1u, audioQueue.getChannels());
+	double frames = std::max(0.0, round((m_trimUntil - m_position) * audioQueue.getRate()));
+	unsigned skip = std::min<double>(frames * channels, samples);
+	if (skip < samples) m_trimUntil = getNaN();  // The target is in this frame
+	return skip;
+}
+
+
+VideoKeyframes::VideoKeyframes(std::string const& file, unsigned height):
+  m_filename(file), pFormatCtx(), pVideoCodecCtx(), pSwsCtx(), pFrame(),
+  videoStream(-1), m_width(), m_height(height), m_time(getNaN()), m_draining()
+{
+	try {
+		open();
+	} catch (...) {
+		close();
+		throw;
+	}
+}
+
+VideoKeyframes::~VideoKeyframes() { close(); }
+
+void VideoKeyframes::open() {
+	QMutexLocker l(&FFmpeg::s_avcodec_mutex);
+	av_register_all();
+	av_log_set_level(AV_LOG_ERROR);
+	if (avformat_open_input(&pFormatCtx, m_filename.c_str(), NULL, NULL)) throw std::runtime_error("Cannot open input file");
+	if (avformat_find_stream_info(pFormatCtx, NULL) < 0) throw std::runtime_error("Cannot find stream information");
+	// Take the first video stream, the demuxer can drop everything else
+	for (unsigned int i=0; i<pFormatCtx->nb_streams; i++) {
+		AVStream* st = pFormatCtx->streams[i];
+		if (videoStream == -1 && st->codec->codec_type==AVMEDIA_TYPE_VIDEO) videoStream = i;
+		else st->discard = AVDISCARD_ALL;
+	}
+	if (videoStream == -1) throw std::runtime_error("No video stream found");
+	pFormatCtx->streams[videoStream]->discard = AVDISCARD_NONKEY;  // Only keyframes are read from the file
+	AVCodecContext* cc = pFormatCtx->streams[videoStream]->codec;
+	AVCodec* codec = avcodec_find_decoder(cc->codec_id);
+	if (!codec) throw std::runtime_error("Cannot find video codec");
+	cc->workaround_bugs = FF_BUG_AUTODETECT;
+	cc->skip_frame = AVDISCARD_NONKEY;  // In case a non-key packet gets through
+	cc->skip_loop_filter = AVDISCARD_ALL;  // Not visible at thumbnail size
+	if (avcodec_open2(cc, codec, NULL) < 0) throw std::runtime_error("Cannot open video codec");
+	pVideoCodecCtx = cc;
+	if (cc->width <= 0 || cc->height <= 0) throw std::runtime_error("Invalid video size");
+	m_width = std::max(1, int(round(double(cc->width) * m_height / cc->height)));
+	pFrame = avcodec_alloc_frame();
+	if (!pFrame) throw std::runtime_error("Unable to allocate AVFrame");
+}
+
+void VideoKeyframes::close() {
+	if (pFrame) av_free(pFrame);
+	if (pSwsCtx) sws_freeContext(pSwsCtx);
+	QMutexLocker l(&FFmpeg::s_avcodec_mutex); // avcodec_close is not thread-safe
+	if (pVideoCodecCtx) avcodec_close(pVideoCodecCtx);
+	if (pFormatCtx) avformat_close_input(&pFormatCtx);
+	pFrame = NULL;
+	pSwsCtx = NULL;
+	pVideoCodecCtx = NULL;
+}
+
+bool VideoKeyframes::next() {
+	AVPacket packet;
+	for (;;) {
+		int frameFinished = 0;
+		if (!m_draining && av_read_frame(pFormatCtx, &packet) >= 0) {
+			// Only keyframes are given to the decoder (the demuxer should not even read the rest)
+			if (packet.stream_index == videoStream && (packet.flags & AV_PKT_FLAG_KEY)) {
+				if (avcodec_decode_video2(pVideoCodecCtx, pFrame, &frameFinished, &packet) < 0) frameFinished = 0;  // Skip broken frames
+			}
+			av_free_packet(&packet);
+			if (!frameFinished) continue;
+		} else {
+			// At the end of the file, empty packets get the frames still delayed in the decoder
+			m_draining = true;
+			av_init_packet(&packet);
+			packet.data = NULL;
+			packet.size = 0;
+			if (avcodec_decode_video2(pVideoCodecCtx, pFrame, &frameFinished, &packet) < 0 || !frameFinished) return false;
+		}
+		int64_t pts = pFrame->pkt_pts != int64_t(AV_NOPTS_VALUE) ? pFrame->pkt_pts : pFrame->pkt_dts;
+		if (pts == int64_t(AV_NOPTS_VALUE)) continue;  // No way to place it on the timeline
+		m_time = pts * av_q2d(pFormatCtx->streams[videoStream]->time_base);
+		// Scale directly into the thumbnail buffer
+		AVCodecContext* cc = pVideoCodecCtx;
+		pSwsCtx = sws_getCachedContext(pSwsCtx, cc->width, cc->height, cc->pix_fmt, m_width, m_height, PIX_FMT_RGB32, SWS_AREA, NULL, NULL, NULL);
+		if (!pSwsCtx) throw std::runtime_error("Cannot initialize video scaling");
+		m_data.resize(m_width * m_height);
+		uint8_t* dst[4] = { reinterpret_cast<uint8_t*>(&m_data[0]) };
+		int dstStride[4] = { int(m_width * sizeof(uint32_t)) };
+		sws_scale(pSwsCtx, pFrame->data, pFrame->linesize, 0, cc->height, dst, dstStride);
+		return true;
+	}
+}
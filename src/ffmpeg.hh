@@ -1,17 +1,36 @@
 #pragma once
 
 #include "util.hh"
+#include "types.hh"
 #include "libda/sample.hpp"
 #include <QThread>
 #include <QMutex>
 #include <QMutexLocker>
 #include <QWaitCondition>
+#include <QElapsedTimer>
 #include <QScopedPointer>
 #include <memory>
 #include <vector>
 
+/// Timing of AudioQueue, only compiled in with DECODE_STATS defined (as for the core library that decodebench links)
+#ifdef DECODE_STATS
+#define DECODE_STATS_START(timer) QElapsedTimer timer; timer.start()
+#define DECODE_STATS_ADD(field, value) m_stats.field += (value)
+#else
+#define DECODE_STATS_START(timer) ((void)0)
+#define DECODE_STATS_ADD(field, value) ((void)0)
+#endif
+
 class AudioQueue {
 public:
+	/// Time spent in the queue (nanoseconds), for measuring the decoding pipeline (all zero without DECODE_STATS)
+	struct Stats {
+		qint64 input;  ///< In input(), converting and copying the samples (including inputBlocked)
+		qint64 inputBlocked;  ///< Waiting for space (the consumer is slower)
+		qint64 outputBlocked;  ///< Waiting for data (the decoder is slower)
+		unsigned long long samples;  ///< Samples input
+		Stats(): input(), inputBlocked(), outputBlocked(), samples() {}
+	};
 	void reset() {
 		QMutexLocker lock(&m_mutex);
 		m_size = 0;
@@ -19,15 +38,22 @@ public:
 		m_needSpace.wakeOne();
 	}
 	template <typename Iterator> void input(Iterator begin, Iterator end, double scale) {
+		DECODE_STATS_START(timer);
 		QMutexLocker lock(&m_mutex);
 		unsigned count = end - begin;
 		unsigned capacity = m_ring.size();
 		if (capacity < count) throw std::logic_error("AudioQueue input chunk is bigger than capacity");
-		while (capacity - m_size < count) m_needSpace.wait(&m_mutex);
+		if (capacity - m_size < count) {
+			DECODE_STATS_START(blocked);
+			while (capacity - m_size < count) m_needSpace.wait(&m_mutex);
+			DECODE_STATS_ADD(inputBlocked, blocked.nsecsElapsed());
+		}
 		for (unsigned i = 0; i < count; ++i) {
 			m_ring[m_position + m_size++] = *begin++ * scale;
 		}
 		m_needData.wakeOne();
+		DECODE_STATS_ADD(samples, count);
+		DECODE_STATS_ADD(input, timer.nsecsElapsed());
 	}
 	void setEof(bool eof = true) {
 		QMutexLocker lock(&m_mutex);
@@ -36,10 +62,12 @@ public:
 	}
 	bool output(std::vector<da::sample_t>& out) {
 		QMutexLocker lock(&m_mutex);
-		while (m_size == 0) {
-			if (m_eof) return false;
-			m_needData.wait(&m_mutex);
+		if (m_size == 0 && !m_eof) {
+			DECODE_STATS_START(blocked);
+			while (m_size == 0 && !m_eof) m_needData.wait(&m_mutex);
+			DECODE_STATS_ADD(outputBlocked, blocked.nsecsElapsed());
 		}
+		if (m_size == 0) return false;
 		std::size_t outsz = out.size();
 		out.resize(outsz + m_size);
 		da::sample_t* outptr = &out[outsz];
@@ -61,6 +89,7 @@ public:
 	void setRateChannels(unsigned rate, unsigned channels) { m_rate = rate; m_channels = channels; }
 	unsigned getRate() { return m_rate; }
 	unsigned getChannels() { return m_channels; }
+	Stats stats() { QMutexLocker lock(&m_mutex); return m_stats; }
 	AudioQueue(unsigned capacity = 32768): m_ring(capacity), m_channels(), m_position(), m_size(), m_eof() {}
 	
 private:
@@ -73,6 +102,7 @@ private:
 	unsigned m_position;
 	unsigned m_size;
 	bool m_eof;
+	Stats m_stats;
 };
 
 // ffmpeg forward declarations
@@ -82,6 +112,7 @@ extern "C" {
   struct AVFormatContext;
   struct ReSampleContext;
   struct SwsContext;
+  struct AVFrame;
 }
 
 /// ffmpeg class
@@ -94,17 +125,30 @@ class FFmpeg: public QThread {
 	void run();
 	/// Queue for audio
 	AudioQueue audioQueue;
-	/** Seek to the chosen time. Will block until the seek is done, if wait is true. **/
+	/** Seek to the chosen time. Will block until the seek is done, if wait is true.
+	  * The samples decoded before the target are dropped, so the queue continues exactly at it.
+	 **/
 	void seek(double time, bool wait = true);
 	/// Duration
 	double duration() const;
+	/// Tag of the file (e.g. "title" or "artist"), empty if not available
+	std::string metadata(std::string const& key) const;
 	bool terminating() const { return m_quit; }
+	/// Audio format of a file
+	struct Format {
+		unsigned rate;
+		unsigned channels;
+		double duration;  ///< Seconds (infinite if not known)
+	};
+	/// Read the format of the first audio stream from the headers, without opening a decoder (throws on errors)
+	static Format probe(std::string const& file);
 
   private:
 	class eof_error: public std::exception {};
 	void seek_internal();
 	void open();
 	void decodeNextFrame();
+	unsigned trim(unsigned samples);
 	std::string m_filename;
 	unsigned int m_rate;
 	volatile bool m_quit;
@@ -118,6 +162,40 @@ class FFmpeg: public QThread {
 
 	int audioStream;
 	double m_position;
+	double m_trimUntil;  ///< Seek target whose earlier samples are dropped (NaN when not seeking)
 	static QMutex s_avcodec_mutex; // Used for avcodec_open/close (which use some static crap and are thus not thread-safe)
+	friend class VideoKeyframes;
+};
+
+/// Keyframe-only video decoder for thumbnails
+/** All other frames are discarded before decoding, which makes scanning through
+  * a whole music video fast. Keyframes are scaled by libswscale straight into small
+  * RGB32 images (the same layout as QImage::Format_RGB32).
+ */
+class VideoKeyframes {
+  public:
+	/// @param height thumbnail height in pixels (width follows the aspect ratio)
+	VideoKeyframes(std::string const& file, unsigned height);
+	~VideoKeyframes();
+	/// Decode the next keyframe, returns false at the end of the video
+	bool next();
+	double time() const { return m_time; }  ///< Timestamp of the current keyframe (seconds)
+	unsigned width() const { return m_width; }
+	unsigned height() const { return m_height; }
+	std::vector<uint32_t> const& data() const { return m_data; }  ///< Pixels of the current keyframe
+
+  private:
+	void open();
+	void close();
+	std::string m_filename;
+	AVFormatContext* pFormatCtx;
+	AVCodecContext* pVideoCodecCtx;
+	SwsContext* pSwsCtx;
+	AVFrame* pFrame;
+	int videoStream;
+	unsigned m_width, m_height;
+	double m_time;
+	bool m_draining;  ///< The file has ended, the decoder is being emptied
+	std::vector<uint32_t> m_data;
 };
 
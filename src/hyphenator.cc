@@ -0,0 +1,300 @@
+#include "hyphenator.hh"
+#include <QByteArray>
+#include <QFile>
+#include <QFileInfo>
+#include <QLocale>
+#include <QMutex>
+#include <QRegExp>
+#include <QStandardPaths>
+#include <QTextCodec>
+#include <QVarLengthArray>
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
+namespace {
+	/// Language names used in song files and the dictionaries to use for them
+	struct Language {
+		char const* name;
+		char const* code;  ///< Dictionaries of the hyphen library
+		char const* tex;  ///< TeX patterns
+	};
+	static const Language languages[] = {
+		{ "English", "en_US", "en-us" },
+		{ "German", "de_DE", "de-1996" },
+		{ "Finnish", "fi_FI", "fi" },
+		{ "Swedish", "sv_SE", "sv" },
+		{ "Norwegian", "nb_NO", "nb" },
+		{ "Danish", "da_DK", "da" },
+		{ "Dutch", "nl_NL", "nl" },
+		{ "French", "fr_FR", "fr" },
+		{ "Spanish", "es_ES", "es" },
+		{ "Italian", "it_IT", "it" },
+		{ "Portuguese", "pt_PT", "pt" },
+		{ "Polish", "pl_PL", "pl" },
+		{ "Czech", "cs_CZ", "cs" },
+		{ "Slovak", "sk_SK", "sk" },
+		{ "Hungarian", "hu_HU", "hu" },
+		{ "Estonian", "et_EE", "et" },
+		{ "Croatian", "hr_HR", "hr" },
+		{ "Slovenian", "sl_SI", "sl" },
+		{ "Russian", "ru_RU", "ru" },
+		{ "Ukrainian", "uk_UA", "uk" },
+		{ "Turkish", "tr_TR", "tr" },
+		{ "Latin", "la", "la" }
+	};
+
+	/// Files that may contain the patterns of a language, the preferred ones first
+	QStringList candidateFiles(QString language) {
+		language = language.trimmed();
+		if (language.isEmpty()) language = QLocale::system().name();
+		QString code, tex;
+		for (unsigned i = 0; i < sizeof(languages) / sizeof(*languages); ++i) {
+			if (language.compare(languages[i].name, Qt::CaseInsensitive) == 0 || language.compare(languages[i].code, Qt::CaseInsensitive) == 0) {
+				code = languages[i].code;
+				tex = languages[i].tex;
+			}
+		}
+		if (code.isEmpty()) {
+			if (!QRegExp("[a-zA-Z]{2,3}([_-][a-zA-Z]{2})?").exactMatch(language)) return QStringList();
+			code = language;
+			code.replace('-', '_');
+			tex = code.toLower().replace('_', '-');
+		}
+		QString base = code.section('_', 0, 0).toLower();
+		QStringList names;
+		names << "hyph_" + code + ".dic" << "hyph-" + tex + ".pat.txt";
+		if (base != code) names << "hyph_" + base + ".dic";
+		if (base != tex) names << "hyph-" + base + ".pat.txt";
+		// Ours first, then those of the hyphen library (LibreOffice) and TeX Live
+		QStringList dirs;
+		dirs << QStandardPaths::locateAll(QStandardPaths::DataLocation, "hyphenation", QStandardPaths::LocateDirectory);
+		char const* system[] = { "hyphen", "myspell/dicts", "texlive/texmf-dist/tex/generic/hyph-utf8/patterns/txt", "texmf-dist/tex/generic/hyph-utf8/patterns/txt" };
+		for (unsigned i = 0; i < sizeof(system) / sizeof(*system); ++i) {
+			dirs << QStandardPaths::locateAll(QStandardPaths::GenericDataLocation, system[i], QStandardPaths::LocateDirectory);
+		}
+		QStringList files;
+		for (int n = 0; n < names.size(); ++n) {
+			for (int d = 0; d < dirs.size(); ++d) files << dirs[d] + "/" + names[n];
+		}
+		return files;
+	}
+
+	bool isLetter(QChar ch) { return ch.isLetter() || ch.isMark(); }
+}
+
+Hyphenator::Hyphenator(QString const& fileName): m_patterns(), m_leftMin(2), m_rightMin(2)
+{
+	load(fileName);
+	if (fileName.endsWith(".pat.txt")) {
+		QString exceptions = fileName.left(fileName.size() - 8) + ".hyp.txt";
+		if (QFileInfo(exceptions).exists()) loadExceptions(exceptions);
+	}
+}
+
+Hyphenator const* Hyphenator::forLanguage(QString const& language)
+{
+	// Loaded once per language and kept until exit (also languages without patterns)
+	static QMutex mutex;
+	static QHash<QString, Hyphenator const*> cache;
+	QMutexLocker locker(&mutex);
+	QHash<QString, Hyphenator const*>::const_iterator it = cache.find(language);
+	if (it != cache.end()) return *it;
+	Hyphenator const* hyphenator = NULL;
+	QStringList files = candidateFiles(language);
+	for (int i = 0; i < files.size() && !hyphenator; ++i) {
+		if (!QFileInfo(files[i]).isFile()) continue;
+		try {
+			hyphenator = new Hyphenator(files[i]);
+		} catch (std::exception&) {}
+	}
+	cache.insert(language, hyphenator);
+	return hyphenator;
+}
+
+QString Hyphenator::userDirectory()
+{
+	return QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/hyphenation";
+}
+
+void Hyphenator::load(QString const& fileName)
+{
+	QFile file(fileName);
+	if (!file.open(QIODevice::ReadOnly)) throw std::runtime_error("Cannot open hyphenation patterns " + fileName.toStdString());
+	QByteArray data = file.readAll();
+	// TeX patterns are UTF-8, the dictionaries of the hyphen library begin with their character set
+	QTextCodec* codec = QTextCodec::codecForName("UTF-8");
+	bool dic = fileName.endsWith(".dic");
+	if (dic) {
+		int eol = data.indexOf('\n');
+		QByteArray charset = data.left(eol).trimmed();
+		if (QTextCodec* c = QTextCodec::codecForName(charset)) codec = c;
+		data.remove(0, eol < 0 ? data.size() : eol + 1);
+	}
+	QStringList lines = codec->toUnicode(data).split('\n');
+	QStringList patterns;
+	for (int i = 0; i < lines.size(); ++i) {
+		QString line = lines[i].section('%', 0, 0).trimmed();
+		if (line.isEmpty()) continue;
+		if (dic) {
+			QString keyword = line.section(' ', 0, 0);
+			if (keyword == "LEFTHYPHENMIN") { m_leftMin = line.section(' ', 1, 1).toInt(); continue; }
+			if (keyword == "RIGHTHYPHENMIN") { m_rightMin = line.section(' ', 1, 1).toInt(); continue; }
+			// The first level of a two level dictionary splits compound words, the second one is what TeX does
+			if (keyword == "NEXTLEVEL") { patterns.clear(); continue; }
+			if (keyword.startsWith("COMPOUND") || keyword == "NOHYPHEN") continue;
+		}
+		QStringList items = line.split(QRegExp("\\s+"), QString::SkipEmptyParts);
+		for (int j = 0; j < items.size(); ++j) {
+			if (items[j].contains('/')) continue;  // Non-standard hyphenation (changes the letters), not for syllables
+			patterns << items[j];
+		}
+	}
+	if (patterns.isEmpty()) throw std::runtime_error("No hyphenation patterns in " + fileName.toStdString());
+	m_leftMin = std::max(1, m_leftMin);
+	m_rightMin = std::max(1, m_rightMin);
+	compile(patterns);
+}
+
+void Hyphenator::loadExceptions(QString const& fileName)
+{
+	QFile file(fileName);
+	if (!file.open(QIODevice::ReadOnly)) return;
+	QStringList words = QString::fromUtf8(file.readAll()).split(QRegExp("\\s+"), QString::SkipEmptyParts);
+	for (int i = 0; i < words.size(); ++i) {
+		if (!words[i].startsWith('%')) addException(words[i]);
+	}
+}
+
+void Hyphenator::addException(QString const& hyphenated)
+{
+	QString word;
+	std::vector<int> positions;
+	for (int i = 0; i < hyphenated.size(); ++i) {
+		if (hyphenated[i] == '-') positions.push_back(word.size());
+		else word += hyphenated[i];
+	}
+	m_exceptions.insert(word.toLower(), positions);
+}
+
+void Hyphenator::compile(QStringList const& patterns)
+{
+	// A pattern such as "1ba2" is the letters "ba" with the values 1, 0, 2 before, between and after them
+	struct Building {
+		std::map<ushort, unsigned> children;
+		QByteArray values;
+	};
+	std::vector<Building> trie(1);
+	for (int p = 0; p < patterns.size(); ++p) {
+		QString const& pattern = patterns[p];
+		QByteArray values(1, '\0');
+		unsigned node = 0;
+		for (int i = 0; i < pattern.size(); ++i) {
+			QChar ch = pattern[i];
+			if (ch.isDigit()) { values[values.size() - 1] = char(ch.digitValue()); continue; }
+			ushort letter = ch.toLower().unicode();
+			std::map<ushort, unsigned>::const_iterator it = trie[node].children.find(letter);
+			if (it != trie[node].children.end()) node = it->second;
+			else {
+				unsigned added = trie.size();
+				trie[node].children[letter] = added;
+				trie.push_back(Building());  // Invalidates the iterators into the trie
+				node = added;
+			}
+			values.append('\0');
+		}
+		if (node == 0) continue;
+		trie[node].values = values;
+		++m_patterns;
+	}
+	// Flatten, children in order of their letters and identical value sequences stored once
+	QHash<QByteArray, quint32> shared;
+	m_nodes.resize(trie.size());
+	for (unsigned n = 0; n < trie.size(); ++n) {
+		Node& node = m_nodes[n];
+		node.edges = m_edgeChars.size();
+		node.edgeCount = trie[n].children.size();
+		for (std::map<ushort, unsigned>::const_iterator it = trie[n].children.begin(); it != trie[n].children.end(); ++it) {
+			m_edgeChars.push_back(it->first);
+			m_edgeNodes.push_back(it->second);
+		}
+		QByteArray const& values = trie[n].values;
+		int begin = 0, end = values.size();
+		while (begin < end && values[begin] == '\0') ++begin;
+		while (end > begin && values[end - 1] == '\0') --end;
+		node.valueStart = begin;
+		node.valueCount = end - begin;
+		node.values = 0;
+		if (begin == end) continue;
+		QByteArray key = values.mid(begin, end - begin);
+		QHash<QByteArray, quint32>::const_iterator it = shared.find(key);
+		if (it == shared.end()) {
+			it = shared.insert(key, m_values.size());
+			m_values.insert(m_values.end(), key.begin(), key.end());
+		}
+		node.values = *it;
+	}
+}
+
+int Hyphenator::child(Node const& node, ushort ch) const
+{
+	std::vector<ushort>::const_iterator begin = m_edgeChars.begin() + node.edges, end = begin + node.edgeCount;
+	std::vector<ushort>::const_iterator it = std::lower_bound(begin, end, ch);
+	if (it == end || *it != ch) return -1;
+	return m_edgeNodes[it - m_edgeChars.begin()];
+}
+
+std::vector<int> Hyphenator::breaks(QString const& word) const
+{
+	std::vector<int> result;
+	// Only the letters are hyphenated, not punctuation around them
+	int first = 0, last = word.size();
+	while (first < last && !isLetter(word[first])) ++first;
+	while (last > first && !isLetter(word[last - 1])) --last;
+	int n = last - first;
+	if (n < m_leftMin + m_rightMin) return result;
+	QString lower = word.mid(first, n).toLower();
+	if (lower.size() != n) return result;  // Case mapping changed the length (rare special letters)
+	QHash<QString, std::vector<int> >::const_iterator ex = m_exceptions.find(lower);
+	if (ex != m_exceptions.end()) {
+		for (std::size_t i = 0; i < ex->size(); ++i) result.push_back(first + (*ex)[i]);
+		return result;
+	}
+	// Liang: each pattern found in ".word." raises the values at its positions, odd values allow a break
+	QVarLengthArray<ushort, 64> text(n + 2);
+	text[0] = text[n + 1] = '.';
+	for (int i = 0; i < n; ++i) text[i + 1] = lower[i].unicode();
+	QVarLengthArray<quint8, 64> points(n + 3);
+	std::fill(points.begin(), points.end(), 0);
+	for (int i = 0; i < n + 2; ++i) {
+		int node = 0;
+		for (int j = i; j < n + 2; ++j) {
+			node = child(m_nodes[node], text[j]);
+			if (node < 0) break;
+			Node const& found = m_nodes[node];
+			for (int k = 0; k < found.valueCount; ++k) {
+				quint8& point = points[i + found.valueStart + k];
+				point = std::max(point, m_values[found.values + k]);
+			}
+		}
+	}
+	// The value before letter c of the word is at c + 1 because of the leading dot
+	for (int c = m_leftMin; c <= n - m_rightMin; ++c) {
+		if (points[c + 1] & 1) result.push_back(first + c);
+	}
+	return result;
+}
+
+QStringList Hyphenator::syllables(QString const& word) const
+{
+	QStringList result;
+	std::vector<int> positions = breaks(word);
+	int begin = 0;
+	for (std::size_t i = 0; i < positions.size(); ++i) {
+		result << word.mid(begin, positions[i] - begin);
+		begin = positions[i];
+	}
+	result << word.mid(begin);
+	return result;
+}
+
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+/// Splitting of words into syllables with Liang's algorithm (as TeX hyphenates)
+/** The patterns come from the hyphenation dictionaries installed on the system (or into
+  * userDirectory(), as on Windows where there are none), either
+  * the TeX hyph-utf8 pattern files (hyph-xx.pat.txt, exceptions in hyph-xx.hyp.txt) or
+  * the dictionaries of the hyphen library used by LibreOffice (hyph_xx.dic).
+  * The patterns are compiled into a trie stored in flat arrays (children of each node
+  * sorted for binary search, values shared by the nodes that end a pattern), so that a
+  * word is hyphenated with a few cache friendly lookups per letter.
+ */
+class Hyphenator {
+public:
+	/// Load patterns from a file, throws std::runtime_error if it cannot be read
+	explicit Hyphenator(QString const& fileName);
+	/// The hyphenator of a language, given by name (as in song files, e.g. "English") or code (e.g. "en_US")
+	/// @return NULL if no patterns are installed for the language
+	static Hyphenator const* forLanguage(QString const& language);
+	/// The directory where the user may install patterns (searched first), none are bundled with the program
+	static QString userDirectory();
+	/// Split a word into syllables, punctuation stays with the first and the last syllable
+	QStringList syllables(QString const& word) const;
+	/// Positions within the word (indices of the first character of each syllable but the first)
+	std::vector<int> breaks(QString const& word) const;
+	unsigned patterns() const { return m_patterns; }
+
+private:
+	struct Node {
+		quint32 edges;  ///< Index of the first child in m_edgeChars/m_edgeNodes
+		quint16 edgeCount;
+		quint8 valueCount;  ///< Values of the pattern that ends here (0 if none)
+		quint8 valueStart;  ///< Position of the first value within the pattern (leading zeros are not stored)
+		quint32 values;  ///< Index of the first value in m_values
+	};
+	void load(QString const& fileName);
+	void loadExceptions(QString const& fileName);
+	void addException(QString const& hyphenated);
+	void compile(QStringList const& patterns);
+	int child(Node const& node, ushort ch) const;
+	std::vector<Node> m_nodes;  ///< Root first
+	std::vector<ushort> m_edgeChars;
+	std::vector<quint32> m_edgeNodes;
+	std::vector<quint8> m_values;
+	QHash<QString, std::vector<int> > m_exceptions;  ///< Lower case words hyphenated by hand
+	unsigned m_patterns;
+	int m_leftMin, m_rightMin;  ///< Shortest syllables allowed at the beginning and the end of a word
+};
+
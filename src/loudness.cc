@@ -0,0 +1,154 @@
+#include "loudness.hh"
+#include "util.hh"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#ifndef M_PI
+	#define M_PI 3.141592653589793
+#endif
+
+namespace {
+	static const double absoluteGate = -70.0;  ///< LUFS
+	static const double relativeGate = -10.0;  ///< LU below the absolutely gated loudness (integrated)
+	static const double rangeGate = -20.0;  ///< LU below the absolutely gated loudness (loudness range)
+	static const unsigned blockSubs = 4;  ///< 400 ms gating block
+	static const unsigned shortTermSubs = 30;  ///< 3 s short-term window
+
+	double energy2LUFS(double energy) { return -0.691 + 10.0 * std::log10(energy); }
+
+	/// Mean energies of windows of the given length (in sub-blocks), one window per sub-block
+	std::vector<double> windows(std::vector<double> const& subBlocks, unsigned length) {
+		std::vector<double> result;
+		double sum = 0.0;
+		for (std::size_t i = 0; i < subBlocks.size(); ++i) {
+			sum += subBlocks[i];
+			if (i >= length) sum -= subBlocks[i - length];
+			if (i + 1 >= length) result.push_back(std::max(0.0, sum / length));
+		}
+		return result;
+	}
+
+	/// Energies above the absolute gate and above the given gate relative to their mean
+	std::vector<double> gate(std::vector<double> const& energies, double relative) {
+		std::vector<double> result;
+		double threshold = std::pow(10.0, (absoluteGate + 0.691) / 10.0);
+		for (int pass = 0; pass < 2; ++pass) {
+			result.clear();
+			double sum = 0.0;
+			for (std::size_t i = 0; i < energies.size(); ++i) {
+				if (energies[i] <= threshold) continue;
+				result.push_back(energies[i]);
+				sum += energies[i];
+			}
+			if (result.empty()) break;
+			threshold = std::max(threshold, sum / result.size() * std::pow(10.0, relative / 10.0));
+		}
+		return result;
+	}
+}
+
+LoudnessMeter::LoudnessMeter(unsigned rate, unsigned channels):
+  m_channels(channels), m_subBlock((rate + 5) / 10), m_frames(), m_energy(), m_peak(), m_historyPos(),
+  m_filters(channels), m_weights(channels, 1.0), m_history(2 * Taps * channels)
+{
+	if (rate == 0 || channels == 0) throw std::logic_error("LoudnessMeter needs a sample rate and channels");
+	// K-weighting coefficients for any sample rate (the standard only lists them for 48 kHz)
+	{
+		// Stage 1: high shelf (head effects)
+		double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+		double k = std::tan(M_PI * f0 / rate);
+		double vh = std::pow(10.0, gain / 20.0);
+		double vb = std::pow(vh, 0.4996667741545416);
+		double a0 = 1.0 + k / q + k * k;
+		m_b1[0] = (vh + vb * k / q + k * k) / a0;
+		m_b1[1] = 2.0 * (k * k - vh) / a0;
+		m_b1[2] = (vh - vb * k / q + k * k) / a0;
+		m_a1[0] = 1.0;
+		m_a1[1] = 2.0 * (k * k - 1.0) / a0;
+		m_a1[2] = (1.0 - k / q + k * k) / a0;
+	}
+	{
+		// Stage 2: RLB high pass
+		double f0 = 38.13547087602444, q = 0.5003270373238773;
+		double k = std::tan(M_PI * f0 / rate);
+		double a0 = 1.0 + k / q + k * k;
+		m_b2[0] = 1.0; m_b2[1] = -2.0; m_b2[2] = 1.0;
+		m_a2[0] = 1.0;
+		m_a2[1] = 2.0 * (k * k - 1.0) / a0;
+		m_a2[2] = (1.0 - k / q + k * k) / a0;
+	}
+	// 5.1 in FFmpeg order (FL, FR, FC, LFE, BL, BR)
+	if (channels == 6) { m_weights[3] = 0.0; m_weights[4] = m_weights[5] = 1.41; }
+	// Windowed sinc interpolation, each phase normalized to unity gain
+	for (unsigned p = 0; p < Phases; ++p) {
+		double sum = 0.0;
+		for (unsigned j = 0; j < Taps; ++j) {
+			double t = double(j) - (Taps / 2 - 1) - double(p) / Phases;  // Distance from the interpolated point in input samples
+			double sinc = (t == 0.0 ? 1.0 : std::sin(M_PI * t) / (M_PI * t));
+			double window = 0.5 + 0.5 * std::cos(M_PI * t / (Taps / 2));
+			m_fir[p][j] = sinc * window;
+			sum += m_fir[p][j];
+		}
+		for (unsigned j = 0; j < Taps; ++j) m_fir[p][j] /= sum;
+	}
+}
+
+void LoudnessMeter::process(float const* begin, float const* end)
+{
+	for (float const* frame = begin; frame + m_channels <= end; frame += m_channels) {
+		m_historyPos = (m_historyPos + Taps - 1) % Taps;  // Newest sample first
+		for (unsigned ch = 0; ch < m_channels; ++ch) {
+			double x = frame[ch];
+			// K-weighting
+			Filter& f = m_filters[ch];
+			double y = m_b1[0] * x + f.s1[0];
+			f.s1[0] = m_b1[1] * x - m_a1[1] * y + f.s1[1];
+			f.s1[1] = m_b1[2] * x - m_a1[2] * y;
+			double z = m_b2[0] * y + f.s2[0];
+			f.s2[0] = m_b2[1] * y - m_a2[1] * z + f.s2[1];
+			f.s2[1] = m_b2[2] * y - m_a2[2] * z;
+			m_energy += m_weights[ch] * z * z;
+			// True peak from the oversampled signal
+			float* history = &m_history[2 * Taps * ch];
+			history[m_historyPos] = history[m_historyPos + Taps] = frame[ch];
+			float const* h = history + m_historyPos;
+			for (unsigned p = 0; p < Phases; ++p) {
+				float sum = 0.0f;
+				for (unsigned j = 0; j < Taps; ++j) sum += m_fir[p][j] * h[j];
+				m_peak = std::max(m_peak, std::abs(sum));
+			}
+		}
+		if (++m_frames == m_subBlock) {
+			m_subBlocks.push_back(m_energy / m_frames);
+			m_energy = 0.0;
+			m_frames = 0;
+		}
+	}
+}
+
+double LoudnessMeter::integrated() const
+{
+	std::vector<double> blocks = gate(windows(m_subBlocks, blockSubs), relativeGate);
+	if (blocks.empty()) return getNaN();
+	double sum = 0.0;
+	for (std::size_t i = 0; i < blocks.size(); ++i) sum += blocks[i];
+	return energy2LUFS(sum / blocks.size());
+}
+
+double LoudnessMeter::range() const
+{
+	std::vector<double> shortTerm = gate(windows(m_subBlocks, shortTermSubs), rangeGate);
+	if (shortTerm.empty()) return 0.0;
+	std::sort(shortTerm.begin(), shortTerm.end());
+	// Difference of the 10th and 95th percentiles
+	double low = shortTerm[std::size_t(0.10 * (shortTerm.size() - 1) + 0.5)];
+	double high = shortTerm[std::size_t(0.95 * (shortTerm.size() - 1) + 0.5)];
+	return energy2LUFS(high) - energy2LUFS(low);
+}
+
+double LoudnessMeter::truePeak() const
+{
+	return 20.0 * std::log10(m_peak);
+}
+
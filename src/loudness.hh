@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+
+/// Loudness meter following EBU R128 (ITU-R BS.1770)
+/** Samples are K-weighted as they are fed in and only the mean square of each 100 ms
+  * sub-block is kept, so the meter can run along with any decoding loop. The 400 ms
+  * gating blocks and 3 s short-term windows are formed from the sub-blocks at the end.
+ */
+class LoudnessMeter {
+public:
+	LoudnessMeter(unsigned rate, unsigned channels);
+	/// Feed interleaved samples (any number of whole frames)
+	void process(float const* begin, float const* end);
+	/// Gated integrated loudness in LUFS (NaN if everything is below the absolute gate)
+	double integrated() const;
+	/// Loudness range in LU (EBU Tech 3342)
+	double range() const;
+	/// Maximum of the 4x oversampled signal in dBTP
+	double truePeak() const;
+
+private:
+	/// Two-stage K-weighting filter (high shelf + high pass) of one channel
+	struct Filter {
+		double s1[2], s2[2];  ///< Transposed direct form II state of both stages
+		Filter() { s1[0] = s1[1] = s2[0] = s2[1] = 0.0; }
+	};
+	static const unsigned Taps = 12;  ///< Input samples per oversampling phase
+	static const unsigned Phases = 4;
+	double m_b1[3], m_a1[3], m_b2[3], m_a2[3];  ///< Filter coefficients (a[0] = 1)
+	float m_fir[Phases][Taps];  ///< Polyphase interpolation filter for the true peak
+	unsigned m_channels;
+	unsigned m_subBlock;  ///< Frames per 100 ms
+	unsigned m_frames;  ///< Frames in the current sub-block
+	double m_energy;  ///< Weighted sum of squares of the current sub-block
+	float m_peak;
+	unsigned m_historyPos;
+	std::vector<Filter> m_filters;
+	std::vector<double> m_weights;  ///< Channel weights (surrounds louder, LFE ignored)
+	std::vector<float> m_history;  ///< Last Taps samples of each channel, stored twice for contiguous access
+	std::vector<double> m_subBlocks;  ///< Mean square of each finished sub-block
+};
+
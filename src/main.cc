@@ -1,13 +1,23 @@
 #include <QApplication>
 #include <QTranslator>
 #include <iostream>
+#include <string>
 #include "config.hh"
 #include "editorapp.hh"
+#include "analysisworker.hh"
+#include "chartlint.hh"
+#include "startuptrace.hh"
 
 int main(int argc, char *argv[])
 {
+	StartupTrace::start();
 	Q_INIT_RESOURCE(editor);
 
+	// Analysis workers are started by the editor and need no application object
+	for (int i = 1; i < argc; ++i) if (std::string(argv[i]) == "--analysis-worker") return AnalysisWorker::serve();
+	// Headless chart checking and batch analysis must work without a display
+	for (int i = 1; i < argc; ++i) if (std::string(argv[i]) == "--check" || std::string(argv[i]) == "--analyze") qputenv("QT_QPA_PLATFORM", "offscreen");
+
 	QApplication app(argc, argv);
 	// These values are used by e.g. Phonon and QSettings
 	app.setApplicationName(PACKAGE);
@@ -22,6 +32,7 @@ int main(int argc, char *argv[])
 	// additional dependency for a couple of very simple options.
 	QStringList args = QApplication::arguments();
 	QString openpath = "";
+	int workers = 0;
 	for (int i = 1; i < args.size(); ++i) { // FIXME: On Windows arg0 might or might not be the program name
 		if (args[i] == "--version" || args[i] == "-v") {
 			std::cout << VERSION << std::endl;
@@ -31,10 +42,22 @@ int main(int argc, char *argv[])
 			std::cout << PACKAGE << " " << VERSION << std::endl << std::endl
 				<< "-h [ --help ]      you are viewing it" << std::endl
 				<< "-v [ --version ]   display version number" << std::endl
+				<< "--check SONGFILE   compare the notes against the music and report problems" << std::endl
+				<< "--analyze FILE...  analyze music files into the cache, a worker process per core" << std::endl
+				<< "--workers N        the number of worker processes for --analyze" << std::endl
+				<< "--trace-startup    print the time taken by each phase of startup" << std::endl
 				<< "argument without a switch is interpreted as a song file to open" << std::endl
 				;
 			exit(EXIT_SUCCESS);
 		}
+		else if (args[i] == "--check" && i + 1 < args.size()) {
+			return checkChart(args[++i]);
+		}
+		else if (args[i] == "--workers" && i + 1 < args.size()) workers = args[++i].toInt();
+		else if (args[i] == "--analyze") {
+			return AnalysisWorker::batch(args.mid(i + 1), workers);
+		}
+		else if (args[i] == "--trace-startup") StartupTrace::setEnabled(true);
 		else if (!args[i].startsWith("-")) openpath = args[i]; // No switch
 		else {
 			std::cout << "Unknown option: " << args[i].toStdString() << std::endl;
@@ -48,7 +71,9 @@ int main(int argc, char *argv[])
 	translator.load(locale);
 	app.installTranslator(&translator);
 
+	StartupTrace::mark("application");
 	EditorApp window;
+	StartupTrace::mark("window created");
 	window.show();
 
 	if (!openpath.isEmpty()) window.openFile(openpath); // Load song if given in command line
@@ -54,6 +54,7 @@ void Reader::parseMThd() {
 void Reader::parseMTrk() {
 	m_pos = m_riffEnd;  // Skip any unread bytes of the previous
 	parseRiff("MTrk");
+	m_runningStatus = 0;  // Running status does not carry over to the next track
 }
 
 bool Reader::parseEvent(Event& ev) {
@@ -99,67 +100,95 @@ bool Reader::parseEvent(Event& ev) {
 	return true;
 }
 
-Writer::Writer(unsigned fmt, unsigned tracks, unsigned division) {
-	beginRiff("MThd");
+namespace {
+	/// Write a variable length quantity into a buffer (at most four bytes)
+	value_type* putVarLen(value_type* out, unsigned value) {
+		if (value >= 0x10000000U) throw std::logic_error("Value cannot be MIDI varlen encoded");
+		if (value >= 0x200000U) *out++ = 0x80 | ((value >> 21) & 0x7F);
+		if (value >= 0x4000U) *out++ = 0x80 | ((value >> 14) & 0x7F);
+		if (value >= 0x80U) *out++ = 0x80 | ((value >> 7) & 0x7F);
+		*out++ = value & 0x7F;
+		return out;
+	}
+
+	template <unsigned N> value_type* put(value_type* out, unsigned value) {
+		for (unsigned i = N - 1; i < N; --i) *out++ = value >> (8 * i);
+		return out;
+	}
+}
+
+Writer::Writer(char const* filename, unsigned fmt, unsigned tracks, unsigned division):
+  m_file(QFile::decodeName(filename)), m_tracksLeft(tracks), m_runningStatus(), m_inTrack() {
 	if (fmt == 0 && tracks != 1) throw std::logic_error("Format 0 MIDI must have exactly one track");
 	if (fmt == 1 && tracks < 2) throw std::logic_error("Format 1 MIDI must have a separate timing track");
 	if (division == 0) throw std::logic_error("Division must be set to a positive value");
-	write<2>(fmt);
-	write<2>(tracks);
-	write<2>(division);
+	if (!m_file.open(QIODevice::WriteOnly)) throw std::runtime_error("Unable to open " + std::string(filename) + " for writing");
+	value_type header[14] = { 'M', 'T', 'h', 'd' };
+	value_type* p = put<4>(header + 4, 6);
+	p = put<2>(p, fmt);
+	p = put<2>(p, tracks);
+	put<2>(p, division);
+	m_file.write(reinterpret_cast<char const*>(header), sizeof(header));
+	m_track.reserve(4096);
+}
+
+void Writer::close() {
+	endTrack();
+	if (m_tracksLeft) throw std::logic_error("Fewer MIDI tracks written than declared in the header");
+	// The previous file is only replaced if everything got written (otherwise the temporary file is removed)
+	if (!m_file.commit()) throw std::runtime_error("Error writing MIDI file");
 }
 
-void Writer::save(char const* filename) {
-	endRiff();
-	std::ofstream f(filename, std::ios::binary);
-	f.write(reinterpret_cast<char const*>(&m_data[0]), m_data.size());
+void Writer::startTrack(unsigned sizeHint) {
+	endTrack();
+	if (m_tracksLeft == 0) throw std::logic_error("More MIDI tracks written than declared in the header");
+	m_track.clear();
+	m_track.reserve(sizeHint);
+	m_runningStatus = 0;
+	m_inTrack = true;
 }
 
-void Writer::startTrack() {
-	endRiff();
-	beginRiff("MTrk");
+void Writer::endTrack() {
+	if (!m_inTrack) return;
+	value_type header[8] = { 'M', 'T', 'r', 'k' };
+	put<4>(header + 4, m_track.size());
+	m_file.write(reinterpret_cast<char const*>(header), sizeof(header));
+	if (!m_track.empty()) m_file.write(reinterpret_cast<char const*>(&m_track[0]), m_track.size());
+	--m_tracksLeft;
+	m_inTrack = false;
 }
 
 void Writer::writeEvent(Event const& ev) {
-	write_varlen(ev.timecode);
+	if (!m_inTrack) throw std::logic_error("MIDI event written outside of a track");
 	if (ev.type & ~0xF0 || ev.type < 0x80) throw std::logic_error("Invalid MIDI event type");
 	if (ev.channel & ~0x0F) throw std::logic_error("Invalid MIDI channel number");
-	write<1>(ev.type | ev.channel);
-	if (ev.type != Event::SPECIAL || ev.channel >= 8) write<1>(ev.arg1);  // Everything except System Common takes one argument
+	// The event (without any data) is assembled here and appended to the track at once
+	value_type buf[16];
+	value_type* p = putVarLen(buf, ev.timecode);
+	unsigned status = ev.type | ev.channel;
+	// The status byte is left out when a channel message repeats the previous one, other messages cancel that
+	if (ev.type == Event::SPECIAL) m_runningStatus = 0;
+	if (status != m_runningStatus) *p++ = status;
+	if (ev.type != Event::SPECIAL) m_runningStatus = status;
+	if (ev.type != Event::SPECIAL || ev.channel >= 8) *p++ = ev.arg1;  // Everything except System Common takes one argument
 	switch (ev.type) {
 	case Event::NOTE_ON:
 	case Event::NOTE_OFF:
 	case Event::NOTE_AFTERTOUCH:
 	case Event::CONTROLLER:
 	case Event::PITCH_BEND:
-		write<1>(ev.arg2);
+		*p++ = ev.arg2;
 		break;
 	case Event::PROGRAM_CHANGE:
 	case Event::CHANNEL_AFTERTOUCH:
 		if (ev.arg2 != 0) throw std::logic_error("MIDI event with non-zero arg2 for event that only takes one arg");
 		break;  // No arg2 for these
 	case Event::SPECIAL:  // Special category (system exclusive or meta event)
-		write_varlen(ev.end - ev.begin);  // data size
-		std::copy(ev.begin, ev.end, std::back_inserter(m_data));
+		p = putVarLen(p, ev.end - ev.begin);  // data size
 		break;
-	}	
-}
-
-void Writer::beginRiff(char const* name) {
-	m_riffBegin = m_data.size();
-	m_data.resize(m_riffBegin + 8);  // Add space for header
-	std::copy(name, name + 4, m_data.begin() + m_riffBegin);  // Set RIFF name
-}
-
-void Writer::endRiff() {
-	unsigned size = m_data.size() - m_riffBegin;
-	if (size == 0) return;  // Nothing to close
-	size -= 8;
-	m_data[m_riffBegin + 4] = size >> 24;
-	m_data[m_riffBegin + 5] = size >> 16;
-	m_data[m_riffBegin + 6] = size >> 8;
-	m_data[m_riffBegin + 7] = size;
-	m_riffBegin = m_data.size();
+	}
+	m_track.insert(m_track.end(), buf, p);
+	if (ev.type == Event::SPECIAL) m_track.insert(m_track.end(), ev.begin, ev.end);
 }
 
 // Debugging facilities follow
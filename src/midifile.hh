@@ -1,6 +1,8 @@
 #pragma once
 
 #include "types.hh"
+#include <QSaveFile>
+#include <fstream>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -97,33 +99,27 @@ namespace midifile {
 
 	class Writer {
 	public:
-		/// MIDI file writer (constructs the output in a memory buffer)
+		/// MIDI file writer, each track is collected into a buffer and written to the file when it ends
+		/// @param filename The file to create (an existing one is only replaced by close(), it stays as it was if anything fails)
 		/// @param fmt MIDI format (use 1 if in doubt)
 		/// @param tracks The number of tracks (with fmt 1 this is one more than the actual tracks)
 		/// @param division How many timecode units fit into a beat (1/4 note)
-		Writer(unsigned fmt, unsigned tracks, unsigned division);
-		/// Flush the output to a file (after writing everything)
-		void save(char const* filename);
+		Writer(char const* filename, unsigned fmt, unsigned tracks, unsigned division);
+		/// Write the last track and replace the file with the new one (after writing everything)
+		void close();
 		/// Start a new track, must be called before each track.
 		/// Ends any previous track but won't automatically add end of track event.
-		void startTrack();
-		/// Writes an event to current track
+		/// @param sizeHint Expected size of the track in bytes (the buffer is reserved in advance)
+		void startTrack(unsigned sizeHint = 0);
+		/// Writes an event to current track, using running status for channel messages
 		void writeEvent(Event const& ev);
 	private:
-		void beginRiff(char const* name);
-		void endRiff();
-		template <unsigned N> void write(unsigned value) {
-			for (unsigned i = N - 1; i < N; --i) m_data.push_back(value >> (8 * i));
-		}
-		void write_varlen(unsigned value) {
-			if (value >= 0x10000000U) throw std::logic_error("Value cannot be MIDI varlen encoded");
-			if (value >= 0x200000U) m_data.push_back(0x80 | (value >> 21));
-			if (value >= 0x4000U) m_data.push_back(0x80 | (value >> 14));
-			if (value >= 0x80U) m_data.push_back(0x80 | (value >> 7));
-			m_data.push_back(value & 0x7F);
-		}
-		std::vector<value_type> m_data;
-		unsigned m_riffBegin;
+		void endTrack();
+		QSaveFile m_file;  ///< Written into a temporary file until committed
+		std::vector<value_type> m_track;  ///< The current track (the buffer is reused by the next one)
+		unsigned m_tracksLeft;  ///< Tracks declared in the header that are not written yet
+		unsigned m_runningStatus;  ///< Status of the previous channel message of the track (0 if none)
+		bool m_inTrack;
 	};
 }
 
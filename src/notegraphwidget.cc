@@ -7,14 +7,21 @@
 #include <QToolTip>
 #include <QMessageBox>
 #include <QMimeData>
+#include <QGuiApplication>
+#include <QScreen>
+#include <QLocale>
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#include <limits>
 #include "notelabel.hh"
 #include "notegraphwidget.hh"
 #include "song.hh"
 #include "util.hh"
 #include "busydialog.hh"
+#include "chartlint.hh"
+#include "hyphenator.hh"
+#include "renderstats.hh"
 
 
 namespace {
@@ -25,6 +32,14 @@ namespace {
 	}
 
 	static const double endMarginSeconds = 5.0;
+	static const double sentenceGapSeconds = 0.8;  ///< Unvoiced time between notes that suggests a sentence break
+
+	/// Milliseconds between the refreshes of the display
+	int frameInterval() {
+		QScreen* screen = QGuiApplication::primaryScreen();
+		qreal rate = screen ? screen->refreshRate() : 0.0;
+		return rate > 0.0 ? std::max(1, int(1000.0 / rate)) : 16;
+	}
 }
 
 /*static*/ const int NoteGraphWidget::Height = 768;
@@ -32,7 +47,7 @@ namespace {
 
 NoteGraphWidget::NoteGraphWidget(QWidget *parent)
 	: NoteLabelManager(parent), m_mouseHotSpot(), m_seeking(), m_actionHappened(),
-	m_seekHandle(this), m_nextNotePixmap(), m_notePixmapTimer(), m_analyzeTimer(), m_playbackTimer(), m_playbackPos(), m_pixmap(), m_pixmapPos()
+	m_seekHandle(this), m_nextNotePixmap(), m_notePixmapTimer(), m_noteUpdateTimer(), m_analyzeTimer(), m_playbackTimer(), m_playbackPos(), m_pixmap(), m_pixmapPos(), m_layerRectsPps()
 {
 	setProperty("darkBackground", true);
 	setStyleSheet("QLabel[darkBackground=\"true\"] { background: " + BGColor + "; }");
@@ -57,12 +72,19 @@ NoteGraphWidget::NoteGraphWidget(QWidget *parent)
 }
 
 
-void NoteGraphWidget::setLyrics(QString lyrics)
+void NoteGraphWidget::setLyrics(QString lyrics, QString language)
 {
 	BusyDialog busy(this, 2);
+	Hyphenator const* hyphenator = Hyphenator::forLanguage(language);
 	QTextStream ts(&lyrics, QIODevice::ReadOnly);
 
-	doOperation(Operation("CLEAR"));
+	// Only the track being edited gets the new lyrics
+	int ops = 0;
+	if (m_layers.isEmpty()) doOperation(Operation("CLEAR"));
+	else {
+		selectNote(NULL);
+		for (; !m_notes.isEmpty(); ++ops) doOperation(Operation("DEL", m_notes.size() - 1), Operation::NO_UPDATE);
+	}
 	bool firstNote = true;
 	while (!ts.atEnd()) {
 		busy();
@@ -73,8 +95,14 @@ void NoteGraphWidget::setLyrics(QString lyrics)
 		while (!ts2.atEnd()) {
 			QString word;
 			ts2 >> word;
-			if (!word.isEmpty()) {
-				Note note(word + " "); note.end = NoteLabel::default_length; note.note = 24;
+			if (word.isEmpty()) continue;
+			// Words hyphenated by hand are split at the hyphens, others by the patterns
+			QStringList syllables = word.split('-', QString::SkipEmptyParts);
+			if (syllables.size() == 1 && hyphenator) syllables = hyphenator->syllables(word);
+			else if (syllables.isEmpty()) syllables << word;
+			for (int i = 0; i < syllables.size(); ++i) {
+				// The space marks the end of the word
+				Note note(syllables[i] + (i + 1 == syllables.size() ? " " : "")); note.end = NoteLabel::default_length; note.note = 24;
 				if (sentenceStart) note.lineBreak = true;
 				doOperation(opFromNote(note, m_notes.size(), !firstNote), Operation::NO_UPDATE);
 				firstNote = false;
@@ -85,29 +113,63 @@ void NoteGraphWidget::setLyrics(QString lyrics)
 	// Set duration
 	m_duration = std::max(m_duration, NoteLabel::default_length * m_notes.size() * 1.1 + endMarginSeconds);
 
-	finalizeNewLyrics();
+	finalizeNewLyrics(ops);
+	if (!hyphenator) {
+		emit statusBarMessage(tr("No hyphenation patterns for %1, only words hyphenated by hand were split. "
+			"Patterns (hyph-xx.pat.txt or hyph_xx.dic) can be installed into %2")
+			.arg(language.isEmpty() ? QLocale::system().name() : language).arg(Hyphenator::userDirectory()));
+	}
 }
 
 void NoteGraphWidget::setLyrics(const VocalTrack &track)
+{
+	VocalTracks tracks;
+	tracks.insert(std::make_pair(TrackName::LEAD_VOCAL, track));
+	setLyrics(tracks);
+}
+
+void NoteGraphWidget::setLyrics(const VocalTracks &tracks)
 {
 	BusyDialog busy(this, 10);
 	doOperation(Operation("CLEAR"));
+	// The other tracks first, so that the lead vocals (or the last track without them) are the ones being edited in the end
+	int ops = 0;
+	VocalTracks::const_iterator edited = tracks.find(TrackName::LEAD_VOCAL);
+	if (edited == tracks.end() && !tracks.empty()) --edited;
+	for (VocalTracks::const_iterator it = tracks.begin(); it != tracks.end(); ++it) {
+		if (it == edited) continue;
+		doOperation(Operation("TRACK") << it->first, Operation::NO_UPDATE);
+		ops += 1 + addNotes(it->second, busy);
+	}
+	if (edited != tracks.end()) {
+		if (m_track != edited->first) {
+			doOperation(Operation("TRACK") << edited->first, Operation::NO_UPDATE);
+			++ops;
+		}
+		addNotes(edited->second, busy);  // Counted by finalizeNewLyrics
+	}
+	finalizeNewLyrics(ops);
+}
+
+int NoteGraphWidget::addNotes(const VocalTrack &track, BusyDialog &busy)
+{
 	m_duration = std::max(m_duration, track.endTime + endMarginSeconds);
+	int count = 0;
 	const Notes &notes = track.notes;
 	for (Notes::const_iterator it = notes.begin(); it != notes.end(); ++it) {
 		if (it->type == Note::SLEEP) continue;
 		doOperation(opFromNote(*it, m_notes.size(), false), Operation::NO_UPDATE);
+		++count;
 		busy();
 	}
-
-	finalizeNewLyrics();
+	return count;
 }
 
-void NoteGraphWidget::finalizeNewLyrics()
+void NoteGraphWidget::finalizeNewLyrics(int ops)
 {
-	int ops = m_notes.size();
+	ops += m_notes.size();
 	// Set the last note to non-floating and to the end of the song
-	if (ops > 1 && m_notes[ops-1]->isFloating()) {
+	if (m_notes.size() > 1 && m_notes.back()->isFloating()) {
 		doOperation(Operation("FLOATING", (int)m_notes.size()-1, false));
 		Operation moveop("MOVE");
 		moveop << (int)m_notes.size()-1
@@ -147,11 +209,22 @@ void NoteGraphWidget::scrollToFirstNote()
 
 void NoteGraphWidget::analyzeMusic(QString filepath, int visId)
 {
+	if (visId == 0) m_pitchIndex = PitchIndex();
 	m_pitch[visId].reset(new PitchVis(filepath, this, visId));
 	connect(m_pitch[visId].data(), SIGNAL(renderedImage(QImage,QPoint,int)), this, SLOT(updatePixmap(QImage,QPoint,int)));
 	m_analyzeTimer = startTimer(100);
 }
 
+void NoteGraphWidget::setVideo(QString filepath, double videoGap)
+{
+	m_video.reset();
+	if (!filepath.isEmpty()) {
+		m_video.reset(new VideoThumbnails(filepath, videoGap, this));
+		connect(m_video.data(), SIGNAL(updated()), this, SLOT(update()));
+	}
+	update();
+}
+
 void NoteGraphWidget::timerEvent(QTimerEvent* event)
 {
 	if (event->timerId() == m_playbackTimer) {
@@ -173,9 +246,16 @@ void NoteGraphWidget::timerEvent(QTimerEvent* event)
 		// Analyzing has ended?
 		if (progress == 1.0) {
 			killTimer(m_analyzeTimer);
+			m_pitchIndex = PitchIndex(m_pitch[0]->getAnalysis());
 			updatePitch();
 		}
 
+	} else if (event->timerId() == m_noteUpdateTimer) {
+		if (!updateDirtyNotes()) {
+			killTimer(m_noteUpdateTimer);
+			m_noteUpdateTimer = 0;
+		}
+
 	} else if (event->timerId() == m_notePixmapTimer) {
 		// Here we create a pixmap for a NoteLabel
 		if (m_nextNotePixmap >= m_notes.size()) {
@@ -191,6 +271,52 @@ void NoteGraphWidget::timerEvent(QTimerEvent* event)
 	}
 }
 
+void NoteGraphWidget::trackChanged()
+{
+	m_layerRects.clear();
+	updateNotes();
+	startNotePixmapUpdates();
+	scheduleNoteUpdates();  // The labels shown again may have changed while hidden
+	update();
+}
+
+namespace {
+	bool endsBefore(QRect const& rect, int x) { return rect.right() < x; }
+}
+
+void NoteGraphWidget::paintLayers(QPainter& painter, int x1, int x2)
+{
+	if (m_layers.isEmpty()) return;
+	// The notes of the other tracks do not change while they are not edited, only the zoom changes their outlines
+	if (m_layerRectsPps != m_pixelsPerSecond) {
+		m_layerRects.clear();
+		m_layerRectsPps = m_pixelsPerSecond;
+	}
+	static const QColor colors[] = { QColor(80, 160, 255, 100), QColor(255, 170, 60, 100), QColor(140, 230, 80, 100) };
+	painter.save();
+	painter.setPen(Qt::NoPen);
+	int layer = 0;
+	for (QMap<QString, NoteLabels>::const_iterator it = m_layers.begin(); it != m_layers.end(); ++it, ++layer) {
+		std::vector<QRect>& rects = m_layerRects[it.key()];
+		if (rects.empty()) {
+			NoteLabels const& labels = it.value();
+			rects.reserve(labels.size());
+			for (int i = 0; i < labels.size(); ++i) {
+				Note const& n = labels[i]->note();
+				int x = s2px(n.begin);
+				rects.push_back(QRect(x, n2px(n.note) - m_noteHalfHeight, std::max(1, s2px(n.end) - x), 2 * m_noteHalfHeight));
+			}
+		}
+		// Notes do not overlap, so those in view are found by a binary search
+		std::vector<QRect>::const_iterator begin = std::lower_bound(rects.begin(), rects.end(), x1, endsBefore), end = begin;
+		while (end != rects.end() && end->left() <= x2) ++end;
+		if (begin == end) continue;
+		painter.setBrush(colors[layer % (sizeof(colors) / sizeof(*colors))]);
+		painter.drawRects(&*begin, end - begin);
+	}
+	painter.restore();
+}
+
 void NoteGraphWidget::startNotePixmapUpdates()
 {
 	// With 0-delay, note pixmaps are created whenever there is not events to process
@@ -199,7 +325,33 @@ void NoteGraphWidget::startNotePixmapUpdates()
 	m_nextNotePixmap = 0;
 }
 
-void NoteGraphWidget::paintEvent(QPaintEvent*)
+void NoteGraphWidget::scheduleNoteUpdates()
+{
+	// However many notes change, they are all updated by the same timer
+	if (!m_noteUpdateTimer) m_noteUpdateTimer = startTimer(frameInterval());
+}
+
+bool NoteGraphWidget::updateDirtyNotes()
+{
+	// The visible notes are all updated on this frame, the others as long as half of the frame lasts
+	QElapsedTimer timer;
+	timer.start();
+	QRect visible = visibleRegion().boundingRect();
+	int budget = frameInterval() / 2;
+	bool remaining = false;
+	for (int pass = 0; pass < 2; ++pass) {
+		for (int i = 0; i < m_notes.size(); ++i) {
+			NoteLabel *nl = m_notes[i];
+			if (!nl->isDirty() || nl->isHidden()) continue;  // Hidden ones are updated when their pixmap is created
+			if (pass == 0 && !nl->geometry().intersects(visible)) continue;
+			if (pass == 1 && timer.elapsed() >= budget) { remaining = true; break; }
+			nl->updatePixmap();
+		}
+	}
+	return remaining;
+}
+
+void NoteGraphWidget::paintEvent(QPaintEvent* event)
 {
 	setFixedSize(s2px(m_duration), height());
 
@@ -208,6 +360,7 @@ void NoteGraphWidget::paintEvent(QPaintEvent*)
 	calcViewport(x1, y1, x2, y2);
 
 	QPainter painter(this);
+	RENDER_STATS_PIXELS(event->rect().width() * event->rect().height());
 
 	// PitchVis pixmap
 	for (int i = 0; i < MaxPitchVis; ++i) {
@@ -215,12 +368,32 @@ void NoteGraphWidget::paintEvent(QPaintEvent*)
 			painter.drawPixmap(m_pixmapPos[i], m_pixmap[i]);
 	}
 
+	// Video keyframes along the top of the view, each shown until the next one (or until space runs out)
+	if (m_video) {
+		std::vector<double> times = m_video->times();
+		int right = std::numeric_limits<int>::min();  // Where the previous thumbnail ends
+		for (std::size_t i = 0; i < times.size(); ++i) {
+			int x = s2px(times[i]);
+			if (x > x2) break;
+			if (i + 1 < times.size() && s2px(times[i+1]) <= x1) continue;  // Followed by another one before the view
+			if (x < right) continue;  // Would overlap the previous one
+			QImage image = m_video->thumbnail(times[i]);
+			if (image.isNull()) continue;
+			int left = std::max(x, x1);  // The one already shown at the left edge of the view stays there
+			painter.drawImage(left, y1, image);
+			right = left + image.width() + 1;
+		}
+	}
+
 	// Octave lines
 	QPen pen; pen.setWidth(1); pen.setColor(QColor("#666"));
 	painter.setPen(pen);
 	for (int i = 1; i < 4; ++i)
 		painter.drawLine(x1, n2px(i*12), x2, n2px(i*12));
 
+	// The other tracks behind the notes being edited
+	paintLayers(painter, x1, x2);
+
 	// Selection box
 	if (!m_mouseHotSpot.isNull()) {
 		QPoint mousep = mapFromGlobal(QCursor::pos());
@@ -235,6 +408,7 @@ void NoteGraphWidget::updatePixmap(const QImage &image, const QPoint &position,
 	// PitchVis sends its renderings here, let's save & draw them
 	// This gets actually called in our own thread by our own event loop (queued connection)
 	m_pixmap[visId] = QPixmap::fromImage(image);
+	RENDER_STATS_PIXMAP();
 	m_pixmapPos[visId] = position;
 	update();
 }
@@ -243,10 +417,12 @@ void NoteGraphWidget::updatePitch()
 {
 	// Called whenever pitch needs updating
 	// Note that the scrollbar change signals are connected here, so no need to call this from everywhere
-	if (!m_pitch[0]) return;
 	// Find out the viewport
 	int x1, y1, x2, y2;
 	calcViewport(x1, y1, x2, y2);
+	// The video strip stays at the top of the view, so it moves in the widget
+	if (m_video) update(x1, y1, x2 - x1, VideoThumbnails::Height);
+	if (!m_pitch[0]) return;
 	// Ask for a new render
 	for (int i = 0; i < MaxPitchVis; ++i)
 		if (m_pitch[i]) m_pitch[i]->paint(x1, 0, x2, height());
@@ -313,6 +489,37 @@ void NoteGraphWidget::updateNotes(bool leftToRight)
 	}
 }
 
+void NoteGraphWidget::suggestLineBreaks()
+{
+	if (!m_pitch[0]) return;
+	// Only add breaks, the ones already set by the user are kept
+	int ops = 0;
+	for (int i = 1; i < m_notes.size(); ++i) {
+		if (m_notes[i]->isLineBreak()) continue;
+		double gap = m_pitch[0]->longestUnvoiced(m_notes[i-1]->note().end, m_notes[i]->note().begin);
+		if (gap < sentenceGapSeconds) continue;
+		doOperation(Operation("LINEBREAK", i, true), Operation::NO_UPDATE);
+		++ops;
+	}
+	if (ops) doOperation(Operation("COMBINER", ops), Operation::NO_UPDATE);
+	emit statusBarMessage(tr("%n sentence break(s) added", "", ops));
+}
+
+void NoteGraphWidget::checkNotes()
+{
+	if (!m_pitch[0]) return;
+	Notes notes;
+	for (int i = 0; i < m_notes.size(); ++i) notes.push_back(m_notes[i]->note());
+	std::vector<NoteCheck> checks = ChartLint(m_pitch[0]->getAnalysis()).check(notes);
+	int count = 0;
+	for (int i = 0; i < m_notes.size(); ++i) {
+		QString problem = checks[i].problems();
+		if (!problem.isEmpty()) ++count;
+		if (problem != m_notes[i]->problem()) m_notes[i]->setProblem(problem);
+	}
+	emit statusBarMessage(tr("%n note(s) with problems", "", count));
+}
+
 void NoteGraphWidget::updateMusicPos(qint64 time, bool smoothing)
 {
 	m_playbackPos = time;
@@ -322,12 +529,14 @@ void NoteGraphWidget::updateMusicPos(qint64 time, bool smoothing)
 	if (smoothing) m_playbackTimer = startTimer(20); // Hope for 50 fps
 	else m_playbackTimer = 0;
 	m_playbackInterval.restart();
+	emit playbackPitch(smoothing ? m_pitchIndex.pitchAt(m_playbackPos / 1000.0) : getNaN());
 }
 
 void NoteGraphWidget::stopMusic()
 {
 	if (m_playbackTimer) killTimer(m_playbackTimer);
 	m_playbackTimer = 0;
+	emit playbackPitch(getNaN());
 }
 
 void NoteGraphWidget::seek(int x)
@@ -574,7 +783,7 @@ void NoteGraphWidget::dropEvent(QDropEvent *event)
 			QMessageBox::Ok | QMessageBox::Cancel)
 		== QMessageBox::Ok)
 	{
-		setLyrics(lyrics);
+		setLyrics(lyrics, m_language);
 	}
 	event->acceptProposedAction();
 }
@@ -601,6 +810,10 @@ void NoteGraphWidget::showContextMenu(const QPoint &pos)
 	actionFloating->setCheckable(true);
 	QAction *actionLineBreak = menuContext.addAction(tr("Line break"));
 	actionLineBreak->setCheckable(true);
+	QAction *actionSuggestBreaks = menuContext.addAction(tr("Suggest sentence breaks"));
+	actionSuggestBreaks->setEnabled(m_pitch[0] && m_pitch[0]->getProgress() >= 1.0 && m_notes.size() > 1); // Needs finished analysis
+	QAction *actionCheckNotes = menuContext.addAction(tr("Check notes"));
+	actionCheckNotes->setEnabled(m_pitch[0] && m_pitch[0]->getProgress() >= 1.0 && !m_notes.isEmpty()); // Needs finished analysis
 	menuContext.addAction(menuType.menuAction());
 	QAction *actionNormal = menuType.addAction(tr("Normal"));
 	actionNormal->setCheckable(true);
@@ -622,6 +835,24 @@ void NoteGraphWidget::showContextMenu(const QPoint &pos)
 	}
 	menuContext.addSeparator();
 
+	// The tracks that there are and the parts of a harmony that could be added
+	QMenu menuTrack(tr("Track"), NULL);
+	menuContext.addAction(menuTrack.menuAction());
+	QStringList trackNames = tracks();
+	for (unsigned i = 0; i < 4; ++i) {
+		if (!trackNames.contains(TrackName::vocalPart(i))) trackNames << TrackName::vocalPart(i);
+	}
+	trackNames.sort();
+	QList<QAction*> trackActions;
+	for (int i = 0; i < trackNames.size(); ++i) {
+		QAction *actionTrack = menuTrack.addAction(trackNames[i]);
+		actionTrack->setCheckable(true);
+		actionTrack->setChecked(trackNames[i] == m_track);
+		actionTrack->setData(trackNames[i]);
+		trackActions << actionTrack;
+	}
+	menuContext.addSeparator();
+
 	QAction *actionResetZoom = menuContext.addAction(tr("Reset zoom"));
 	actionResetZoom->setIcon(QIcon::fromTheme("zoom-original", QIcon(":/icons/zoom-original.png")));
 	actionResetZoom->setEnabled(getZoomLevel() != 100);
@@ -656,6 +887,8 @@ void NoteGraphWidget::showContextMenu(const QPoint &pos)
 		else if (sel == actionLyric) editLyric(nl);
 		else if (sel == actionFloating) setFloating(nl, !nl->isFloating());
 		else if (sel == actionLineBreak) setLineBreak(nl, !nl->isLineBreak());
+		else if (sel == actionSuggestBreaks) suggestLineBreaks();
+		else if (sel == actionCheckNotes) checkNotes();
 		else if (sel == actionNormal) setType(nl, 0);
 		else if (sel == actionGolden) setType(nl, 1);
 		else if (sel == actionFreestyle) setType(nl, 2);
@@ -667,26 +900,44 @@ void NoteGraphWidget::showContextMenu(const QPoint &pos)
 		else if (sel == actionSelectAll) selectAll();
 		else if (sel == actionSelectAllAfter) selectAllAfter();
 		else if (sel == actionDeselect) selectNote(NULL);
+		else if (trackActions.contains(sel) && sel->data().toString() != m_track) doOperation(Operation("TRACK") << sel->data().toString());
 	}
+	menuTrack.clear();
 	menuType.clear();
 	menuContext.clear();
 }
 
 
-VocalTrack NoteGraphWidget::getVocalTrack() const
-{
-	VocalTrack track(TrackName::LEAD_VOCAL);
-	Notes& notes = track.notes;
-	if (!m_notes.isEmpty()) {
-		for (int i = 0; i < m_notes.size(); ++i) {
-			notes.push_back(m_notes[i]->note());
-			track.noteMin = std::min(notes.back().note, track.noteMin);
-			track.noteMax = std::max(notes.back().note, track.noteMin);
+namespace {
+	VocalTrack toVocalTrack(QString const& name, NoteLabels const& labels)
+	{
+		VocalTrack track(name);
+		Notes& notes = track.notes;
+		if (!labels.isEmpty()) {
+			for (int i = 0; i < labels.size(); ++i) {
+				notes.push_back(labels[i]->note());
+				track.noteMin = std::min(notes.back().note, track.noteMin);
+				track.noteMax = std::max(notes.back().note, track.noteMax);
+			}
+			track.beginTime = notes.front().begin;
+			track.endTime = notes.back().end;
 		}
-		track.beginTime = notes.front().begin;
-		track.endTime = notes.back().end;
+		return track;
 	}
-	return track;
+}
+
+VocalTrack NoteGraphWidget::getVocalTrack() const
+{
+	return toVocalTrack(m_track, m_notes);
+}
+
+VocalTracks NoteGraphWidget::getVocalTracks() const
+{
+	VocalTracks tracks;
+	tracks.insert(std::make_pair(m_track, getVocalTrack()));
+	for (QMap<QString, NoteLabels>::const_iterator it = m_layers.begin(); it != m_layers.end(); ++it)
+		tracks.insert(std::make_pair(it.key(), toVocalTrack(it.key(), it.value())));
+	return tracks;
 }
 
 QString NoteGraphWidget::getCurrentSentence() const
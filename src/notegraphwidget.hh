@@ -1,13 +1,18 @@
 #pragma once
 
 #include "pitchvis.hh"
+#include "videothumbs.hh"
 #include "notes.hh"
 #include "operation.hh"
 #include <QLabel>
 #include <QList>
+#include <QMap>
 #include <QScopedPointer>
+#include <QStringList>
 #include <QElapsedTimer>
 
+class BusyDialog;
+class QPainter;
 class QScrollArea;
 class NoteLabel;
 typedef QList<NoteLabel*> NoteLabels;
@@ -38,7 +43,10 @@ public:
 	virtual void updateNotes(bool leftToRight = true) {}
 	virtual void startNotePixmapUpdates() {}
 
-	void clearNotes();
+	void clearNotes();  ///< Remove the notes of all tracks
+	void setTrack(QString const& name);  ///< Edit another vocal track, the notes of the others are shown as layers
+	QString const& track() const { return m_track; }
+	QStringList tracks() const;  ///< Names of the tracks that have notes and of the one being edited
 	void selectNote(NoteLabel *note, bool clearPrevious = true);
 	void selectAll();
 	void selectAllAfter();
@@ -85,6 +93,7 @@ public slots:
 	void paste();
 
 protected:
+	virtual void trackChanged() {}
 	QScrollArea* getScrollArea() const;
 	void calcViewport(int &x1, int &y1, int &x2, int &y2) const;
 
@@ -95,7 +104,9 @@ protected:
 	static const double ppsNormal = 200.0;  ///< Pixels per second with default zoom
 	double m_pixelsPerSecond;
 
-	NoteLabels m_notes;
+	NoteLabels m_notes;  ///< The track being edited, operations refer to these by index
+	QString m_track;
+	QMap<QString, NoteLabels> m_layers;  ///< Notes of the other tracks (hidden, their pixmaps are kept)
 	NoteLabels m_selectedNotes;
 	enum NoteAction { NONE, RESIZE, MOVE } m_selectedAction;
 	int m_noteHalfHeight;
@@ -115,17 +126,24 @@ public:
 
 	NoteGraphWidget(QWidget *parent = 0);
 
-	void setLyrics(QString lyrics);
+	/// Plain text lyrics, words are split into syllables with the hyphenation patterns of the language (the system language if empty)
+	void setLyrics(QString lyrics, QString language = QString());
 	void setLyrics(const VocalTrack &track);
+	void setLyrics(const VocalTracks &tracks);  ///< All tracks of a song, the lead vocals are edited first
 	void analyzeMusic(QString filepath, int visId = 0);
+	void setVideo(QString filepath, double videoGap);  ///< Show keyframes of the video above the notes (none if filepath is empty)
+	void setLanguage(QString const& language) { m_language = language; }  ///< Of the song, for lyrics dropped on the graph
 
 	void updateNotes(bool leftToRight = true);
 	void updateMusicPos(qint64 time, bool smoothing = true);
 	void stopMusic();
 	void seek(int x);
+	void suggestLineBreaks();  ///< Set line breaks at long unvoiced gaps of the analyzed music
+	void checkNotes();  ///< Mark the notes that do not match the analyzed music
 	void zoom(float steps, double focalSecs = -1);
 
-	VocalTrack getVocalTrack() const;
+	VocalTrack getVocalTrack() const;  ///< The track being edited
+	VocalTracks getVocalTracks() const;  ///< All tracks with notes (and the one being edited)
 	QString getCurrentSentence() const;
 	QString getPrevSentence() const;
 	QString dumpLyrics() const;
@@ -137,13 +155,17 @@ public slots:
 	void setSeekHandleWrapToViewport(bool state) { m_seekHandle.wrapToViewport = state; }
 	void updatePixmap(const QImage &image, const QPoint &position, int visId);
 	void updatePitch();
+	/// The finished pitch analysis of the music, NULL while analysing
+	PitchAnalysis const* analysis() const { return m_pitch[0] && m_pitch[0]->getProgress() >= 1.0 ? &m_pitch[0]->getAnalysis() : NULL; }
 	void abortPitch() { for (int i = 0; i < MaxPitchVis; ++i) if (m_pitch[i]) m_pitch[i]->cancel(); }
 	void scrollToFirstNote();
 	void startNotePixmapUpdates(); ///< Starts creating pixmaps for NoteLabels
+	void scheduleNoteUpdates(); ///< Updates the pixmaps of changed NoteLabels on the next frame
 
 signals:
 	void analyzeProgress(int, int);
 	void seeked(qint64 time);
+	void playbackPitch(float note);  ///< The dominant analysed pitch at the playback position (NaN if none or stopped)
 
 protected:
 	void mousePressEvent(QMouseEvent *event);
@@ -157,24 +179,34 @@ protected:
 	void resizeEvent(QResizeEvent *) { updatePitch(); }
 	void dragEnterEvent(QDragEnterEvent *event);
 	void dropEvent(QDropEvent *event);
+	void trackChanged();
 
 private:
-	void finalizeNewLyrics();
+	void paintLayers(QPainter& painter, int x1, int x2);
+	int addNotes(const VocalTrack &track, BusyDialog &busy);  ///< Returns the number of operations done
+	void finalizeNewLyrics(int ops = 0);  ///< ops: the number of operations done for the import besides adding the notes being edited
 	void timeCurrent();
+	bool updateDirtyNotes();  ///< Returns true if some are left for the next frame
 
 	QPoint m_mouseHotSpot;
 	bool m_seeking;
 	bool m_actionHappened;
 	QScopedPointer<PitchVis> m_pitch[MaxPitchVis];
+	QScopedPointer<VideoThumbnails> m_video;
 	SeekHandle m_seekHandle;
 	int m_nextNotePixmap;
 	int m_notePixmapTimer;
+	int m_noteUpdateTimer;
 	int m_analyzeTimer;
 	int m_playbackTimer;
 	QElapsedTimer m_playbackInterval;
 	qint64 m_playbackPos;
 	QPixmap m_pixmap[MaxPitchVis];
 	QPoint m_pixmapPos[MaxPitchVis];
+	PitchIndex m_pitchIndex;  ///< Of the primary music once analysed
+	QMap<QString, std::vector<QRect> > m_layerRects;  ///< Outlines of the notes of the other tracks (in time order)
+	double m_layerRectsPps;  ///< The zoom that m_layerRects are for
+	QString m_language;  ///< Of the song (the system language if empty)
 };
 
 
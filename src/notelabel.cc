@@ -3,21 +3,22 @@
 #include <QToolTip>
 #include <QPainter>
 #include <QMenu>
+#include <QTimer>
 #include <iostream>
 #include "notelabel.hh"
 #include "notegraphwidget.hh"
+#include "renderstats.hh"
 
 namespace {
 	static const int text_margin = 3; // Margin of the label texts
 }
 
-const int NoteLabel::render_delay = 300; // How many ms to wait before updating pixmap after some action
 const int NoteLabel::resize_margin = 5; // How many pixels is the resize area
 const double NoteLabel::default_length = 0.5; // The preferred size of notes
 const double NoteLabel::min_length = 0.05; // How many seconds minimum
 
 NoteLabel::NoteLabel(const Note &note, QWidget *parent, bool floating)
-	: QLabel(parent), m_note(note), m_selected(false), m_floating(floating), m_resizing(0), m_hotspot()
+	: QLabel(parent), m_note(note), m_selected(false), m_floating(floating), m_resizing(0), m_hotspot(), m_dirty(), m_tipsDirty(true)
 {
 	updateLabel();
 	setMouseTracking(true);
@@ -31,6 +32,7 @@ NoteLabel::NoteLabel(const Note &note, QWidget *parent, bool floating)
 void NoteLabel::updatePixmap()
 {
 	if (isHidden()) return;
+	m_dirty = false;
 	QFont font;
 	font.setStyleStrategy(QFont::ForceOutline);
 	QFontMetrics metric(font);
@@ -77,17 +79,33 @@ void NoteLabel::updatePixmap()
 			painter.setPen(QPen(QBrush(QColor(255, 0, 0)), 4));
 			painter.drawLine(2, 0, 2, image.height()-1);
 		}
+
+		// Render chart check warning
+		if (!m_problem.isEmpty()) {
+			painter.setPen(QPen(QBrush(QColor(255, 160, 0)), 2, Qt::DashLine));
+			painter.setBrush(Qt::NoBrush);
+			painter.drawRoundedRect(QRectF(1.5, 1.5, image.width()-3, image.height()-3), 8, 8);
+		}
 	}
 
 	setPixmap(QPixmap::fromImage(image));
-	updateTips();
+	RENDER_STATS_IMAGE(image.width(), image.height());
 	show();
 }
 
+void NoteLabel::invalidate()
+{
+	m_dirty = true;
+	m_tipsDirty = true;
+	NoteGraphWidget *ngw = qobject_cast<NoteGraphWidget*>(parent());
+	if (ngw) ngw->scheduleNoteUpdates();
+	else QTimer::singleShot(0, this, SLOT(updatePixmap()));
+}
+
 void NoteLabel::setSelected(bool state) {
 	if (m_selected != state) {
 		m_selected = state;
-		QTimer::singleShot(50, this, SLOT(updatePixmap())); // Quick update needed here for box selection
+		invalidate();
 		if (!m_selected) {
 			startResizing(0); // Reset
 			startDragging(QPoint()); // Reset
@@ -95,9 +113,25 @@ void NoteLabel::setSelected(bool state) {
 	}
 }
 
-void NoteLabel::resizeEvent(QResizeEvent *) { updatePixmap(); }
+void NoteLabel::resizeEvent(QResizeEvent *) { invalidate(); }
+
+void NoteLabel::moveEvent(QMoveEvent *) { m_tipsDirty = true; }
 
-void NoteLabel::moveEvent(QMoveEvent *) { updateTips(); }
+bool NoteLabel::event(QEvent *event)
+{
+	// The tips are built just before they are shown (entering shows the status tip)
+	switch (event->type()) {
+	case QEvent::Enter:
+	case QEvent::ToolTip:
+	case QEvent::QueryWhatsThis:
+	case QEvent::WhatsThis:
+		if (m_tipsDirty) updateTips();
+		break;
+	default:
+		break;
+	}
+	return QLabel::event(event);
+}
 
 void NoteLabel::mouseMoveEvent(QMouseEvent *event)
 {
@@ -112,6 +146,7 @@ void NoteLabel::mouseMoveEvent(QMouseEvent *event)
 			if (m_resizing < 0) m_note.begin = m_note.end - min_length; // Left side
 			else m_note.end = m_note.begin + min_length; // Right side
 		}
+		if (!m_problem.isEmpty()) setProblem(QString()); // Re-check needed
 		updateLabel();
 		ngw->updateNotes(m_resizing > 0);
 
@@ -126,6 +161,7 @@ void NoteLabel::mouseMoveEvent(QMouseEvent *event)
 			nl->note().begin += ds;
 			nl->note().end += ds;
 			nl->note().note += dn;
+			if (!nl->problem().isEmpty()) nl->setProblem(QString()); // Re-check needed
 			nl->updateLabel();
 		}
 		ngw->updateNotes((event->pos() - m_hotspot).x() < 0);
@@ -140,6 +176,7 @@ void NoteLabel::mouseMoveEvent(QMouseEvent *event)
 			setCursor(QCursor(Qt::OpenHandCursor));
 		}
 	}
+	if (m_tipsDirty) updateTips();
 	QToolTip::showText(event->globalPos(), toolTip(), this);
 	event->ignore(); // Propagate event to parent
 }
@@ -173,6 +210,7 @@ void NoteLabel::updateLabel()
 
 void NoteLabel::updateTips()
 {
+	m_tipsDirty = false;
 	setToolTip(description(true));
 	setStatusTip(description(false));
 	setWhatsThis(description(true));
@@ -181,6 +219,7 @@ void NoteLabel::updateTips()
 QString NoteLabel::description(bool multiline) const
 {
 	MusicalScale ms;
+	QString problem = m_problem.isEmpty() ? "" : (multiline ? "\n" : ", ") + QString("Problem: ") + m_problem;
 	return QString("Syllable: \"%2\"%1Type: %3%1Note: %4 (%5)%1%6 s - %7 s (= %8 s)")
 		.arg(multiline ? "\n" : ", ")
 		.arg(lyric())
@@ -190,7 +229,7 @@ QString NoteLabel::description(bool multiline) const
 		.arg(QString::number(m_note.begin, 'f', 4))
 		.arg(QString::number(m_note.end, 'f', 4))
 		.arg(QString::number(m_note.length(), 'f', 4)
-		);
+		) + problem;
 }
 
 NoteLabel::operator Operation() const
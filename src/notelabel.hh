@@ -2,7 +2,6 @@
 
 #include <QLabel>
 #include <QCloseEvent>
-#include <QTimer>
 #include "notes.hh"
 #include "operation.hh"
 
@@ -12,9 +11,10 @@
  * Notes:
  * - Is rather useless without a parent NoteGraphWidget-object
  * - Widget is initially hidden and without a pixmap to allow quick creation
- * - Pixmap updates are generally delayed a little
+ * - Pixmap updates are delayed to the next frame of the parent NoteGraphWidget
  *   - The idea is to allow some time to apply the base operation to every note
- *     and then do the gfx updates asynchronously
+ *     and then do the gfx updates asynchronously, the visible notes first
+ * - Tooltips, status tips and What's This texts are only built when they are needed
  * - NoteLabel has its own mouse handling for moving, resizing, cursors, tooltips etc,
  *   but requires the parent NoteGraphWidget to update some internal states
  * - Geometry & position is calculated from the underlying Note attributes (i.e. time and pitch)
@@ -26,7 +26,6 @@ class NoteLabel: public QLabel
 	Q_OBJECT
 
 public:
-	static const int render_delay;
 	static const int resize_margin;
 	static const double default_length;
 	static const double min_length;
@@ -34,7 +33,7 @@ public:
 	NoteLabel(const Note &note, QWidget *parent, bool floating = true);
 
 	QString lyric() const { return m_note.syllable; }
-	void setLyric(const QString &text) { m_note.syllable = text; QTimer::singleShot(render_delay, this, SLOT(updatePixmap())); }
+	void setLyric(const QString &text) { m_note.syllable = text; invalidate(); }
 	QString description(bool multiline) const;
 
 	bool isSelected() const { return m_selected; }
@@ -44,12 +43,17 @@ public:
 	Note note() const { return m_note; }
 	void updateLabel();
 	void updateTips();
+	/// Mark the pixmap and the tips out of date, the pixmap is updated on the next frame
+	void invalidate();
+	bool isDirty() const { return m_dirty; }
 
 	bool isFloating() const { return m_floating; }
-	void setFloating(bool state) { m_floating = state; QTimer::singleShot(render_delay, this, SLOT(updatePixmap())); }
+	void setFloating(bool state) { m_floating = state; invalidate(); }
 	bool isLineBreak() const { return m_note.lineBreak; }
-	void setLineBreak(bool state) { m_note.lineBreak = state; QTimer::singleShot(render_delay, this, SLOT(updatePixmap())); }
-	void setType(int newtype) { m_note.type = Note::types[newtype]; QTimer::singleShot(render_delay, this, SLOT(updatePixmap())); }
+	void setLineBreak(bool state) { m_note.lineBreak = state; invalidate(); }
+	void setType(int newtype) { m_note.type = Note::types[newtype]; invalidate(); }
+	QString problem() const { return m_problem; }
+	void setProblem(QString const& problem) { m_problem = problem; invalidate(); }  ///< Shown in tooltip (empty if none)
 
 	void startResizing(int dir);
 	void startDragging(const QPoint& point);
@@ -70,6 +74,7 @@ protected:
 	void resizeEvent(QResizeEvent *event);
 	void moveEvent(QMoveEvent *event);
 	void mouseMoveEvent(QMouseEvent *event);
+	bool event(QEvent *event);
 	void closeEvent(QCloseEvent *event) { deleteLater(); event->accept(); }
 
 private:
@@ -78,6 +83,9 @@ private:
 	bool m_floating;
 	int m_resizing;
 	QPoint m_hotspot;
+	QString m_problem;  ///< Chart check result
+	bool m_dirty;  ///< The pixmap needs to be updated
+	bool m_tipsDirty;  ///< The tips need to be updated before showing
 };
 
 bool inline cmpNoteLabelPtr(const NoteLabel *lhs, const NoteLabel *rhs)
@@ -11,12 +11,13 @@
 #include "notegraphwidget.hh"
 #include "notelabel.hh"
 #include "operation.hh"
+#include "song.hh"
 
 
 /*static*/ const QString NoteLabelManager::MimeType = "application/x-notelabels";
 
 NoteLabelManager::NoteLabelManager(QWidget *parent)
-	: QLabel(parent), m_selectedAction(NONE), m_pixelsPerSecond(ppsNormal), m_duration(10.0)
+	: QLabel(parent), m_selectedAction(NONE), m_pixelsPerSecond(ppsNormal), m_track(TrackName::LEAD_VOCAL), m_duration(10.0)
 {
 	// Determine NoteLabel height
 	NoteLabel templabel(Note(" "), NULL);
@@ -34,6 +35,32 @@ void NoteLabelManager::clearNotes()
 		if (child) child->close();
 	}
 	m_notes.clear();
+	m_layers.clear();
+	m_track = TrackName::LEAD_VOCAL;
+	trackChanged();
+}
+
+void NoteLabelManager::setTrack(QString const& name)
+{
+	if (name == m_track) return;
+	selectNote(NULL);
+	// The labels of the other tracks stay around hidden, so that switching back needs no new pixmaps
+	for (int i = 0; i < m_notes.size(); ++i) m_notes[i]->hide();
+	if (!m_notes.isEmpty()) m_layers[m_track] = m_notes;
+	m_notes = m_layers.take(name);
+	for (int i = 0; i < m_notes.size(); ++i) {
+		if (m_notes[i]->pixmap()) m_notes[i]->show();
+	}
+	m_track = name;
+	trackChanged();
+}
+
+QStringList NoteLabelManager::tracks() const
+{
+	QStringList result = m_layers.keys();
+	result << m_track;
+	result.sort();
+	return result;
 }
 
 void NoteLabelManager::selectNote(NoteLabel* note, bool clearPrevious)
@@ -350,6 +377,8 @@ void NoteLabelManager::doOperation(const Operation& op, int flags)
 				; // No op
 			} else if (action == "CLEAR") {
 				clearNotes();
+			} else if (action == "TRACK") {
+				setTrack(op.s(1));
 			} else if (action == "NEW") {
 				Note newnote(op.s(2)); // lyric
 				newnote.begin = op.d(3); // begin
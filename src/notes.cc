@@ -1,6 +1,7 @@
 #include "notes.hh"
 
 #include "util.hh"
+#include "libda/fastmath.hpp"
 #include <QtGlobal>
 #include <QTextStream>
 #include <cmath>
@@ -36,7 +37,7 @@ bool MusicalScale::isSharp(int id) const {
 
 double MusicalScale::getNoteFreq(int id) const {
 	if (id == -1) return 0.0;
-	return m_baseFreq * std::pow(2.0, (id - m_baseId) / 12.0);
+	return da::fast_exp2((id - m_baseId) / 12.0f + m_baseLog2);
 }
 
 int MusicalScale::getNoteId(double freq) const {
@@ -47,12 +48,16 @@ int MusicalScale::getNoteId(double freq) const {
 
 double MusicalScale::getNote(double freq) const {
 	if (freq < 1.0) return getNaN();
-	return m_baseId + 12.0 * std::log(freq / m_baseFreq) / std::log(2.0);
+	return m_baseId + 12.0f * (da::fast_log2(freq) - m_baseLog2);
+}
+
+void MusicalScale::getNotes(float const* begin, float const* end, float* notes) const {
+	da::fast_log2(begin, end, notes, 12.0f, m_baseId - 12.0f * m_baseLog2);
 }
 
 double MusicalScale::getNoteOffset(double freq) const {
 	double frac = freq / getNoteFreq(getNoteId(freq));
-	return 12.0 * std::log(frac) / std::log(2.0);
+	return 12.0f * da::fast_log2(frac);
 }
 
 Duration::Duration(): begin(getNaN()), end(getNaN()) {}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cmath>
 #include <map>
 #include <string>
 #include <vector>
@@ -9,11 +10,12 @@
 class MusicalScale {
   private:
 	double m_baseFreq;
+	float m_baseLog2;  ///< log2(m_baseFreq)
 	static const int m_baseId = 33;
 
   public:
 	/// constructor
-	MusicalScale(double baseFreq = 440.0): m_baseFreq(baseFreq) {}
+	MusicalScale(double baseFreq = 440.0): m_baseFreq(baseFreq), m_baseLog2(std::log(baseFreq) / std::log(2.0)) {}
 	/// get name of note
 	QString getNoteStr(double freq) const;
 	/// get note number for id
@@ -26,6 +28,8 @@ class MusicalScale {
 	int getNoteId(double freq) const;
 	/// get note for frequence
 	double getNote(double freq) const;
+	/// get notes for an array of frequencies (all >= 1 Hz), in-place allowed
+	void getNotes(float const* begin, float const* end, float* notes) const;
 	/// get note offset for frequence
 	double getNoteOffset(double freq) const;
 	/// get octave number
@@ -1,17 +1,40 @@
 #include "pitch.hh"
 
+#include "libda/fastmath.hpp"
 #include "libda/fft.hpp"
 #include <cmath>
 #include <numeric>
 
-static const unsigned FFT_P = 12;  // FFT size setting, will use 2^FFT_P sample FFT
+static const unsigned FFT_P = 12;  // FFT size setting for reassignment, will use 2^FFT_P sample FFT
 static const std::size_t FFT_N = 1 << FFT_P;  // FFT size in samples
 static const std::size_t FFT_STEP = 512;  // Step size in samples, should be <= 0.25 * FFT_N. Low values cause high CPU usage.
+static const std::size_t FFT_MINPADDED = 2048;  // Smaller frames are zero padded up to this for interpolation
+// Interpolation bias of the Hamming window: delta += k * delta * (0.25 - delta^2), fitted for no padding and padding by two
+static const double FFT_INTERPBIAS[2] = { -0.330, -0.0683 };  // Reduces the max error from 0.016 to 0.001 bins (padded 0.0033 to 0.00004)
 
 // Limit the range to avoid noise and useless computation
 static const double FFT_MINFREQ = 45.0;
 static const double FFT_MAXFREQ = 3000.0;
 
+// Resonator bank of ResonatorAnalyzer (the singing range only, each resonator costs a complex multiply per sample)
+static const double RESONATOR_MINFREQ = 80.0;
+static const double RESONATOR_MAXFREQ = 1000.0;
+static const double RESONATOR_TIME = 2048 / 44100.0;  // Window length (seconds), resolves the harmonics of low voices
+static const double RESONATOR_DAMPING = 0.999999;  // Keeps the recursion stable against accumulating rounding errors
+
+// Tone tracking between moments (costs are in semitones)
+static const unsigned TRACK_MAXGAP = 2;  // How many moments a path may skip (dropouts) and still continue
+static const double TRACK_MAXCOST = 1.0;  // Links more expensive than this are never made
+static const double TRACK_MAXSLOPE = 0.5;  // Maximum pitch change per moment used for prediction (vibrato)
+static const double TRACK_LEVELCOST = 0.02;  // Cost of each dB of level change
+static const double TRACK_GAPCOST = 0.2;  // Cost of each skipped moment
+
+// Voice activity detection
+static const double VAD_SILENCE = -60.0;  // Hops quieter than this (dB) are not analyzed at all
+static const double VAD_MINHARMONICITY = 0.4;  // Share of spectral energy in the strongest tone that still counts as unvoiced
+static const double VAD_MAXHARMONICITY = 0.8;  // ... and the share that is clearly voiced
+static const double VAD_MAXFLATNESS = 0.5;  // Spectra flatter than this are noise, no matter what tones were found
+
 Tone::Tone(): freq(), level(), prev(), next() {
 	for (std::size_t i = 0; i < MAXHARM; ++i) harmonics[i] = 0.0;
 }
@@ -20,24 +43,45 @@ bool Tone::operator==(double f) const {
 	return std::abs(freq / f - 1.0) < 0.06;  // Half semitone
 }
 
-Analyzer::Analyzer(double rate, std::string id):
-  m_rate(rate),
+Analyzer::Analyzer(double rate, std::string id, Precision precision, unsigned frameSize):
+  ToneTracker(rate, FFT_STEP),
   m_id(id),
-  m_window(FFT_N),
-  m_fftLastPhase(FFT_N / 2),
+  m_precision(precision),
+  m_frameSize(frameSize),
+  m_fftBits(),
   m_oldfreq(0.0)
 {
+	if (frameSize != 1024 && frameSize != 2048 && frameSize != 4096) throw std::logic_error("Unsupported analyzer frame size");
+	if (precision == REASSIGNMENT && frameSize != FFT_N) throw std::logic_error("Reassignment needs 4096 sample frames");
+	std::size_t fftSize = precision == INTERPOLATION ? std::max<std::size_t>(frameSize, FFT_MINPADDED) : frameSize;
+	while ((1u << m_fftBits) < fftSize) ++m_fftBits;
+	m_window.resize(fftSize);
+	m_fftLastPhase.resize(fftSize / 2);
   	// Hamming window
-	for (size_t i=0; i < FFT_N; i++) {
-		m_window[i] = 0.53836 - 0.46164 * std::cos(2.0 * M_PI * i / (FFT_N - 1));
+	for (size_t i=0; i < frameSize; i++) {
+		m_window[i] = 0.53836 - 0.46164 * std::cos(2.0 * M_PI * i / (frameSize - 1));
 	}
 }
 
-unsigned Analyzer::processSize() const { return FFT_N; }
+unsigned Analyzer::processSize() const { return m_frameSize; }
 unsigned Analyzer::processStep() const { return FFT_STEP; }
 
+bool Analyzer::checkSilence(std::vector<float> const& pcm) {
+	double sum = 0.0;
+	for (std::size_t i = 0; i < pcm.size(); ++i) sum += pcm[i] * pcm[i];
+	if (sum > pcm.size() * dB2level(2.0 * VAD_SILENCE)) return false;
+	// The phases will be stale after skipping, NaN makes the reassignment drop all peaks of the next hop
+	std::fill(m_fftLastPhase.begin(), m_fftLastPhase.end(), getNaN());
+	return true;
+}
+
 void Analyzer::calcFFT(float* pcm) {
-	m_fft = da::fft<FFT_P>(pcm, m_window);
+	// The FFT size is a template parameter
+	switch (m_fftBits) {
+	case 11: m_fft = da::fft<11>(pcm, m_window); break;
+	case 12: m_fft = da::fft<12>(pcm, m_window); break;
+	default: throw std::logic_error("Unsupported FFT size");
+	}
 }
 
 namespace {
@@ -54,15 +98,66 @@ void Combo::combine(Peak const& p) {
 
 bool Combo::match(double freqOther) const { return matchFreq(freq, freqOther); }
 
+namespace {
+	/// Peaks of the bins 1 to kMax - 1 from the local maxima of a (zero padded) Hamming windowed DFT
+	/// @param fft the bins up to kMax (included)
+	/// @param padding DFT bins per bin of the unpadded frame
+	void interpolatePeaks(std::vector<std::complex<float> > const& fft, ToneTracker::Peaks& peaks, double freqPerBin, double normCoeff, std::size_t kMax, std::size_t padding) {
+		const double bias = FFT_INTERPBIAS[padding > 1];
+		// Log magnitudes (one extra bin above the range for the last peak)
+		std::vector<float> logMag(kMax + 1);
+		for (size_t k = 0; k <= kMax; ++k) logMag[k] = da::fast_log2(std::norm(fft[k]) + 1e-30f);
+		// Exact frequencies of the local maxima from the parabola through the three bins around them
+		std::vector<double> freq(kMax, getNaN());
+		for (size_t k = 1; k < kMax; ++k) {
+			float a = logMag[k - 1], b = logMag[k], c = logMag[k + 1];
+			if (!(b > a && b >= c)) continue;
+			double delta = 0.5 * (a - c) / (a - 2.0f * b + c);  // Within +/- 0.5 bins
+			delta += bias * delta * (0.25 - delta * delta);
+			freq[k] = (k + delta) * freqPerBin;
+		}
+		// Like with reassignment, every bin of a lobe points to the frequency of its maximum, found by
+		// climbing towards it (at most a bin of the unpadded frame away, further ones are not in the lobe)
+		for (size_t k = 1; k < kMax; ++k) {
+			size_t top = k;
+			for (size_t step = 0; step < padding && freq[top] != freq[top]; ++step) {
+				if (top + 1 < kMax && logMag[top + 1] > logMag[top] && logMag[top + 1] >= logMag[top - 1]) ++top;
+				else if (top > 1 && logMag[top - 1] > logMag[top]) --top;
+				else break;
+			}
+			peaks[k].freqFFT = k * freqPerBin;
+			peaks[k].freq = freq[top];
+			peaks[k].level = normCoeff * std::abs(fft[k]);
+		}
+	}
+}
+
 void Analyzer::calcTones() {
 	// Precalculated constants
-	const double freqPerBin = m_rate / FFT_N;
-	const double phaseStep = 2.0 * M_PI * FFT_STEP / FFT_N;
-	const double normCoeff = 1.0 / FFT_N;
+	const size_t fftSize = m_window.size();
+	const size_t padding = fftSize / m_frameSize;  // FFT bins per bin of the unpadded frame
+	const double freqPerBin = m_rate / fftSize;
+	// Zero padding adds no energy, so the peaks are as strong as without it (only sampled more densely)
+	const double normCoeff = 1.0 / m_frameSize;
 	// Limit frequency range of processing
 	const size_t kMin = std::max(size_t(3), size_t(FFT_MINFREQ / freqPerBin));
-	const size_t kMax = std::min(FFT_N / 2, size_t(FFT_MAXFREQ / freqPerBin));
+	const size_t kMax = std::min(fftSize / 2, size_t(FFT_MAXFREQ / freqPerBin));
 	m_peaks.resize(kMax);
+	if (m_precision == REASSIGNMENT) reassignPeaks(freqPerBin, normCoeff, kMax);
+	else interpolatePeaks(m_fft, m_peaks, freqPerBin, normCoeff, kMax, padding);
+	// Filter peaks (the bins of a lobe all point to the same frequency, which is near them)
+	const double maxShift = (m_precision == REASSIGNMENT ? 1.0 : padding + 0.5) * freqPerBin;
+	Peaks peaks;
+	for (size_t k = kMin; k < kMax; ++k) {
+		Peak const& p = m_peaks[k];
+		bool ok = p.level > 1e-3 && p.freq >= FFT_MINFREQ && p.freq <= FFT_MAXFREQ && std::abs(p.freqFFT - p.freq) < maxShift;
+		if (ok) peaks.push_back(p);
+	}
+	buildTones(Spectrum(m_peaks.begin() + kMin, m_peaks.end(), padding), peaks, padding);
+}
+
+void Analyzer::reassignPeaks(double freqPerBin, double normCoeff, std::size_t kMax) {
+	const double phaseStep = 2.0 * M_PI * FFT_STEP / FFT_N;
 	// Process FFT into peaks
 	for (size_t k = 1; k < kMax; ++k) {
 		double level = normCoeff * std::abs(m_fft[k]);
@@ -77,20 +172,44 @@ void Analyzer::calcTones() {
 		m_peaks[k].freq = (k + delta) * freqPerBin;  // Calculate the true frequency
 		m_peaks[k].level = level;
 	}
-	// Filter peaks and combine adjacent peaks pointing at the same frequency into one
+}
+
+ToneTracker::Spectrum::Spectrum(Peaks::const_iterator begin, Peaks::const_iterator end, double density): level(), flatness(1.0) {
+	if (begin == end) return;
+	// Flatness is the geometric mean of power divided by the arithmetic mean
+	double power = 0.0, logPower = 0.0;
+	for (Peaks::const_iterator it = begin; it != end; ++it) {
+		double p = it->level * it->level;
+		power += p;
+		logPower += da::fast_log2(p + 1e-20);
+	}
+	std::size_t n = end - begin;
+	level = std::sqrt(power / density);
+	if (power > 0.0) flatness = da::fast_exp2(logPower / n) / (power / n);
+}
+
+void ToneTracker::addSilence() {
+	Tones tones;
+	temporalMerge(tones);
+	m_moments.back().m_voicing = 0.0f;
+}
+
+void ToneTracker::buildTones(Spectrum const& spectrum, Peaks const& peaks, double density) {
+	if (spectrum.level < dB2level(VAD_SILENCE)) { addSilence(); return; }
+	// Combine adjacent peaks pointing at the same frequency into one
 	typedef std::vector<Combo> Combos;
 	Combos combos;
-	for (size_t k = kMin; k < kMax; ++k) {
-		Peak const& p = m_peaks[k];
-		bool ok = p.level > 1e-3 && p.freq >= FFT_MINFREQ && p.freq <= FFT_MAXFREQ && std::abs(p.freqFFT - p.freq) < freqPerBin;
-		if (!ok) continue;
+	for (Peaks::const_iterator it = peaks.begin(), itend = peaks.end(); it != itend; ++it) {
 		// Do we need to add a new Combo (rather than using the last one)?
-		if (combos.empty() || !combos.back().match(p.freq)) combos.push_back(Combo());
-		combos.back().combine(p);
+		if (combos.empty() || !combos.back().match(it->freq)) combos.push_back(Combo());
+		combos.back().combine(*it);
 	}
 	// Convert sum frequencies into averages
+	double comboLevel = 0.0;
 	for (Combos::iterator it = combos.begin(), itend = combos.end(); it != itend; ++it) {
 		it->freq /= it->level;
+		it->level /= density;  // The sum over a lobe grows with the number of bins in it
+		comboLevel += it->level;
 	}
 	// Only keep a reasonable amount of strongest combos
 	std::sort(combos.begin(), combos.end(), Combo::cmpByLevel);
@@ -136,32 +255,143 @@ void Analyzer::calcTones() {
 			if (erase) it2 = tones.erase(it2); else ++it2;
 		}
 	}
+	// Voicing: how much of the energy a single harmonic tone explains (noise and dense mixes score low)
+	double harmonicity = 0.0;
+	for (Tones::const_iterator it = tones.begin(); it != tones.end(); ++it) harmonicity = std::max(harmonicity, it->level / comboLevel);
+	double voicing = clamp((harmonicity - VAD_MINHARMONICITY) / (VAD_MAXHARMONICITY - VAD_MINHARMONICITY));
+	if (spectrum.flatness > VAD_MAXFLATNESS) voicing = 0.0;
 	temporalMerge(tones);
+	m_moments.back().m_voicing = voicing;
+}
+
+namespace {
+	/// A candidate link between the end of an earlier path and a tone of the new moment
+	struct Link {
+		double cost;
+		Tone* old;
+		Tone* tone;
+		unsigned steps;  ///< How many moments apart the two tones are (1 = adjacent)
+		Link(double cost, Tone* old, Tone* tone, unsigned steps): cost(cost), old(old), tone(tone), steps(steps) {}
+		bool operator<(Link const& other) const { return cost < other.cost; }
+	};
+
+	/// Distance from f1 to f2 in semitones
+	double semitones(double f1, double f2) { return 12.0f * da::fast_log2(f2 / f1); }
+
+	/// Extrapolate the frequency where a path is expected to continue after the given number of moments
+	double predictFreq(Tone const& t, unsigned steps) {
+		if (!t.prev) return t.freq;
+		// Limit the slope so that a single noisy step does not throw the prediction off
+		double slope = clamp(semitones(t.prev->freq, t.freq), -TRACK_MAXSLOPE, TRACK_MAXSLOPE);
+		return t.freq * da::fast_exp2(slope * steps / 12.0);
+	}
+
+	/// The cost of continuing the path ending at old with tone (lower is better)
+	double linkCost(Tone const& old, Tone const& tone, unsigned steps) {
+		double pitch = std::abs(semitones(predictFreq(old, steps), tone.freq));
+		double level = std::abs(level2dB(tone.level / old.level));
+		return pitch + TRACK_LEVELCOST * level + TRACK_GAPCOST * (steps - 1);
+	}
+
+	/// Insert a tone into a frequency sorted list, returning a pointer to the stored tone
+	Tone* insertSorted(Moment::Tones& tones, Tone const& tone) {
+		Moment::Tones::iterator it = tones.begin();
+		while (it != tones.end() && it->freq < tone.freq) ++it;
+		return &*tones.insert(it, tone);
+	}
 }
 
-void Analyzer::temporalMerge(Tones& tones) {
-	if (!m_moments.empty()) {
-		Tones& old = m_moments.back().m_tones;
-		Tones::iterator it = tones.begin();
-		// Iterate over old tones
-		for (Tones::iterator oldit = old.begin(); oldit != old.end(); ++oldit) {
-			// Try to find a matching new tone
-			while (it != tones.end() && *it < *oldit) ++it;
-			// If match found
-			if (it != tones.end() && *it == *oldit) {
-				// Link together the old and the new tones
-				oldit->next = &*it;
-				it->prev = &*oldit;
+void ToneTracker::temporalMerge(Tones& tones) {
+	// Collect the path ends of the last few moments and score every plausible continuation
+	typedef std::vector<Link> Links;
+	Links links;
+	std::vector<Moment*> history;  // Moments in reverse order (history[0] is the previous moment)
+	for (Moments::reverse_iterator mit = m_moments.rbegin(); mit != m_moments.rend() && history.size() <= TRACK_MAXGAP; ++mit) {
+		history.push_back(&*mit);
+		unsigned steps = history.size();
+		for (Tones::iterator oldit = mit->m_tones.begin(); oldit != mit->m_tones.end(); ++oldit) {
+			if (oldit->next) continue;  // Not the end of a path
+			for (Tones::iterator it = tones.begin(); it != tones.end(); ++it) {
+				double cost = linkCost(*oldit, *it, steps);
+				if (cost < TRACK_MAXCOST) links.push_back(Link(cost, &*oldit, &*it, steps));
 			}
 		}
 	}
-	m_moments.push_back(Moment(m_moments.size() * processStep() / m_rate));
+	// Greedy assignment, cheapest links first
+	std::sort(links.begin(), links.end());
+	for (Links::const_iterator it = links.begin(); it != links.end(); ++it) {
+		Tone* old = it->old;
+		Tone* tone = it->tone;
+		if (old->next || tone->prev) continue;  // One end already taken by a cheaper link
+		// Bridge the gap with interpolated tones so that paths still advance one moment at a time
+		for (unsigned s = 1; s < it->steps; ++s) {
+			double w = double(s) / it->steps;
+			Tone fill;
+			fill.freq = old->freq * std::pow(tone->freq / old->freq, w);
+			fill.level = old->level + w * (tone->level - old->level);
+			for (std::size_t h = 0; h < Tone::MAXHARM; ++h) fill.harmonics[h] = old->harmonics[h] + w * (tone->harmonics[h] - old->harmonics[h]);
+			Tone* filled = insertSorted(history[it->steps - s - 1]->m_tones, fill);
+			old->next = filled;
+			filled->prev = old;
+			old = filled;
+		}
+		// Link together the old and the new tones
+		old->next = tone;
+		tone->prev = old;
+	}
+	m_moments.push_back(Moment(m_moments.size() * m_step / m_rate));
 	m_moments.back().stealTones(tones);  // No pointers are invalidated
 }
 
-Moment::Moment(double t): m_time(t) {}
+Moment::Moment(double t): m_time(t), m_voicing() {}
 
 void Moment::stealTones(Tones& tones) {
 	m_tones.swap(tones);
 }
 
+
+
+// Resonator bank analysis
+
+ResonatorAnalyzer::ResonatorAnalyzer(double rate, unsigned block):
+  ToneTracker(rate, block),
+  m_block(block),
+  m_blockPos(),
+  m_length(round(RESONATOR_TIME * rate)),
+  m_kMin(std::max(2.0, std::floor(RESONATOR_MINFREQ * m_length / rate))),
+  m_kMax(std::ceil(RESONATOR_MAXFREQ * m_length / rate)),
+  m_rotate(m_kMax + 3),
+  m_remove(std::pow(RESONATOR_DAMPING, double(m_length))),
+  m_sums(m_kMax + 3),
+  m_history(nextPow2(m_length + 1)),
+  m_pos(),
+  m_peaks(m_kMax + 1)
+{
+	if (block == 0) throw std::logic_error("ResonatorAnalyzer block size must be positive");
+	// The neighbours of the range are needed for windowing, and one more above it for finding the last peak
+	for (std::size_t k = m_kMin - 1; k <= m_kMax + 2; ++k) m_rotate[k] = std::polar(RESONATOR_DAMPING, 2.0 * M_PI * k / m_length);
+}
+
+void ResonatorAnalyzer::input(float sample) {
+	const unsigned mask = m_history.size() - 1;
+	float old = m_history[(m_pos - m_length) & mask];
+	m_history[m_pos] = sample;
+	m_pos = (m_pos + 1) & mask;
+	double diff = sample - m_remove * old;
+	for (std::size_t k = m_kMin - 1; k <= m_kMax + 2; ++k) m_sums[k] = m_rotate[k] * m_sums[k] + diff;
+}
+
+void ResonatorAnalyzer::calcTones() {
+	const double freqPerBin = m_rate / m_length;
+	// Hamming window (the same that Analyzer uses) applied in frequency domain, zero outside of the range
+	Analyzer::Fourier fft(m_kMax + 2);
+	for (std::size_t k = m_kMin; k <= m_kMax + 1; ++k) fft[k] = 0.53836 * m_sums[k] - 0.23082 * (m_sums[k - 1] + m_sums[k + 1]);
+	interpolatePeaks(fft, m_peaks, freqPerBin, 1.0 / m_length, m_kMax + 1, 1);
+	Peaks peaks;
+	for (std::size_t k = m_kMin; k <= m_kMax; ++k) {
+		Peak const& p = m_peaks[k];
+		bool ok = p.level > 1e-3 && p.freq >= RESONATOR_MINFREQ && p.freq <= RESONATOR_MAXFREQ && std::abs(p.freqFFT - p.freq) < 1.5 * freqPerBin;
+		if (ok) peaks.push_back(p);
+	}
+	buildTones(Spectrum(m_peaks.begin() + m_kMin, m_peaks.end()), peaks);
+}
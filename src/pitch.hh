@@ -35,8 +35,10 @@ struct Moment {
 	typedef std::list<Tone> Tones;
 	Tones m_tones;
 	double m_time;
+	float m_voicing;  ///< Voice activity estimate (0 = silence or noise, 1 = clearly pitched sound)
 	Moment(double t);
 	double time() const { return m_time; }
+	bool voiced() const { return m_voicing >= 0.5f; }
 	void stealTones(Tones& tones);
 };
 
@@ -60,46 +62,123 @@ struct Combo {
 };
 
 
-/// analyzer class
- /** class to analyze input audio and transform it into useable data
+/// Tone building and tracking stage of the analyzer
+ /** Combines the peaks of each analysis step into tones and links them into continuous paths
  */
-class Analyzer {
+class ToneTracker {
 public:
-	typedef std::vector<std::complex<float> > Fourier;  ///< FFT vector (the first level of detection)
 	typedef std::vector<Peak> Peaks;  ///< Peaks (the second level of detection)
 	typedef std::list<Tone> Tones; ///< Tones (the final level of detection)
 	typedef std::list<Moment> Moments; ///< Time-serie history of time and tones
+	/** Get a list of all tones detected. **/
+	Moments const& getMoments() const { return m_moments; }
+	double getTime() const { return m_moments.empty() ? 0.0 : m_moments.back().time(); }
+protected:
+	/// @param step the number of samples between moments
+	ToneTracker(double rate, unsigned step): m_rate(rate), m_step(step) {}
+	/// Voice activity features of the whole analyzed spectrum
+	struct Spectrum {
+		double level;  ///< Total level (linear)
+		double flatness;  ///< Spectral flatness (0 = a single sinusoid, 1 = white noise)
+		/// @param density peaks per bin of the unpadded frame (the zero padding factor)
+		Spectrum(Peaks::const_iterator begin, Peaks::const_iterator end, double density = 1.0);
+	};
+	/// Add a new moment with tones built from peaks (sorted by frequency, unusable peaks already dropped)
+	/// @param density peaks per bin of the unpadded frame, so that tone levels do not depend on the padding
+	void buildTones(Spectrum const& spectrum, Peaks const& peaks, double density = 1.0);
+	/// Add a new moment without any tones (tone building skipped because of silence)
+	void addSilence();
+	double m_rate;
+private:
+	void temporalMerge(Tones& tones);
+	unsigned m_step;
+	Moments m_moments;
+};
+
+/// analyzer class
+ /** class to analyze input audio and transform it into useable data
+ */
+class Analyzer: public ToneTracker {
+public:
+	typedef std::vector<std::complex<float> > Fourier;  ///< FFT vector (the first level of detection)
+	/// How the frequencies of the peaks are refined beyond the FFT bins
+	enum Precision {
+		/// Phase advance of each bin between hops, needs a large frame that the hops overlap a lot
+		REASSIGNMENT,
+		/// Parabola fitted on the log magnitudes around each peak (exact for a Gaussian window and
+		/// close for Hamming), within a single frame so that smaller frames can be used
+		INTERPOLATION
+	};
 	/// constructor
-	Analyzer(double rate, std::string id);
+	/// @param frameSize 1024, 2048 or 4096 samples (REASSIGNMENT needs 4096, 1024 is zero padded and too short for low voices)
+	Analyzer(double rate, std::string id, Precision precision = REASSIGNMENT, unsigned frameSize = 4096);
 	/** Get the fourier transform. **/
 	Fourier const& getFourier() const { return m_fft; }
 	/** Get the peak frequencies. **/
 	Peaks const& getPeaks() const { return m_peaks; }
-	/** Get a list of all tones detected. **/
-	Moments const& getMoments() const { return m_moments; }
 	/** Find a tone within the singing range; prefers strong tones around 200-400 Hz. **/
 	//Tone const* findTone(double minfreq = 70.0, double maxfreq = 700.0) const;
 	std::string const& getId() const { return m_id; }
 	/// Process processSize() samples from RndIt input
 	template<typename RndIt> void process(RndIt input) {
 		std::vector<float> pcm(input, input + processSize());  // Needs local modifyable copy for calculations
+		if (checkSilence(pcm)) { addSilence(); return; }  // No need for FFT or tones
+		pcm.resize(m_window.size());  // Zero padding up to the FFT size
 		calcFFT(&pcm[0]);
 		calcTones();
 	}
 	unsigned processSize() const;  ///< The number of samples required by process()
 	unsigned processStep() const;  ///< The number of samples to increment the input position after each call to process()
-	double getTime() const { return m_moments.empty() ? 0.0 : m_moments.back().time(); }
 private:
-	double m_rate;
 	std::string m_id;
-	std::vector<float> m_window;
+	Precision m_precision;
+	unsigned m_frameSize;
+	unsigned m_fftBits;  ///< The FFT size is 2^m_fftBits (larger than the frame when zero padded)
+	std::vector<float> m_window;  ///< Zero after the frame
 	Fourier m_fft;
 	std::vector<float> m_fftLastPhase;
 	Peaks m_peaks;
-	Moments m_moments;
 	mutable double m_oldfreq;
+	bool checkSilence(std::vector<float> const& pcm);
 	void calcFFT(float* pcm);
 	void calcTones();
-	void temporalMerge(Tones& tones);
+	void reassignPeaks(double freqPerBin, double normCoeff, std::size_t kMax);
 };
 
+/// Low latency analyzer for the singing range
+ /** A bank of complex resonators at the DFT bin frequencies of a 46 ms window (2048 samples at
+  * 44.1 kHz) from 80 Hz to 1 kHz, updated on every input sample and read after every block of
+  * samples, which is a sliding DFT of only the bins needed for voices. Peaks are found like with
+  * Analyzer::INTERPOLATION (which needs a full FFT for every hop) and go to the same tone building
+  * and tracking, so that tones are reported every block instead of every 512 samples.
+ */
+class ResonatorAnalyzer: public ToneTracker {
+public:
+	/// @param block the number of samples between moments (32-64 is a good choice for live monitoring)
+	ResonatorAnalyzer(double rate, unsigned block = 64);
+	/** Get the peak frequencies (one per resonator, zero below the range). **/
+	Peaks const& getPeaks() const { return m_peaks; }
+	/// Process any number of samples, producing a new moment after every processStep() samples
+	template<typename InIt> void process(InIt begin, InIt end) {
+		for (; begin != end; ++begin) {
+			input(*begin);
+			if (++m_blockPos == m_block) { m_blockPos = 0; calcTones(); }
+		}
+	}
+	unsigned processStep() const { return m_block; }  ///< The number of samples between moments
+	/// Seconds from the start of a tone until the resonators have it in full (the window and a block)
+	double latency() const { return double(m_length + m_block) / m_rate; }
+private:
+	void input(float sample);
+	void calcTones();
+	unsigned m_block;
+	unsigned m_blockPos;
+	unsigned m_length;  ///< Window length in samples
+	std::size_t m_kMin, m_kMax;  ///< The bins of the range
+	std::vector<std::complex<double> > m_rotate;  ///< Per sample rotation (with damping) of each bin
+	double m_remove;  ///< Damping of the sample leaving the window (the rotation is a whole number of cycles)
+	std::vector<std::complex<double> > m_sums;  ///< Current DFT values (not windowed, one more bin beyond both ends)
+	std::vector<float> m_history;  ///< Ring buffer of past input, size is a power of two
+	unsigned m_pos;
+	Peaks m_peaks;
+};
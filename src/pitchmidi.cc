@@ -0,0 +1,146 @@
+#include "pitchmidi.hh"
+#include "midifile.hh"
+#include <QFile>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+using midifile::Event;
+
+namespace {
+	static const unsigned division = 480;  ///< Timecode units per beat
+	static const int bendRange = 12;  ///< Semitones up and down
+	static const int noteOffset = 36;  ///< From the note numbers of the analysis to MIDI (as in FoF MIDI files)
+	static const unsigned maxChannels = 15;  ///< All but channel 10 (percussion)
+
+	bool beginsBefore(PitchPath const* a, PitchPath const* b) { return a->beginTime() < b->beginTime(); }
+
+	unsigned velocity(float level) { return clamp<int>(round(127.0f + 2.0f * level), 1, 127); }
+
+	/// Writes the events of a track at absolute times
+	class TrackWriter {
+	public:
+		TrackWriter(midifile::Writer& writer, unsigned channel, double ticksPerSecond):
+		  m_writer(writer), m_channel(channel), m_ticksPerSecond(ticksPerSecond), m_tick() {}
+		void message(double time, Event::Type type, unsigned arg1, unsigned arg2) {
+			Event ev;
+			ev.timecode = advance(time);
+			ev.type = type;
+			ev.channel = m_channel;
+			ev.arg1 = arg1;
+			ev.arg2 = arg2;
+			m_writer.writeEvent(ev);
+		}
+		/// Pitch bend relative to the playing note
+		void bend(double time, float semitones) {
+			int value = clamp<int>(8192 + round(semitones / bendRange * 8192.0f), 0, 16383);
+			message(time, Event::PITCH_BEND, value & 0x7F, value >> 7);
+		}
+		void meta(double time, Event::Meta meta, std::string const& data) {
+			Event ev;
+			ev.timecode = advance(time);
+			ev.type = Event::SPECIAL;
+			ev.channel = 0x0F;
+			ev.arg1 = meta;
+			ev.begin = reinterpret_cast<midifile::const_iterator>(data.data());
+			ev.end = ev.begin + data.size();
+			m_writer.writeEvent(ev);
+		}
+	private:
+		/// Time from the previous event in timecode units (never backwards)
+		unsigned advance(double time) {
+			unsigned tick = std::max<double>(m_tick, round(time * m_ticksPerSecond));
+			unsigned delta = tick - m_tick;
+			m_tick = tick;
+			return delta;
+		}
+		midifile::Writer& m_writer;
+		unsigned m_channel;
+		double m_ticksPerSecond;
+		unsigned m_tick;
+	};
+}
+
+unsigned PitchMIDIExport::write(PitchAnalysis const& analysis, QString const& fileName) const
+{
+	// The paths in time order, each on the first channel that is free by the time it begins
+	std::vector<PitchPath const*> paths;
+	for (PitchAnalysis::Paths::const_iterator it = analysis.paths.begin(); it != analysis.paths.end(); ++it) {
+		if (it->size() > 1 && it->endTime() - it->beginTime() >= minLength) paths.push_back(&*it);
+	}
+	std::stable_sort(paths.begin(), paths.end(), beginsBefore);
+	std::vector<std::vector<PitchPath const*> > channels;
+	std::vector<float> channelEnd;
+	for (std::size_t i = 0; i < paths.size(); ++i) {
+		std::size_t ch = 0;
+		while (ch < channels.size() && channelEnd[ch] > paths[i]->beginTime()) ++ch;
+		if (ch == maxChannels) continue;  // Too many voices at once, this one is left out
+		if (ch == channels.size()) {
+			channels.push_back(std::vector<PitchPath const*>());
+			channelEnd.push_back(0.0f);
+		}
+		channels[ch].push_back(paths[i]);
+		channelEnd[ch] = paths[i]->time(paths[i]->size());
+	}
+	if (channels.empty()) throw std::runtime_error("No pitch to export");
+
+	QByteArray name = QFile::encodeName(fileName);
+	midifile::Writer writer(name.constData(), 1, 1 + channels.size(), division);
+	// Timing track
+	writer.startTrack();
+	{
+		TrackWriter timing(writer, 0, 0.0);
+		unsigned usPerBeat = 6e7 / tempo;
+		char data[3] = { char(usPerBeat >> 16), char(usPerBeat >> 8), char(usPerBeat) };
+		timing.meta(0.0, Event::META_TEMPO, std::string(data, 3));
+		timing.meta(0.0, Event::META_ENDOFTRACK, std::string());
+	}
+	double ticksPerSecond = tempo / 60.0 * division;
+	double minInterval = 1.0 / maxBendRate;
+	unsigned notes = 0;
+	for (std::size_t ch = 0; ch < channels.size(); ++ch) {
+		// The buffer fits a bend (three bytes or less with running status) per point
+		unsigned points = 0;
+		for (std::size_t i = 0; i < channels[ch].size(); ++i) points += channels[ch][i]->size();
+		writer.startTrack(64 + 3 * points);
+		TrackWriter out(writer, ch < 9 ? ch : ch + 1, ticksPerSecond);
+		out.meta(0.0, Event::META_SEQNAME, QString("Pitch %1").arg(ch + 1).toStdString());
+		// Bend range with RPN 0 (pitch bend sensitivity), then the null RPN so that no data entry changes it
+		out.message(0.0, Event::CONTROLLER, 101, 0);
+		out.message(0.0, Event::CONTROLLER, 100, 0);
+		out.message(0.0, Event::CONTROLLER, 6, bendRange);
+		out.message(0.0, Event::CONTROLLER, 38, 0);
+		out.message(0.0, Event::CONTROLLER, 101, 127);
+		out.message(0.0, Event::CONTROLLER, 100, 127);
+		for (std::size_t p = 0; p < channels[ch].size(); ++p) {
+			PitchPath const& path = *channels[ch][p];
+			for (unsigned i = 0; i < path.size(); ) {
+				// A note on the nearest key, bent to the exact pitch for as long as it stays within the range
+				PitchFragment const first = path[i];
+				int base = round(first.note);
+				unsigned key = clamp(base + noteOffset, 0, 127);
+				out.bend(first.time, first.note - base);
+				out.message(first.time, Event::NOTE_ON, key, velocity(first.level));
+				float bent = first.note;
+				double bentTime = first.time;
+				unsigned j = i + 1;
+				for (; j < path.size(); ++j) {
+					PitchFragment const fragment = path[j];
+					if (std::abs(fragment.note - base) > bendRange) break;  // Continues as a new note
+					if (std::abs(fragment.note - bent) < tolerance || fragment.time - bentTime < minInterval) continue;
+					out.bend(fragment.time, fragment.note - base);
+					bent = fragment.note;
+					bentTime = fragment.time;
+				}
+				out.message(path.time(j), Event::NOTE_ON, key, 0);  // Note off
+				++notes;
+				i = j;
+			}
+		}
+		out.meta(0.0, Event::META_ENDOFTRACK, std::string());
+	}
+	writer.close();
+	return notes;
+}
+
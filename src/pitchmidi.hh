@@ -0,0 +1,23 @@
+#pragma once
+
+#include "analysis.hh"
+#include <QString>
+
+/// MIDI export of the analysed pitch, so that the real melody can be played along with in any sequencer
+/** Each pitch path becomes a note with 14-bit pitch bends following its exact pitch (the bend
+  * range is set to an octave with RPN 0). A bend is only written once the pitch has moved by
+  * the tolerance and not more often than maxBendRate, which keeps dense curves compact.
+  * Paths that leave the bend range continue as new notes and overlapping paths are given
+  * different MIDI channels, each on a track of its own.
+ */
+struct PitchMIDIExport {
+	double tempo;  ///< Beats per minute (only affects the bars and beats shown by sequencers)
+	double minLength;  ///< Shorter paths are left out (seconds)
+	float tolerance;  ///< Pitch change that needs a new bend (semitones)
+	double maxBendRate;  ///< Bends per second and channel at most
+	PitchMIDIExport(): tempo(120.0), minLength(0.05), tolerance(0.03f), maxBendRate(50.0) {}
+	/// Write the paths of the analysis into a MIDI file, throws std::runtime_error on failure
+	/// @return the number of notes written
+	unsigned write(PitchAnalysis const& analysis, QString const& fileName) const;
+};
+
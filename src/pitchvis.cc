@@ -1,9 +1,9 @@
 
+#include "analysisworker.hh"
 #include "notegraphwidget.hh"
 #include "pitchvis.hh"
-#include "pitch.hh"
-#include "ffmpeg.hh"
-#include <fstream>
+#include "renderstats.hh"
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 #include <QPainter>
@@ -11,8 +11,9 @@
 #include <QLabel>
 #include <QSettings>
 
+
 PitchVis::PitchVis(QString const& filename, QWidget *parent, int visId)
-	: QThread(parent), mutex(), fileName(filename), duration(), moreAvailable(), quit(),
+	: QThread(parent), mutex(), fileName(filename), position(), duration(), moreAvailable(), quit(),
 	  cancelled(), restart(), m_x1(), m_y1(), m_x2(), m_y2(), m_visId(visId), condition()
 {
 	start(); // Launch the thread
@@ -31,77 +32,30 @@ void PitchVis::cancel()
 	cancelled = true;
 }
 
+bool PitchVis::update(double pos, double dur)
+{
+	QMutexLocker locker(&mutex);
+	if (quit || cancelled) return false;
+	position = pos;
+	duration = dur;
+	return true;
+}
+
 void PitchVis::run()
 {
 	bool analyzingSuccess = false;
 	try {
-		// Initialize FFmpeg decoding
-		std::string file(fileName.toLocal8Bit().data(), fileName.toLocal8Bit().size());
-		FFmpeg mpeg(file);
-		{
-			QMutexLocker locker(&mutex);
-			paths.clear();
-			position = 0.0;
-			duration = mpeg.duration(); // Estimation
-		}
-		unsigned rate = mpeg.audioQueue.getRate();
-		unsigned channels = mpeg.audioQueue.getChannels();
-		if (channels == 0) throw std::runtime_error("No audio channels found");
-		std::vector<Analyzer> analyzers(channels, Analyzer(rate, ""));
-		// Process the entire song
-		std::vector<float> data;
-		data.reserve((duration + 1.0) * rate * channels);
-		unsigned x = 0;
-		while (mpeg.audioQueue.output(data)) {
-			// Process as much as can be processed at this point
-			while (data.size() / channels - x >= analyzers[0].processSize()) {
-				// Pitch detection
-				for (unsigned ch = 0; ch < channels; ++ch) {
-					analyzers[ch].process(da::step_iterator<float>(&data[x * channels + ch], channels));
-				}
-				x += analyzers[0].processStep();
-				// Update progress and check for quit flag
-				QMutexLocker locker(&mutex);
-				if (quit) return;
-				else if (cancelled) break;
-				double t = analyzers[0].getTime();
-				position = t;
-				duration = std::max(duration, t + 0.01);
-			}
-		}
-		// DEBUG: std::ofstream("audio.raw", std::ios::binary).write(reinterpret_cast<char*>(&data[0]), data.size() * sizeof(float));
-		// Filter the analyzer output data into QPainterPaths.
-		std::vector<Analyzer::Moments::const_iterator> mit(channels), mend(channels);
-		for (unsigned ch = 0; ch < channels; ++ch) {
-			Analyzer::Moments const& moments = analyzers[ch].getMoments();
-			mit[ch] = moments.begin();
-			mend[ch] = moments.end();
-		}
-		while (mit[0] != mend[0]) {
-			for (unsigned ch = 0; ch < channels; ++mit[ch++]) {
-				Moment::Tones const& tones = mit[ch]->m_tones;  // Take tones then move forward the iterator
-				for (Moment::Tones::const_iterator it2 = tones.begin(), it2end = tones.end(); it2 != it2end; ++it2) {
-					if (it2->prev) continue;  // The tone doesn't begin at this moment, skip
-					// Copy the linked list into vector for easier access and calculate max level
-					std::vector<Tone const*> tones;
-					for (Tone const* n = &*it2; n; n = n->next) { tones.push_back(n); }
-					if (tones.size() < 3) continue;  // Too short tone, ignored
-					PitchPath path(ch);
-					double score = 0.0;
-					Analyzer::Moments::const_iterator momit = mit[ch];
-					// Store path used for rendering
-					for (unsigned i = 0; i < tones.size(); ++i, ++momit) {
-						float t = momit->m_time;
-						float n = scale.getNote(tones[i]->freq);
-						float level = level2dB(tones[i]->level);
-						score += tones[i]->level;
-						path.fragments.push_back(PitchFragment(t, n, level));
-					}
-					QMutexLocker locker(&mutex);
-					if (score > 1.0) paths.push_back(path);
-				}
-			}
+		PitchAnalysis result;
+		// Use the earlier analysis if available, otherwise analyze (in a worker process, so that
+		// broken files cannot crash the editor) and store for the next time
+		if (!result.load(fileName)) {
+			AnalysisWorker worker;
+			if (worker.analyze(fileName, result, *this)) result.save(fileName);
 		}
+		QMutexLocker locker(&mutex);
+		if (quit) return;
+		analysis.swap(result);
+		duration = analysis.duration;
 		analyzingSuccess = true;
 
 	} catch (std::exception& e) {
@@ -110,6 +64,7 @@ void PitchVis::run()
 	{
 		QMutexLocker locker(&mutex);
 		moreAvailable = true;
+		if (!(duration > 0.0)) duration = 0.01;  // Failed before getting any duration, still report completion
 		position = duration;
 	}
 
@@ -158,27 +113,29 @@ void PitchVis::renderer() {
 
 			PitchVis::Paths const& paths = getPaths();
 			for (PitchVis::Paths::const_iterator it = paths.begin(), itend = paths.end(); it != itend; ++it) {
-				PitchPath::Fragments const& fragments = it->fragments;
+				PitchPath const& path = *it;
 				int oldx, oldy;
 				// Only render paths in view
-				if (widget->s2px(fragments.back().time) < x1) continue;
-				else if (widget->s2px(fragments.front().time) > x2) break;
+				if (widget->s2px(path.endTime()) < x1) continue;
+				else if (widget->s2px(path.beginTime()) > x2) break;
 				// Iterate through the path points
-				for (PitchPath::Fragments::const_iterator it2 = fragments.begin(), it2end = fragments.end(); it2 != it2end; ++it2) {
+				for (unsigned i = 0; i < path.size(); ++i) {
+					PitchFragment const fragment = path[i];
 					// TODO: Take y-size into account (change also the paint calls in NoteGraphWidget)
-					int x = widget->s2px(it2->time) - x1;
-					int y = widget->n2px(it2->note);
+					int x = widget->s2px(fragment.time) - x1;
+					int y = widget->n2px(fragment.note);
 					if (m_visId == 0)
-						pen.setColor(QColor(32 + 64 * it->channel, clamp<int>(127 + it2->level, 32, 255), 32, 128));
+						pen.setColor(QColor(32 + 64 * path.channel, clamp<int>(127 + fragment.level, 32, 255), 32, 128));
 					else
-						pen.setColor(QColor(clamp<int>(127 + it2->level, 32, 255), 32, 32 + 32 * it->channel, 100));
+						pen.setColor(QColor(clamp<int>(127 + fragment.level, 32, 255), 32, 32 + 32 * path.channel, 100));
 					painter.setPen(pen);
-					if (it2 != fragments.begin()) painter.drawLine(oldx, oldy, x, y);
+					if (i > 0) painter.drawLine(oldx, oldy, x, y);
 					oldx = x; oldy = y;
 				}
 			}
 		}
 
+		RENDER_STATS_IMAGE(image.width(), image.height());
 		// Send the image
 		// This is actually delivered by the reciever's event loop thread, and not called directly from here
 		emit renderedImage(image, QPoint(x1, y1), m_visId);
@@ -196,20 +153,42 @@ int PitchVis::guessNote(double begin, double end, int note) {
 	double score[scoreSz] = {};
 	if (note >= 0 || note < 48) score[note] = 10.0;  // Slightly prefer the current note
 	// Score against paths
-	for (PitchVis::Paths::const_iterator it = paths.begin(), itend = paths.end(); it != itend; ++it) {
-		PitchPath::Fragments const& fragments = it->fragments;
+	for (PitchVis::Paths::const_iterator it = analysis.paths.begin(), itend = analysis.paths.end(); it != itend; ++it) {
+		PitchPath const& path = *it;
 		// Discard paths completely outside the window
-		if (fragments.back().time < begin) continue;
-		if (fragments.front().time > end) break;
-		for (PitchPath::Fragments::const_iterator it2 = fragments.begin(), it2end = fragments.end(); it2 != it2end; ++it2) {
+		if (path.endTime() < begin) continue;
+		if (path.beginTime() > end) break;
+		for (unsigned i = 0; i < path.size(); ++i) {
+			PitchFragment const fragment = path[i];
 			// Discard path points outside the window
-			if (it2->time < begin) continue;
-			if (it2->time > end) break;
-			unsigned n = round(it2->note);
-			if (n < scoreSz) score[n] += 100 + it2->level;
+			if (fragment.time < begin) continue;
+			if (fragment.time > end) break;
+			if (!isVoiced(fragment.time)) continue;  // Instrumental or noise, not singing
+			unsigned n = round(fragment.note);
+			if (n < scoreSz) score[n] += 100 + fragment.level;
 		}
 	}
 	// Return the idx with best score
 	return std::max_element(score + 1, score + scoreSz) - score;
 }
 
+bool PitchVis::isVoiced(double time) const {
+	std::vector<float> const& voicing = analysis.voicing;
+	if (voicing.empty()) return true;  // No information available
+	int idx = round(time / analysis.hopTime);
+	if (idx < 0 || idx >= int(voicing.size())) return true;
+	return voicing[idx] >= 0.5f;
+}
+
+double PitchVis::longestUnvoiced(double begin, double end) const {
+	std::vector<float> const& voicing = analysis.voicing;
+	if (voicing.empty()) return 0.0;
+	int first = std::max(0, int(std::ceil(begin / analysis.hopTime)));
+	int last = std::min(int(voicing.size()) - 1, int(std::floor(end / analysis.hopTime)));
+	int longest = 0, run = 0;
+	for (int i = first; i <= last; ++i) {
+		run = (voicing[i] < 0.5f ? run + 1 : 0);
+		longest = std::max(longest, run);
+	}
+	return longest * analysis.hopTime;
+}
@@ -1,6 +1,8 @@
 #pragma once
 
+#include "analysis.hh"
 #include "notes.hh"
+#include "types.hh"
 #include "util.hh"
 #include <QWidget>
 #include <QThread>
@@ -8,28 +10,17 @@
 #include <QWaitCondition>
 #include <QPainterPath>
 #include <cmath>
+#include <iosfwd>
 #include <string>
 #include <vector>
 
-struct PitchFragment {
-	float time, note, level;  // seconds, MIDI note, dB
-	PitchFragment(float time, float note, float level): time(time), note(note), level(level) {}
-};
-
-struct PitchPath {
-	typedef std::vector<PitchFragment> Fragments;
-	Fragments fragments;
-	unsigned channel;
-	PitchPath(unsigned channel): channel(channel) {}
-};
-
 class NoteGraphWidget;
 
-class PitchVis: public QThread
+class PitchVis: public QThread, private PitchAnalysis::Progress
 {
 	Q_OBJECT
 public:
-	typedef std::vector<PitchPath> Paths;
+	typedef PitchAnalysis::Paths Paths;
 	QMutex mutex;
 
 	PitchVis(QString const& filename, QWidget *parent = NULL, int visId = 0);
@@ -39,9 +30,12 @@ public:
 	void cancel();
 	void paint(int x1, int y1, int x2, int y2);
 	bool newDataAvailable() const { return moreAvailable; }
-	double getProgress() const { return position / duration; }
+	double getProgress() const { return duration > 0.0 ? position / duration : 0.0; }
 	double getDuration() const { return duration; }
+	PitchAnalysis const& getAnalysis() const { return analysis; }  ///< Empty until analyzing is finished
 	int guessNote(double begin, double end, int initial);
+	bool isVoiced(double time) const;
+	double longestUnvoiced(double begin, double end) const;  ///< Length (seconds) of the longest unvoiced stretch in the given range
 
 signals:
 	void renderedImage(const QImage &image, const QPoint &position, int visId);
@@ -51,11 +45,11 @@ protected:
 
 private:
 	void renderer();
-	Paths const& getPaths() { moreAvailable = false; return paths; }
+	bool update(double position, double duration);
+	Paths const& getPaths() { moreAvailable = false; return analysis.paths; }
 
-	MusicalScale scale;
 	QString fileName;
-	Paths paths;
+	PitchAnalysis analysis;
 	double position;  ///< Position while analyzing
 	double duration;  ///< Song duration (or estimation while analyzing)
 	bool moreAvailable;
@@ -0,0 +1,455 @@
+#include "playback.hh"
+#include "audiodevice.hh"
+#include "util.hh"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+	static const unsigned defaultRate = 44100;  ///< Output sample rate until music is loaded
+	static const unsigned bytesPerFrame = AudioDevice::bytesPerFrame;  ///< 16-bit stereo
+	static const double readAhead = 2.0;  ///< Seconds of music decoded ahead of the output
+	static const double outputLatency = 0.05;  ///< Seconds buffered by the audio device (delay of the voices)
+	static const double spanHistory = 10.0;  ///< Seconds of output remembered for finding the music being heard
+	static const int notifyInterval = 50;  ///< Milliseconds between position updates
+
+	/// Probes an audio device in a thread of its own
+	class ProbeThread: public QThread {
+	public:
+		ProbeThread(AudioDevice& device): m_device(device) {}
+	protected:
+		void run() { m_device.probe(); }
+	private:
+		AudioDevice& m_device;
+	};
+}
+
+
+// MusicBuffer
+
+MusicBuffer::MusicBuffer(Timeline::Segments const& segments, double seconds):
+  m_timeline(new Timeline(segments)), m_rate(m_timeline->getRate()), m_channels(m_timeline->getChannels()),
+  m_begin(), m_size(), m_frame(), m_seekTarget(getNaN()), m_generation(), m_eof(), m_quit()
+{
+	if (m_rate == 0 || m_channels == 0) throw std::runtime_error("No audio channels found");
+	m_ring.resize(std::max(1.0, seconds * m_rate) * m_channels);
+	start();
+}
+
+MusicBuffer::~MusicBuffer()
+{
+	{
+		QMutexLocker locker(&m_mutex);
+		m_quit = true;
+		m_needSpace.wakeOne();
+	}
+	m_timeline->abort();  // In case the thread is waiting for the decoder
+	wait();
+}
+
+double MusicBuffer::duration() const { return m_timeline->duration(); }
+
+QString MusicBuffer::metadata(QString const& key) const
+{
+	return QString::fromUtf8(m_timeline->metadata(key.toStdString()).c_str());
+}
+
+std::size_t MusicBuffer::read(float* out, std::size_t count)
+{
+	QMutexLocker locker(&m_mutex);
+	count = std::min(count, m_size) / m_channels * m_channels;
+	// Copy in up to two parts (the ring wraps around)
+	std::size_t first = std::min(count, m_ring.size() - m_begin);
+	std::copy(m_ring.begin() + m_begin, m_ring.begin() + m_begin + first, out);
+	std::copy(m_ring.begin(), m_ring.begin() + (count - first), out + first);
+	m_begin = (m_begin + count) % m_ring.size();
+	m_size -= count;
+	m_frame += count / m_channels;
+	if (count) m_needSpace.wakeOne();
+	return count;
+}
+
+quint64 MusicBuffer::frame() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_frame;
+}
+
+bool MusicBuffer::atEnd() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_eof && m_size == 0;
+}
+
+double MusicBuffer::buffered() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_eof ? getInf() : double(m_size / m_channels) / m_rate;
+}
+
+void MusicBuffer::seek(double time)
+{
+	QMutexLocker locker(&m_mutex);
+	time = std::max(0.0, time);
+	m_seekTarget = time;
+	++m_generation;
+	m_begin = m_size = 0;
+	m_frame = round(time * m_rate);
+	m_eof = false;
+	m_needSpace.wakeOne();
+}
+
+void MusicBuffer::run()
+{
+	std::vector<da::sample_t> chunk;
+	while (true) {
+		unsigned generation;
+		double seekTarget;
+		{
+			QMutexLocker locker(&m_mutex);
+			if (m_quit) break;
+			generation = m_generation;
+			seekTarget = m_seekTarget;
+			m_seekTarget = getNaN();
+		}
+		if (seekTarget == seekTarget) m_timeline->seek(seekTarget);
+		chunk.clear();
+		bool more = m_timeline->output(chunk);  // Waits for the decoder
+		QMutexLocker locker(&m_mutex);
+		if (m_generation != generation) continue;  // Decoded before a seek
+		if (!more) {
+			m_eof = true;
+			while (!m_quit && m_generation == generation) m_needSpace.wait(&m_mutex);
+			continue;
+		}
+		// Copy into the ring as space becomes available
+		for (std::size_t pos = 0; pos < chunk.size(); ) {
+			while (!m_quit && m_generation == generation && m_size == m_ring.size()) m_needSpace.wait(&m_mutex);
+			if (m_quit || m_generation != generation) break;
+			std::size_t end = (m_begin + m_size) % m_ring.size();
+			std::size_t count = std::min(chunk.size() - pos, std::min(m_ring.size() - m_size, m_ring.size() - end));
+			std::copy(chunk.begin() + pos, chunk.begin() + pos + count, m_ring.begin() + end);
+			m_size += count;
+			pos += count;
+		}
+	}
+}
+
+
+// PlaybackEngine
+
+PlaybackEngine::PlaybackEngine(QObject *parent, AudioDevice *device):
+  QObject(parent), m_device(device ? device : new QtAudioDevice), m_deviceRate(), m_mixer(*this), m_state(STOPPED),
+  m_rate(defaultRate), m_musicFrame(), m_musicPhase(), m_pulledFrames(), m_baseFrame(), m_rendering(), m_musicVolume(1.0f), m_voiceVolume(1.0f)
+{
+	m_device->setParent(this);
+	connect(m_device, SIGNAL(error(QString)), this, SIGNAL(error(QString)));
+	m_mixer.open(QIODevice::ReadOnly | QIODevice::Unbuffered);  // Pulled frames must all reach the device
+	m_notifyTimer.setInterval(notifyInterval);
+	connect(&m_notifyTimer, SIGNAL(timeout()), this, SLOT(notify()));
+}
+
+PlaybackEngine::~PlaybackEngine()
+{
+	if (m_probe) m_probe->wait();
+	m_device->stop();
+}
+
+void PlaybackEngine::init()
+{
+	if (m_probe) m_probe->wait();  // Used before the probe was done, the device must not be opened meanwhile
+	if (!m_deviceRate) openOutput(m_music ? m_music->rate() : m_rate);
+}
+
+void PlaybackEngine::initInBackground()
+{
+	if (m_probe) return;
+	m_probe.reset(new ProbeThread(*m_device));
+	connect(m_probe.data(), SIGNAL(finished()), this, SLOT(probed()));
+	m_probe->start();
+}
+
+void PlaybackEngine::probed()
+{
+	m_probe->wait();  // It has only signalled being done
+	m_probe.reset();
+	init();
+	emit ready();
+}
+
+void PlaybackEngine::openOutput(unsigned rate)
+{
+	if (rate == m_deviceRate) return;
+	m_device->stop();
+	unsigned outputRate = m_device->nearestRate(rate);  // The music gets resampled if it differs
+	{
+		QMutexLocker locker(&m_mutex);
+		m_rate = outputRate;
+		m_musicSamples.clear();
+		m_musicPhase = 0.0;
+	}
+	// The device keeps pulling (silence when there is nothing to play), so that voices start right away
+	m_device->start(&m_mixer, outputRate, outputLatency * outputRate);
+	m_deviceRate = rate;
+}
+
+void PlaybackEngine::setMedia(QString const& fileName)
+{
+	setMedia(Timeline::Segments(1, TimelineSegment(fileName)));
+}
+
+void PlaybackEngine::setMedia(Timeline::Segments const& segments)
+{
+	QScopedPointer<MusicBuffer> music(new MusicBuffer(segments, readAhead));  // Throws on error
+	{
+		QMutexLocker locker(&m_mutex);
+		m_rendering = false;
+		m_music.swap(music);
+		restart(0);
+	}
+	music.reset();  // The previous one, outside of the lock
+	if (m_deviceRate) openOutput(m_music->rate());
+	m_notifyTimer.stop();
+	setState(STOPPED);
+	emit positionChanged(0);
+	emit metaDataChanged();
+}
+
+/// Forget the music given to the output, which continues from the given music frame
+void PlaybackEngine::restart(quint64 frame)
+{
+	m_spans.clear();
+	m_baseFrame = frame;
+	m_musicSamples.clear();
+	m_musicPhase = 0.0;
+}
+
+/// Music frame being heard when the device has the given number of frames buffered
+quint64 PlaybackEngine::heardFrame(unsigned buffered, bool* ended) const
+{
+	quint64 heard = m_pulledFrames - std::min<quint64>(buffered, m_pulledFrames);
+	// The last span that began by then
+	std::deque<Span>::const_reverse_iterator it = m_spans.rbegin();
+	while (it != m_spans.rend() && it->output > heard) ++it;
+	if (it == m_spans.rend()) {
+		if (ended) *ended = m_spans.empty();
+		return m_baseFrame;  // Nothing of it heard yet
+	}
+	if (ended) *ended = (it == m_spans.rbegin() && heard >= it->output + it->frames);
+	return quint64(it->music + std::min(heard - it->output, it->frames) * it->step);
+}
+
+qint64 PlaybackEngine::position() const
+{
+	// Asked before locking, as the device may hold its own lock while pulling from the mixer
+	unsigned buffered = m_device->buffered();
+	QMutexLocker locker(&m_mutex);
+	if (!m_music) return 0;
+	quint64 frame = m_rendering ? heardFrame(buffered, NULL) : m_baseFrame;
+	return frame * 1000 / m_music->rate();
+}
+
+qint64 PlaybackEngine::duration() const
+{
+	double d = m_music ? m_music->duration() : 0.0;
+	return d == d && d < getInf() ? qint64(d * 1000.0) : 0;
+}
+
+QString PlaybackEngine::metaData(QString const& key) const
+{
+	return m_music ? m_music->metadata(key) : QString();
+}
+
+double PlaybackEngine::bufferedMusic() const
+{
+	return m_music ? m_music->buffered() : 0.0;
+}
+
+void PlaybackEngine::setMusicVolume(qreal volume)
+{
+	QMutexLocker locker(&m_mutex);
+	m_musicVolume = volume;
+}
+
+void PlaybackEngine::setVoiceVolume(qreal volume)
+{
+	QMutexLocker locker(&m_mutex);
+	m_voiceVolume = volume;
+}
+
+void PlaybackEngine::mix(QByteArray const& samples, unsigned rate)
+{
+	init();
+	Voice voice;
+	qint16 const* begin = reinterpret_cast<qint16 const*>(samples.constData());
+	voice.samples.assign(begin, begin + samples.size() / 2);
+	for (std::size_t i = 0; i < voice.samples.size(); ++i) voice.samples[i] /= 32768.0f;
+	voice.pos = 0.0;
+	QMutexLocker locker(&m_mutex);
+	voice.step = double(rate) / m_rate;
+	m_voices.push_back(voice);
+}
+
+void PlaybackEngine::play()
+{
+	if (!m_music || m_state == PLAYING) return;
+	if (m_music->atEnd()) setPosition(0);
+	init();
+	{
+		QMutexLocker locker(&m_mutex);
+		m_rendering = true;
+	}
+	m_notifyTimer.start();
+	setState(PLAYING);
+}
+
+void PlaybackEngine::pause()
+{
+	if (m_state != PLAYING) return;
+	qint64 pos = position();
+	{
+		QMutexLocker locker(&m_mutex);
+		m_rendering = false;
+	}
+	m_notifyTimer.stop();
+	// Continue from what was heard, not from what was already given to the device
+	setPosition(pos);
+	setState(PAUSED);
+}
+
+void PlaybackEngine::stop()
+{
+	{
+		QMutexLocker locker(&m_mutex);
+		m_rendering = false;
+	}
+	m_notifyTimer.stop();
+	if (m_music) setPosition(0);
+	setState(STOPPED);
+}
+
+void PlaybackEngine::setPosition(qint64 ms)
+{
+	if (!m_music) return;
+	{
+		QMutexLocker locker(&m_mutex);
+		m_music->seek(std::max<qint64>(0, ms) / 1000.0);
+		restart(m_music->frame());
+	}
+	emit positionChanged(position());
+}
+
+void PlaybackEngine::setState(State state)
+{
+	if (state == m_state) return;
+	m_state = state;
+	emit stateChanged(state);
+}
+
+void PlaybackEngine::notify()
+{
+	emit positionChanged(position());
+	if (m_state != PLAYING || !m_music->atEnd()) return;
+	// Stop once the end has been heard too
+	unsigned buffered = m_device->buffered();
+	{
+		QMutexLocker locker(&m_mutex);
+		bool ended;
+		quint64 frame = heardFrame(buffered, &ended);
+		if (!ended) return;
+		m_rendering = false;
+		restart(frame);  // Stays at the end
+	}
+	m_notifyTimer.stop();
+	setState(STOPPED);
+}
+
+qint64 PlaybackEngine::render(char *data, qint64 maxlen)
+{
+	QMutexLocker locker(&m_mutex);
+	std::size_t frames = maxlen / bytesPerFrame;
+	m_mix.assign(frames * AudioDevice::channels, 0.0f);
+	// The music (silence while the buffer is being filled after a seek)
+	if (m_rendering && m_music && frames) {
+		double first;
+		std::size_t count = renderMusic(frames, first);
+		// Remember where it went, continuing the last span if there was no gap
+		if (count) {
+			double step = double(m_music->rate()) / m_rate;
+			Span* last = m_spans.empty() ? NULL : &m_spans.back();
+			if (last && last->output + last->frames == m_pulledFrames && last->step == step
+			  && std::abs(last->music + last->frames * step - first) < 1e-3) last->frames += count;
+			else {
+				Span span = { m_pulledFrames, first, count, step };
+				m_spans.push_back(span);
+			}
+		}
+		while (m_spans.size() > 1 && m_spans[1].output + spanHistory * m_rate < m_pulledFrames) m_spans.pop_front();
+	}
+	m_pulledFrames += frames;
+	// The voices, resampled to the output rate
+	for (std::list<Voice>::iterator it = m_voices.begin(); it != m_voices.end(); ) {
+		Voice& v = *it;
+		for (std::size_t i = 0; i < frames; ++i, v.pos += v.step) {
+			std::size_t n = v.pos;
+			if (n + 1 >= v.samples.size()) break;
+			float value = m_voiceVolume * (v.samples[n] + float(v.pos - n) * (v.samples[n + 1] - v.samples[n]));
+			m_mix[2 * i] += value;
+			m_mix[2 * i + 1] += value;
+		}
+		if (std::size_t(v.pos) + 1 >= v.samples.size()) it = m_voices.erase(it);
+		else ++it;
+	}
+	qint16* out = reinterpret_cast<qint16*>(data);
+	for (std::size_t i = 0; i < m_mix.size(); ++i) out[i] = clamp(m_mix[i], -1.0f, 1.0f) * 32767.0f;
+	return frames * bytesPerFrame;
+}
+
+/// Mix the music into the output frames, resampled if the output is at another rate
+/// @param first set to the music frame of the first output frame
+/// @return the output frames mixed (fewer if the buffer runs out)
+std::size_t PlaybackEngine::renderMusic(std::size_t frames, double& first)
+{
+	unsigned channels = m_music->channels();
+	if (m_music->rate() == m_rate) {
+		m_musicSamples.resize(frames * channels);
+		first = m_music->frame();
+		std::size_t count = m_music->read(&m_musicSamples[0], m_musicSamples.size()) / channels;
+		for (std::size_t i = 0; i < count; ++i) {
+			float const* s = &m_musicSamples[i * channels];
+			m_mix[2 * i] = m_musicVolume * s[0];
+			m_mix[2 * i + 1] = m_musicVolume * s[channels > 1 ? 1 : 0];
+		}
+		return count;
+	}
+	// Linear interpolation, the frames not passed yet are kept for the next time
+	const double step = double(m_music->rate()) / m_rate;
+	std::size_t available = m_musicSamples.size() / channels;
+	if (!available) m_musicFrame = m_music->frame();
+	std::size_t needed = std::size_t(m_musicPhase + (frames - 1) * step) + 2;
+	if (needed > available) {
+		m_musicSamples.resize(needed * channels);
+		available += m_music->read(&m_musicSamples[available * channels], (needed - available) * channels) / channels;
+		m_musicSamples.resize(available * channels);
+	}
+	first = m_musicFrame + m_musicPhase;
+	std::size_t count = 0;
+	for (; count < frames; ++count) {
+		double pos = m_musicPhase + count * step;
+		std::size_t n = pos;
+		if (n + 1 >= available) break;
+		float frac = pos - n;
+		float const* s = &m_musicSamples[n * channels];
+		float const* t = s + channels;
+		unsigned right = channels > 1 ? 1 : 0;
+		m_mix[2 * count] = m_musicVolume * (s[0] + frac * (t[0] - s[0]));
+		m_mix[2 * count + 1] = m_musicVolume * (s[right] + frac * (t[right] - s[right]));
+	}
+	// Drop the frames passed
+	double end = m_musicPhase + count * step;
+	std::size_t passed = std::min<std::size_t>(end, available);
+	m_musicSamples.erase(m_musicSamples.begin(), m_musicSamples.begin() + passed * channels);
+	m_musicFrame += passed;
+	m_musicPhase = end - passed;
+	return count;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QIODevice>
+#include <QByteArray>
+#include <QScopedPointer>
+#include <QString>
+#include <QTimer>
+#include "timeline.hh"
+#include <deque>
+#include <list>
+#include <vector>
+
+class AudioDevice;
+
+/// Decoded music ahead of the playback position, filled by a thread of its own
+/** The output only ever copies from the buffer (it never waits for the decoder), and seeking
+  * drops the buffered samples and lets the decoder continue exactly at the new position.
+ */
+class MusicBuffer: public QThread
+{
+public:
+	/// Open the files and start decoding, throws std::runtime_error on failure
+	MusicBuffer(Timeline::Segments const& segments, double seconds);
+	~MusicBuffer();
+	unsigned rate() const { return m_rate; }
+	unsigned channels() const { return m_channels; }
+	double duration() const;
+	QString metadata(QString const& key) const;
+	/// Take up to count samples (interleaved), returns the number taken
+	std::size_t read(float* out, std::size_t count);
+	/// Frame number of the next sample to be read
+	quint64 frame() const;
+	/// Everything has been read
+	bool atEnd() const;
+	/// Seconds decoded ahead (infinite once the end has been decoded)
+	double buffered() const;
+	void seek(double time);
+
+protected:
+	void run(); // Thread runs here
+
+private:
+	QScopedPointer<Timeline> m_timeline;
+	unsigned m_rate;
+	unsigned m_channels;
+	mutable QMutex m_mutex;
+	QWaitCondition m_needSpace;
+	std::vector<float> m_ring;
+	std::size_t m_begin;  ///< Ring position of the first buffered sample
+	std::size_t m_size;  ///< Samples buffered
+	quint64 m_frame;  ///< Frame number of the first buffered sample
+	double m_seekTarget;  ///< Seek for the decoder thread to do (NaN for none)
+	unsigned m_generation;  ///< Changed by each seek, so that samples decoded before it are not buffered
+	bool m_eof;
+	bool m_quit;
+};
+
+
+/// Music playback through our own decoder, with a mixer for short sounds played over it
+/** The audio device pulls from the mixer, which takes the music from a MusicBuffer and
+  * adds the voices (synth notes, piano keys) given with mix(). The device is opened at the rate
+  * of the music, or at the nearest one that it supports, in which case the music gets resampled
+  * (linearly, like the voices). The mixer remembers which
+  * music went to which output frames, so the position is that of the sample being heard
+  * (the frames pulled less those still in the device), even across seeks and underruns.
+ */
+class PlaybackEngine: public QObject
+{
+	Q_OBJECT
+public:
+	enum State { STOPPED, PLAYING, PAUSED };
+
+	/// @param device where to play (taken over), the sound card if none
+	PlaybackEngine(QObject *parent = NULL, AudioDevice *device = NULL);
+	~PlaybackEngine();
+	/// Open the audio device now instead of on the first use (it may take a while)
+	void init();
+	/// Probe the audio device in a thread, then open it on the thread of the engine and emit ready()
+	void initInBackground();
+	/// Load a music file, throws std::runtime_error on failure
+	void setMedia(QString const& fileName);
+	/// Load several music files played as one (see Timeline), throws std::runtime_error on failure
+	void setMedia(Timeline::Segments const& segments);
+	bool hasMedia() const { return !m_music.isNull(); }
+	State state() const { return m_state; }
+	qint64 position() const;  ///< Milliseconds
+	qint64 duration() const;  ///< Milliseconds
+	/// Tag of the music file (e.g. "title" or "artist"), empty if not available
+	QString metaData(QString const& key) const;
+	void setMusicVolume(qreal volume);
+	void setVoiceVolume(qreal volume);
+	void setNotifyInterval(int ms) { m_notifyTimer.setInterval(ms); }
+	/// Seconds of music decoded ahead of the playback (infinite once the end has been decoded)
+	double bufferedMusic() const;
+	/// Play a sound (16-bit mono samples) over the music, starting now
+	void mix(QByteArray const& samples, unsigned rate);
+
+public slots:
+	void play();
+	void pause();
+	void stop();
+	void setPosition(qint64 ms);
+
+signals:
+	void positionChanged(qint64 ms);
+	void stateChanged(PlaybackEngine::State state);
+	void metaDataChanged();
+	void error(QString const& message);
+	void ready();  ///< The audio device has been opened by initInBackground()
+
+private slots:
+	void notify();
+	void probed();
+
+private:
+	/// The device that the audio output pulls from
+	class Mixer: public QIODevice {
+	public:
+		Mixer(PlaybackEngine& engine): m_engine(engine) {}
+		bool isSequential() const { return true; }
+		qint64 bytesAvailable() const { return 16384 + QIODevice::bytesAvailable(); }  // Never runs out
+	protected:
+		qint64 readData(char *data, qint64 maxlen) { return m_engine.render(data, maxlen); }
+		qint64 writeData(char const*, qint64) { return -1; }
+	private:
+		PlaybackEngine& m_engine;
+	};
+	struct Voice {
+		std::vector<float> samples;
+		double pos;  ///< Position in samples
+		double step;  ///< Samples per output frame
+	};
+	/// Music given to the output without gaps
+	struct Span {
+		quint64 output;  ///< Output frame of the first music frame
+		double music;  ///< Music frame (between frames if resampled)
+		quint64 frames;  ///< Output frames
+		double step;  ///< Music frames per output frame
+	};
+	void openOutput(unsigned rate);
+	qint64 render(char *data, qint64 maxlen);
+	std::size_t renderMusic(std::size_t frames, double& first);
+	quint64 heardFrame(unsigned buffered, bool* ended) const;
+	void restart(quint64 frame);
+	void setState(State state);
+
+	QScopedPointer<MusicBuffer> m_music;
+	AudioDevice *m_device;
+	QScopedPointer<QThread> m_probe;  ///< Running AudioDevice::probe() (null when not)
+	unsigned m_deviceRate;  ///< Rate asked from the device (0 if not started), it may play at another
+	Mixer m_mixer;
+	QTimer m_notifyTimer;
+	State m_state;
+	unsigned m_rate;  ///< Output sample rate (the music's if the device supports it)
+	mutable QMutex m_mutex;  ///< For the state shared with the output
+	std::vector<float> m_mix;  ///< Stereo output being mixed
+	std::vector<float> m_musicSamples;  ///< Music read for the output (when resampling, the frames not passed yet)
+	quint64 m_musicFrame;  ///< Music frame of the first of m_musicSamples when resampling
+	double m_musicPhase;  ///< Resampling position from m_musicFrame
+	std::list<Voice> m_voices;
+	std::deque<Span> m_spans;  ///< Music given to the output since the last seek (the recent part)
+	quint64 m_pulledFrames;  ///< Output frames given to the device
+	quint64 m_baseFrame;  ///< Music frame where the output continues (after a seek or pause)
+	bool m_rendering;  ///< The music is being given to the output
+	float m_musicVolume;
+	float m_voiceVolume;
+};
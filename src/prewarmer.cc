@@ -0,0 +1,152 @@
+#include "prewarmer.hh"
+#include "analysisworker.hh"
+#include <QApplication>
+#include <QDir>
+#include <QDirIterator>
+#include <QEvent>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+#include <QTextStream>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+	static const int idleMilliseconds = 2000;  ///< Analysis is paused until the user has been idle this long
+	static const int idlePollMilliseconds = 200;
+
+	/// Add file to list if it exists and is not already there
+	void addMusic(QStringList& list, QString const& file) {
+		if (!list.contains(file) && QFileInfo(file).isFile()) list << file;
+	}
+}
+
+AnalysisPrewarmer::AnalysisPrewarmer(QObject *parent)
+	: QThread(parent), m_rescan(), m_quit()
+{
+	m_activity.start();
+	// Watch the user input of the whole application
+	qApp->installEventFilter(this);
+}
+
+AnalysisPrewarmer::~AnalysisPrewarmer()
+{
+	{
+		QMutexLocker locker(&m_mutex);
+		m_quit = true;
+		m_condition.wakeOne();
+	}
+	wait();
+}
+
+void AnalysisPrewarmer::prewarm(QString const& path)
+{
+	QSettings settings; // Default QSettings parameters given in main()
+	if (!settings.value("prewarm-analysis", true).toBool()) return;
+	if (QThread::idealThreadCount() < 2) return;  // No idle cores, would only slow down the editor
+	{
+		QMutexLocker locker(&m_mutex);
+		m_current = QFileInfo(path).absolutePath();
+		m_rescan = true;
+		m_condition.wakeOne();
+	}
+	if (!isRunning()) start(QThread::IdlePriority);
+}
+
+bool AnalysisPrewarmer::eventFilter(QObject *obj, QEvent *event)
+{
+	switch (event->type()) {
+	case QEvent::MouseButtonPress:
+	case QEvent::MouseMove:
+	case QEvent::KeyPress:
+	case QEvent::Wheel:
+		{
+			QMutexLocker locker(&m_mutex);
+			m_activity.restart();
+		}
+		break;
+	default:
+		break;
+	}
+	return QThread::eventFilter(obj, event);
+}
+
+bool AnalysisPrewarmer::update(double, double)
+{
+	// Stay out of the way while the user is working
+	forever {
+		{
+			QMutexLocker locker(&m_mutex);
+			if (m_quit || m_rescan) return false;
+			if (m_activity.elapsed() > idleMilliseconds) return true;
+		}
+		msleep(idlePollMilliseconds);
+	}
+}
+
+QStringList AnalysisPrewarmer::findMusic(QString const& root, QString const& current) const
+{
+	// Song files in path order, so that the songs after the current one come first
+	QStringList songs;
+	QDirIterator it(root, QStringList() << "*.txt" << "*.ini", QDir::Files, QDirIterator::Subdirectories | QDirIterator::FollowSymlinks);
+	while (it.hasNext()) songs << it.next();
+	songs.sort();
+	QStringList before, after;
+	for (int i = 0; i < songs.size(); ++i) {
+		QFileInfo finfo(songs[i]);
+		QString dir = finfo.absolutePath();
+		if (dir == current) continue;  // Being analyzed by the editor already
+		QStringList& list = (dir < current ? before : after);
+		if (finfo.suffix().toLower() == "ini") {
+			// Frets on Fire songs have fixed file names
+			addMusic(list, dir + "/vocals.ogg");
+			addMusic(list, dir + "/song.ogg");
+			continue;
+		}
+		// UltraStar TXT header references (only file names are needed, so no encoding detection)
+		QFile f(songs[i]);
+		if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) continue;
+		QTextStream ts(&f);
+		while (!ts.atEnd()) {
+			QString line = ts.readLine().trimmed();
+			if (!line.startsWith('#')) break;  // End of header
+			int pos = line.indexOf(':');
+			QString key = line.mid(1, pos - 1).trimmed().toUpper();
+			if (pos > 0 && (key == "MP3" || key == "VOCALS")) addMusic(list, dir + "/" + line.mid(pos + 1).trimmed());
+		}
+	}
+	return after + before;
+}
+
+void AnalysisPrewarmer::run()
+{
+	AnalysisWorker worker;  // Kept running for all the files
+	forever {
+		QString file;
+		{
+			QMutexLocker locker(&m_mutex);
+			while (!m_quit && !m_rescan && m_queue.isEmpty()) m_condition.wait(&m_mutex);
+			if (m_quit) return;
+			if (m_rescan) {
+				m_rescan = false;
+				QString current = m_current;
+				QString root = QSettings().value("library-root").toString();
+				if (root.isEmpty()) root = QFileInfo(current).absolutePath();  // The folder that contains the song folders
+				locker.unlock();
+				QStringList queue = findMusic(root, current);
+				locker.relock();
+				if (!m_rescan) m_queue = queue;
+				continue;
+			}
+			file = m_queue.takeFirst();
+		}
+		if (PitchAnalysis::isCached(file)) continue;
+		try {
+			PitchAnalysis analysis;
+			if (worker.analyze(file, analysis, *this)) analysis.save(file);
+		} catch (std::exception& e) {
+			std::cerr << "Pre-warming analysis of " << file.toStdString() << " failed: " << e.what() << std::endl;
+		}
+	}
+}
+
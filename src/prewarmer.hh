@@ -0,0 +1,43 @@
+#pragma once
+
+#include "analysis.hh"
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QStringList>
+
+class QEvent;
+
+/// Background analysis of the other songs in the library
+/** Finds the music files referenced by the song files around the current song (or under
+  * the library root configured by the "library-root" setting) and stores their pitch
+  * analysis into the analysis cache, so that the next songs open without waiting.
+  * Runs in an idle priority thread and pauses whenever the user is interacting.
+ */
+class AnalysisPrewarmer: public QThread, private PitchAnalysis::Progress
+{
+public:
+	AnalysisPrewarmer(QObject *parent = NULL);
+	~AnalysisPrewarmer();
+
+	/// Restart pre-warming around the given song or music file (its own folder is skipped)
+	void prewarm(QString const& path);
+
+protected:
+	void run(); // Thread runs here
+	bool eventFilter(QObject *obj, QEvent *event);
+
+private:
+	bool update(double position, double duration);
+	QStringList findMusic(QString const& root, QString const& current) const;
+
+	QMutex m_mutex;
+	QWaitCondition m_condition;
+	QString m_current;  ///< Folder of the song being edited
+	QStringList m_queue;  ///< Music files waiting for analysis
+	QElapsedTimer m_activity;  ///< Time since the last user input
+	bool m_rescan;  ///< Should the queue be rebuilt?
+	bool m_quit;
+};
+
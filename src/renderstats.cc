@@ -0,0 +1,4 @@
+#include "renderstats.hh"
+
+QAtomicInt RenderStats::pixmaps;
+QAtomicInt RenderStats::pixels;
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <QAtomicInt>
+
+/// Counters of the rendering work done, for measuring (updated from any thread)
+/** The counting is only compiled in with RENDER_STATS defined, as it is for the GUI library
+  * that renderbench links. Elsewhere the macros below expand to nothing.
+ */
+namespace RenderStats {
+	extern QAtomicInt pixmaps;  ///< Pixmaps and images created
+	extern QAtomicInt pixels;  ///< Pixels rasterized into them and painted on widgets
+	/// Count a new pixmap or image of the given size
+	inline void image(int width, int height) { pixmaps.ref(); pixels.fetchAndAddRelaxed(width * height); }
+}
+
+#ifdef RENDER_STATS
+#define RENDER_STATS_IMAGE(width, height) RenderStats::image((width), (height))
+#define RENDER_STATS_PIXMAP() RenderStats::pixmaps.ref()
+#define RENDER_STATS_PIXELS(count) RenderStats::pixels.fetchAndAddRelaxed(count)
+#else
+#define RENDER_STATS_IMAGE(width, height) ((void)0)
+#define RENDER_STATS_PIXMAP() ((void)0)
+#define RENDER_STATS_PIXELS(count) ((void)0)
+#endif
@@ -32,6 +32,16 @@ namespace TrackName {
 	const QString HARMONIC_1 = "Harmonic 1";
 	const QString HARMONIC_2 = "Harmonic 2";
 	const QString HARMONIC_3 = "Harmonic 3";
+	/// The vocal track of a part of a duet or a harmony by its number in song files (0 is the lead vocals)
+	inline QString vocalPart(unsigned part) {
+		switch (part) {
+			case 0: return LEAD_VOCAL;
+			case 1: return HARMONIC_1;
+			case 2: return HARMONIC_2;
+			case 3: return HARMONIC_3;
+		}
+		return QString("Harmonic %1").arg(part);
+	}
 }
 
 /// class to load and parse songfiles
@@ -97,13 +107,17 @@ class Song {
 		}
 	}
 
-	std::vector<QString> getVocalTrackNames() {
+	/// Names of the vocal tracks, the lead vocals first
+	std::vector<QString> getVocalTrackNames() const {
 		std::vector<QString> result;
+		if (vocalTracks.find(TrackName::LEAD_VOCAL) != vocalTracks.end()) result.push_back(TrackName::LEAD_VOCAL);
 		for (VocalTracks::const_iterator it = vocalTracks.begin(); it != vocalTracks.end(); ++it) {
-			result.push_back(it->first);
+			if (it->first != TrackName::LEAD_VOCAL) result.push_back(it->first);
 		}
 		return result;
 	}
+	VocalTracks const& getVocalTracks() const { return vocalTracks; }
+	void setVocalTracks(VocalTracks const& tracks) { vocalTracks = tracks; }
 	//InstrumentTracks instrumentTracks; ///< guitar etc. notes for this song
 	//DanceTracks danceTracks; ///< dance tracks
 	//bool hasDance() const { return !danceTracks.empty(); }
@@ -1,5 +1,7 @@
 #include "songparser.hh"
 
+#include <algorithm>
+#include <iterator>
 #include <stdexcept>
 #include <iostream>
 
@@ -8,6 +10,14 @@
 
 using namespace SongParserUtil;
 
+namespace {
+	/// Workaround for the terminating : 1 0 0 line, written by some converters
+	void dropTerminator(Notes& notes) {
+		if (!notes.empty() && notes.back().type != Note::SLEEP
+		  && notes.back().begin == notes.back().end) notes.pop_back();
+	}
+}
+
 /// 'Magick' to check if this file looks like correct format
 bool SongParser::txtCheck(QString const& data) {
 	return data[0] == '#' && data[1] >= 'A' && data[1] <= 'Z';
@@ -22,15 +32,44 @@ void SongParser::txtParse() {
 		throw std::runtime_error("Required header fields missing");
 	if (m_song.bpm != 0.0) addBPM(0, m_song.bpm);
 
-	// Parse notes
-	VocalTrack vocal(TrackName::LEAD_VOCAL);
-	while (txtParseNote(line, vocal) && getline(line)) {}
-
-	// Workaround for the terminating : 1 0 0 line, written by some converters
-	if (!vocal.notes.empty() && vocal.notes.back().type != Note::SLEEP
-	  && vocal.notes.back().begin == vocal.notes.back().end) vocal.notes.pop_back();
+	// Parse notes, in duets those of each singer follow a P1 or P2 line and those sung by both a P3 line
+	VocalTracks tracks;
+	VocalTrack* vocal = &tracks.insert(std::make_pair(TrackName::LEAD_VOCAL, VocalTrack(TrackName::LEAD_VOCAL))).first->second;
+	VocalTrack both(TrackName::LEAD_VOCAL);  // Added to the tracks of both singers in the end
+	do {
+		QString player = line.trimmed();
+		if (player.startsWith('P')) {
+			bool ok = false;
+			unsigned part = player.mid(1).trimmed().toUInt(&ok);
+			if (!ok || part < 1) part = 1;  // Unknown players sing the lead
+			if (part == 3) vocal = &both;
+			else {
+				QString name = TrackName::vocalPart(part - 1);
+				vocal = &tracks.insert(std::make_pair(name, VocalTrack(name))).first->second;
+			}
+			// The timing of each singer starts from the beginning of the song
+			m_prevts = 0;
+			m_prevtime = vocal->notes.empty() ? 0.0 : vocal->notes.back().end;
+			m_relativeShift = 0;
+		} else if (!txtParseNote(line, *vocal)) break;
+	} while (getline(line));
 
-	m_song.insertVocalTrack(TrackName::LEAD_VOCAL, vocal);
+	dropTerminator(both.notes);
+	for (VocalTracks::iterator it = tracks.begin(); it != tracks.end(); ++it) dropTerminator(it->second.notes);
+	if (!both.notes.empty()) {
+		for (unsigned part = 0; part < 2; ++part) {
+			QString name = TrackName::vocalPart(part);
+			VocalTrack& track = tracks.insert(std::make_pair(name, VocalTrack(name))).first->second;
+			Notes merged;
+			std::merge(track.notes.begin(), track.notes.end(), both.notes.begin(), both.notes.end(), std::back_inserter(merged), Note::ltBegin);
+			track.notes.swap(merged);
+			track.noteMin = std::min(track.noteMin, both.noteMin);
+			track.noteMax = std::max(track.noteMax, both.noteMax);
+		}
+	}
+	for (VocalTracks::iterator it = tracks.begin(); it != tracks.end(); ++it) {
+		if (it->first == TrackName::LEAD_VOCAL || !it->second.notes.empty()) m_song.insertVocalTrack(it->first, it->second);
+	}
 }
 
 bool SongParser::txtParseField(QString const& line) {
@@ -84,7 +123,6 @@ bool SongParser::txtParseNote(QString line, VocalTrack &vocal) {
 		addBPM(ts, bpm);
 		return true;
 	}
-	if (line[0] == 'P') return true; //We ignore player information for now (multiplayer hack)
 	Note n;
 	n.type = Note::Type(iss.read(1)[0].toLatin1());
 	unsigned int ts = m_prevts;
@@ -24,9 +24,6 @@ void SongParser::xmlParse()
 	if (!doc.setContent(m_stream.readAll())) {
 		throw std::runtime_error(QT_TR_NOOP("XML parse error"));	}
 
-	VocalTrack vocal(TrackName::LEAD_VOCAL);
-	Notes& notes = vocal.notes;
-
 	// Parse meta
 	QDomElement root = doc.documentElement();
 	m_song.bpm = root.attribute("Tempo").toDouble();
@@ -38,80 +35,94 @@ void SongParser::xmlParse()
 	m_song.genre = root.attribute("Genre");
 	m_song.year = root.attribute("Year");
 
-	bool track_found = false; // FIXME: HACK: We only parse the first track
-
-	// Loop through the child elements
+	// Duets have the sentences of each singer inside their TRACK, otherwise they follow the only TRACK
+	std::vector<VocalTrack> tracks;
 	QDomElement elem = root.firstChildElement();
 	while (!elem.isNull()) {
 
 		if (elem.tagName() == "TRACK") {
-			// Track found
-			if (track_found) break; // FIXME: HACK: We only parse the first track
-			track_found = true;
-			m_song.artist = elem.attribute("Artist");
+			// Track found, the timing of each one starts from the beginning of the song
+			if (tracks.empty()) m_song.artist = elem.attribute("Artist");
+			tracks.push_back(VocalTrack(TrackName::vocalPart(tracks.size())));
+			m_prevts = 0;
+			m_prevtime = 0.0;
+			for (QDomElement sentence = elem.firstChildElement("SENTENCE"); !sentence.isNull(); sentence = sentence.nextSiblingElement("SENTENCE"))
+				xmlParseSentence(sentence, tracks.back());
 
 		} else if (elem.tagName() == "SENTENCE") {
 			// Sentence found
-			// Loop through the notes in the sentence
-			QDomElement noteElem = elem.firstChildElement();
-			while (!noteElem.isNull()) {
-
-				// We are only interested in NOTE elements
-				if (noteElem.tagName() == "NOTE") {
-					// Note found
-					int length = noteElem.attribute("Duration").toInt();
-					unsigned int ts = m_prevts;
-
-					// See if it is an actual note and not sleep
-					QString lyric = noteElem.attribute("Lyric").isEmpty()
-						? noteElem.attribute("Rap") : noteElem.attribute("Lyric");
-					if (noteElem.attribute("MidiNote") != "0" || !lyric.isEmpty()) {
-						// TODO: Prettify lyric? (as ss_extract)
-						Note n(lyric);
-						if (noteElem.attribute("Bonus") == QString("Yes"))
-							n.type = Note::GOLDEN;
-						else if (noteElem.attribute("FreeStyle") == QString("Yes"))
-							n.type = Note::FREESTYLE;
-						else
-							n.type = Note::NORMAL;
-
-						n.note = noteElem.attribute("MidiNote").toInt();
-						n.notePrev = n.note; // No slide notes
-						n.begin = tsTime(ts);
-						n.end = tsTime(ts + length);
-
-						// Track note meta
-						vocal.noteMin = std::min(vocal.noteMin, n.note);
-						vocal.noteMax = std::max(vocal.noteMax, n.note);
-
-						// Save note
-						notes.push_back(n);
-					}
-
-					// Update time
-					m_prevts += length;
-					m_prevtime = tsTime(ts + length);
-				}
-				noteElem = noteElem.nextSiblingElement();
-			}
-
-			// Now add sentence end indicator
-			Note n;
-			n.type = Note::SLEEP;
-			n.note = 0;
-			n.begin = m_prevtime;
-			n.end = n.begin;
-			notes.push_back(n);
+			if (tracks.empty()) tracks.push_back(VocalTrack(TrackName::LEAD_VOCAL));
+			xmlParseSentence(elem, tracks.back());
 		}
 		elem = elem.nextSiblingElement();
 	}
 
-	if (!notes.empty()) {
-		vocal.beginTime = notes.front().begin;
-		vocal.endTime = notes.back().end;
+	bool found = false;
+	for (std::size_t i = 0; i < tracks.size(); ++i) {
+		VocalTrack& vocal = tracks[i];
+		if (vocal.notes.empty()) continue;
+		vocal.beginTime = vocal.notes.front().begin;
+		vocal.endTime = vocal.notes.back().end;
 		// Insert notes
-		m_song.insertVocalTrack(TrackName::LEAD_VOCAL, vocal);
-	} else throw std::runtime_error(QT_TR_NOOP("Couldn't find any notes"));
+		m_song.insertVocalTrack(vocal.name, vocal);
+		found = true;
+	}
+	if (!found) throw std::runtime_error(QT_TR_NOOP("Couldn't find any notes"));
+}
+
+void SongParser::xmlParseSentence(QDomElement const& sentence, VocalTrack& vocal)
+{
+	Notes& notes = vocal.notes;
+	// Loop through the notes in the sentence
+	QDomElement noteElem = sentence.firstChildElement();
+	while (!noteElem.isNull()) {
+
+		// We are only interested in NOTE elements
+		if (noteElem.tagName() == "NOTE") {
+			// Note found
+			int length = noteElem.attribute("Duration").toInt();
+			unsigned int ts = m_prevts;
+
+			// See if it is an actual note and not sleep
+			QString lyric = noteElem.attribute("Lyric").isEmpty()
+				? noteElem.attribute("Rap") : noteElem.attribute("Lyric");
+			if (noteElem.attribute("MidiNote") != "0" || !lyric.isEmpty()) {
+				// TODO: Prettify lyric? (as ss_extract)
+				Note n(lyric);
+				if (noteElem.attribute("Bonus") == QString("Yes"))
+					n.type = Note::GOLDEN;
+				else if (noteElem.attribute("FreeStyle") == QString("Yes"))
+					n.type = Note::FREESTYLE;
+				else
+					n.type = Note::NORMAL;
+
+				n.note = noteElem.attribute("MidiNote").toInt();
+				n.notePrev = n.note; // No slide notes
+				n.begin = tsTime(ts);
+				n.end = tsTime(ts + length);
+
+				// Track note meta
+				vocal.noteMin = std::min(vocal.noteMin, n.note);
+				vocal.noteMax = std::max(vocal.noteMax, n.note);
+
+				// Save note
+				notes.push_back(n);
+			}
+
+			// Update time
+			m_prevts += length;
+			m_prevtime = tsTime(ts + length);
+		}
+		noteElem = noteElem.nextSiblingElement();
+	}
+
+	// Now add sentence end indicator
+	Note n;
+	n.type = Note::SLEEP;
+	n.note = 0;
+	n.begin = m_prevtime;
+	n.end = n.begin;
+	notes.push_back(n);
 }
 
 
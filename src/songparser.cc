@@ -1,5 +1,5 @@
 #include "songparser.hh"
-#include "textcodecselector.hh"
+#include <QByteArray>
 #include <QFile>
 #include <QFileInfo>
 #include <algorithm>
@@ -35,11 +35,14 @@ SongParser::SongParser(Song& s):
 		throw SongParserException(QT_TR_NOOP("Could not open song file"), 0);
 
 	QFileInfo finfo(file);
-	if (finfo.size() < 10 || finfo.size() > 100000) throw SongParserException("Does not look like a song file (wrong size)", 1, true);
+	if (finfo.size() < 10 || finfo.size() > 10000000) throw SongParserException("Does not look like a song file (wrong size)", 1, true);
 
-	// Determine encoding
-	QString data = TextCodecSelector::readAllAndHandleEncoding(file);
+	// Determine encoding: UTF-8 if the data is valid as such, otherwise Latin-1 (which accepts
+	// any bytes, so there is never a need to ask the user and the parser works without a GUI)
+	QByteArray ba = file.readAll();
 	file.close();
+	QString data = QString::fromUtf8(ba, ba.size());
+	if (data.toUtf8().size() != ba.size()) data = QString::fromLatin1(ba, ba.size());
 	// Add a newline to the end to make sure our parsing doesn't skip the last line
 	data += "\n";
 
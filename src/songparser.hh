@@ -3,6 +3,8 @@
 #include "song.hh"
 #include <QTextStream>
 
+class QDomElement;
+
 namespace SongParserUtil {
 	/// Parse a boolean from string and assign it to a variable
 	void assign(bool& var, QString const& str);
@@ -37,6 +39,7 @@ class SongParser {
 	// SingStar XML
 	static bool xmlCheck(QString const& data);
 	void xmlParse();
+	void xmlParseSentence(QDomElement const& sentence, VocalTrack& vocal);
 
 	// Frets on Fire MIDI
 	static bool iniCheck(QString const& data);
@@ -10,7 +10,8 @@ void FoFMIDIWriter::writeMIDI() const {
 	double tempo = s.bpm > 0 ? s.bpm : 120.0;
 	unsigned division = 256;  // Allow for very precise timing
 	unsigned endtc = round(tempo / 60.0 * division * notes.back().end);
-	midifile::Writer writer(1, 2, division);
+	QByteArray name = QFile::encodeName(path + "/notes.mid");
+	midifile::Writer writer(name.constData(), 1, 2, division);
 	using midifile::Event;
 	writer.startTrack();
 	Event ev;
@@ -30,8 +31,8 @@ void FoFMIDIWriter::writeMIDI() const {
 	// End the timing track
 	ev.arg1 = Event::META_ENDOFTRACK;
 	writer.writeEvent(ev);
-	// Vocals track begins
-	writer.startTrack();
+	// Vocals track begins (a lyric and three note events per note, typically under 20 bytes)
+	writer.startTrack(20 * notes.size());
 	// Write track name
 	ev.arg1 = Event::META_SEQNAME;
 	std::string partvocals = "PART VOCALS";
@@ -97,9 +98,7 @@ void FoFMIDIWriter::writeMIDI() const {
 	ev.channel = 0x0F;
 	ev.arg1 = Event::META_ENDOFTRACK;
 	writer.writeEvent(ev);
-	// Write to file
-	QByteArray name = (path + "/notes.mid").toLocal8Bit();
-	writer.save(std::string(name.data(), name.size()).c_str());
+	writer.close();
 }
 
 void FoFMIDIWriter::writeINI() const {
@@ -43,18 +43,22 @@ void UltraStarTXTWriter::writeTXT() const {
 	//out << "#PREVIEWSTART:" << s.preview_start << '\n';
 	//if (!s.music["vocals"].isEmpty()) out << "#VOCALS:" << s.music["vocals"] << '\n'; // FIXME: remove full path
 
-	// Loop through the notes
-	const Notes& notes = s.getVocalTrack().notes;
-	for (int i = 0; i < notes.size(); ++i) {
-		const Note& n = notes[i];
-		if (n.type == Note::SLEEP) continue;
+	// Loop through the notes, each singer of a duet after a player line
+	std::vector<QString> tracks = vocalTracks(s);
+	for (std::size_t t = 0; t < tracks.size(); ++t) {
+		if (tracks.size() > 1) out << 'P' << t + 1 << '\n';
+		const Notes& notes = s.getVocalTrack(tracks[t]).notes;
+		for (int i = 0; i < notes.size(); ++i) {
+			const Note& n = notes[i];
+			if (n.type == Note::SLEEP) continue;
 
-		// Put sleeps before new phrases
-		if (i > 0 && n.lineBreak)
-			out << "- " << sec2dur(notes[i-1].end) << '\n';
+			// Put sleeps before new phrases
+			if (i > 0 && n.lineBreak)
+				out << "- " << sec2dur(notes[i-1].end) << '\n';
 
-		// Output the note
-		out << (char)n.type << ' '<< sec2dur(n.begin) << ' ' << sec2dur(n.length()) << ' ' << n.note << ' ' << n.syllable << '\n';
+			// Output the note
+			out << (char)n.type << ' '<< sec2dur(n.begin) << ' ' << sec2dur(n.length()) << ' ' << n.note << ' ' << n.syllable << '\n';
+		}
 	}
 
 	out << "E"; // End indicator
@@ -33,20 +33,35 @@ void SingStarXMLWriter::writeXML() {
 	root.appendChild(artistComment);
 	root.appendChild(titleComment);
 
-	// Track element
-	int tracknum = 1;
-	QDomElement trackElem = doc.createElement("TRACK");
-	trackElem.setAttribute("Name", "Player1");
-	trackElem.setAttribute("Artist", s.artist);
-	root.appendChild(trackElem);
+	// Track elements, the sentences follow a single track and are inside the tracks of a duet
+	std::vector<QString> tracks = vocalTracks(s);
+	for (std::size_t t = 0; t < tracks.size(); ++t) {
+		int tracknum = t + 1;
+		QDomElement trackElem = doc.createElement("TRACK");
+		trackElem.setAttribute("Name", QString("Player%1").arg(tracknum));
+		trackElem.setAttribute("Artist", s.artist);
+		root.appendChild(trackElem);
+		writeSentences(doc, tracks.size() > 1 ? trackElem : root, s.getVocalTrack(tracks[t]).notes, tracknum);
+	}
+
+	// Get the xml data
+	QString xml = doc.toString(4);
+	// Write to file
+	QFile f(path + "/notes.xml");
+	if (f.open(QFile::WriteOnly)) {
+		QTextStream out(&f);
+		out.setCodec("UTF-8");
+		out << xml;
+	} else throw std::runtime_error("Couldn't open target file notes.xml");
+}
 
+void SingStarXMLWriter::writeSentences(QDomDocument& doc, QDomElement& parent, Notes const& notes, int tracknum) {
 	// Create first sentence
 	int sentencenum = 1;
 	QDomElement sentenceElem = doc.createElement("SENTENCE"); // FIXME: Should there be Singer and Part attributes?
 	QDomComment sentenceComment = doc.createComment(QString("Track %1, Sentence %2").arg(tracknum).arg(sentencenum));
 	sentenceElem.appendChild(sentenceComment);
 	// First sentence also needs a starting SLEEP
-	Notes const& notes = s.getVocalTrack().notes;
 	int ts = sec2dur(notes.front().begin);
 	QDomElement firstNoteElem = doc.createElement("NOTE");
 	firstNoteElem.setAttribute("MidiNote", "0");
@@ -62,7 +77,7 @@ void SingStarXMLWriter::writeXML() {
 
 		// New sentence
 		if (n.lineBreak && !firstNote) {
-			root.appendChild(sentenceElem);
+			parent.appendChild(sentenceElem);
 			++sentencenum;
 			sentenceElem = doc.createElement("SENTENCE");
 			sentenceComment = doc.createComment(QString("Track %1, Sentence %2").arg(tracknum).arg(sentencenum));
@@ -100,17 +115,7 @@ void SingStarXMLWriter::writeXML() {
 			ts += pauseLen;
 		}
 	}
-	root.appendChild(sentenceElem);
-
-	// Get the xml data
-	QString xml = doc.toString(4);
-	// Write to file
-	QFile f(path + "/notes.xml");
-	if (f.open(QFile::WriteOnly)) {
-		QTextStream out(&f);
-		out.setCodec("UTF-8");
-		out << xml;
-	} else throw std::runtime_error("Couldn't open target file notes.xml");
+	parent.appendChild(sentenceElem);
 }
 
 int SingStarXMLWriter::sec2dur(double sec) const {
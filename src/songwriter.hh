@@ -1,6 +1,10 @@
 #include "song.hh"
 #include <QDir>
 #include <fstream>
+#include <vector>
+
+class QDomDocument;
+class QDomElement;
 
 struct SongWriter
 {
@@ -8,6 +12,17 @@ struct SongWriter
 		: s(s_), path(path_) { QDir dir; dir.mkpath(path_); }
 	const Song& s;
 	QString path;
+protected:
+	/// The vocal tracks to write (those with notes, the lead vocals first), at least one
+	static std::vector<QString> vocalTracks(const Song& song) {
+		VocalTracks const& tracks = song.getVocalTracks();
+		std::vector<QString> names = song.getVocalTrackNames(), result;
+		for (std::size_t i = 0; i < names.size(); ++i) {
+			if (!tracks.find(names[i])->second.notes.empty()) result.push_back(names[i]);
+		}
+		if (result.empty()) result.push_back(TrackName::LEAD_VOCAL);
+		return result;
+	}
 };
 
 struct SingStarXMLWriter: public SongWriter
@@ -16,6 +31,7 @@ struct SingStarXMLWriter: public SongWriter
 		: SongWriter(s_, path_), tempo(s_.bpm > 0 ? s_.bpm : 180), res("Semiquaver") { writeXML(); }
 private:
 	void writeXML();
+	void writeSentences(QDomDocument& doc, QDomElement& parent, Notes const& notes, int tracknum);
 	int sec2dur(double sec) const;
 	double dur2sec(int ts) const;
 	int tempo;
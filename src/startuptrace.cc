@@ -0,0 +1,18 @@
+#include "startuptrace.hh"
+#include <QElapsedTimer>
+#include <iostream>
+
+namespace {
+	QElapsedTimer s_timer;
+	bool s_enabled = false;
+}
+
+void StartupTrace::start() { s_timer.start(); }
+
+void StartupTrace::setEnabled(bool enabled) { s_enabled = enabled; }
+
+void StartupTrace::mark(char const* point)
+{
+	if (!s_enabled || !s_timer.isValid()) return;
+	std::cerr << "startup: " << point << " " << s_timer.elapsed() << " ms" << std::endl;
+}
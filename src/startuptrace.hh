@@ -0,0 +1,11 @@
+#pragma once
+
+/// Startup timing, printed with --trace-startup
+/** Times are measured from start(), which main calls before anything else. **/
+namespace StartupTrace {
+	/// Start the clock (printing stays off until enabled)
+	void start();
+	void setEnabled(bool enabled);
+	/// Print the time elapsed until the named point of startup
+	void mark(char const* point);
+}
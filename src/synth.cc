@@ -2,9 +2,11 @@
 #include <fstream>
 #include <string>
 #include <cmath>
-#include <QDebug>
+#include <vector>
 #include <QElapsedTimer>
 #include "synth.hh"
+#include "loudness.hh"
+#include "util.hh"
 
 #ifndef M_PI
 	#define M_PI 3.141592653589793
@@ -56,6 +58,41 @@ void Synth::createBuffer(QByteArray &buffer, int note, double length) {
 	//of.write(buf.data(), buf.size());
 }
 
+namespace {
+	struct BeepLevels {
+		double loudness;  ///< LUFS
+		double truePeak;  ///< dBTP
+		BeepLevels(): loudness(getNaN()), truePeak(getNaN()) {}
+	};
+
+	BeepLevels const& beepLevels() {
+		static BeepLevels s_levels;
+		if (s_levels.loudness != s_levels.loudness) {
+			// Measure a short beep of every note once, in both channels as the mixer plays it
+			LoudnessMeter meter(Synth::SampleRate, 2);
+			for (int note = 0; note < 12; ++note) {
+				QByteArray buffer;
+				Synth::createBuffer(buffer, note, 0.5);
+				qint16 const* samples = reinterpret_cast<qint16 const*>(buffer.constData());
+				std::vector<float> data(2 * (buffer.size() / 2));  // Interleaved stereo frames
+				for (std::size_t i = 0; i < data.size(); i += 2) data[i] = data[i + 1] = samples[i / 2] / 32768.0f;
+				meter.process(&data[0], &data[0] + data.size());
+			}
+			s_levels.loudness = meter.integrated();
+			s_levels.truePeak = meter.truePeak();
+		}
+		return s_levels;
+	}
+}
+
+double Synth::loudness() {
+	return beepLevels().loudness;
+}
+
+double Synth::truePeak() {
+	return beepLevels().truePeak;
+}
+
 void Synth::run() {
 	calcNext();
 	while (!m_quit) {
@@ -127,70 +164,3 @@ std::string Synth::writeWavHeader(unsigned bits, unsigned ch, unsigned sr, unsig
 	{ int   tmp = datasize; out.write((char*)(&tmp),4); }
 	return out.str();
 }
-
-
-
-// BufferPlayer
-
-BufferPlayer::BufferPlayer(QObject *parent)
-: QObject(parent)
-{
-	m_buffer = new QBuffer(this);
-
-	QAudioFormat format;
-	format.setChannelCount(1);
-	format.setSampleRate(Synth::SampleRate);
-	format.setSampleSize(16);
-	format.setSampleType(QAudioFormat::SignedInt);
-	format.setByteOrder(QAudioFormat::LittleEndian);
-	format.setCodec("audio/pcm");
-
-	QAudioDeviceInfo info(QAudioDeviceInfo::defaultOutputDevice());
-	if (!info.isFormatSupported(format)) {
-		qWarning() << "Synth output format not supported, trying nearest";
-		format = info.nearestFormat(format);
-	}
-	m_player = new QAudioOutput(format, this);
-	m_player->setVolume(1.0f);
-	//m_player->setNotifyInterval(100);
-	//connect(m_player, SIGNAL(notify()), this, SLOT(debugDumpStats()));
-	connect(m_player, SIGNAL(stateChanged(QAudio::State)), this, SLOT(handleStateChanged(QAudio::State)));
-}
-
-bool BufferPlayer::play(const QByteArray& ba)
-{
-	if (m_player->state() != QAudio::ActiveState) {
-		m_player->stop();
-		m_buffer->close();
-		m_buffer->setData(ba);
-		m_buffer->open(QIODevice::ReadOnly);
-		m_player->setBufferSize(ba.size());
-		m_player->start(m_buffer);
-		return true;
-	}
-	return false;
-}
-
-void BufferPlayer::handleStateChanged(QAudio::State newState)
-{
-	//qDebug() << "Synth" << newState;
-	switch (newState) {
-	case QAudio::IdleState: // Finished playing (no more data)
-		m_player->stop();
-		break;
-	case QAudio::StoppedState: // Stopped for other reasons
-		if (m_player->error() != QAudio::NoError) {
-			qWarning() << "Synth audio error code " << m_player->error();
-		}
-		break;
-	default:
-		break;
-	}
-}
-
-void BufferPlayer::debugDumpStats()
-{
-	qWarning() << "bytesFree =" << m_player->bytesFree()
-		<< "- elapsedUSecs =" << m_player->elapsedUSecs()
-		<< "- processedUSecs =" << m_player->processedUSecs();
-}
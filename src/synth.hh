@@ -3,10 +3,7 @@
 #include <QThread>
 #include <QMutex>
 #include <QWaitCondition>
-#include <QBuffer>
 #include <QFile>
-#include <QAudioOutput>
-#include <QAudioFormat>
 #include "notes.hh"
 
 
@@ -44,6 +41,10 @@ public:
 	void stop();
 	/// Creates the sound
 	static void createBuffer(QByteArray &buffer, int note, double length);
+	/// Integrated loudness of the created sounds in LUFS, measured in stereo as they are mixed
+	static double loudness();
+	/// True peak of the created sounds in dBTP
+	static double truePeak();
 
 signals:
 	void playBuffer(const QByteArray&);
@@ -68,27 +69,3 @@ private:
 	QMutex m_mutex; ///< Mutex for protecting resource access
 	QWaitCondition m_condition; ///< For signaling the thread
 };
-
-
-/**
- * @brief Class for playing a WAV buffer from memory.
- *
- * Designed to be reused, but won't play the buffer if the previous hasn't finished.
- */
-class BufferPlayer: public QObject
-{
-	Q_OBJECT
-	Q_DISABLE_COPY(BufferPlayer)
-public:
-	BufferPlayer(QObject *parent);
-
-	bool play(const QByteArray& ba);
-
-public slots:
-	void handleStateChanged(QAudio::State newState);
-	void debugDumpStats();
-
-private:
-	QBuffer *m_buffer;
-	QAudioOutput *m_player;
-};
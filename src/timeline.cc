@@ -0,0 +1,244 @@
+#include "timeline.hh"
+#include "ffmpeg.hh"
+#include <QByteArray>
+#include <QDataStream>
+#include <QSaveFile>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+	static const unsigned long long silenceFrames = 4096;  ///< Block size for the silence between segments
+	static const unsigned long long endless = std::numeric_limits<unsigned long long>::max();
+
+	std::string localFile(QString const& fileName) {
+		QByteArray name = fileName.toLocal8Bit();
+		return std::string(name.data(), name.size());
+	}
+
+	unsigned long long toFrames(double seconds, unsigned rate) {
+		return seconds > 0.0 ? static_cast<unsigned long long>(seconds * rate + 0.5) : 0;
+	}
+
+	/// Copy frames converting the number of channels (extra channels are averaged, missing ones repeated)
+	void remix(da::sample_t const* in, unsigned inCh, da::sample_t* out, unsigned outCh, unsigned long long frames) {
+		if (inCh == outCh) { std::copy(in, in + frames * inCh, out); return; }
+		for (unsigned long long f = 0; f < frames; ++f, in += inCh, out += outCh) {
+			for (unsigned c = 0; c < outCh; ++c) {
+				if (inCh < outCh) { out[c] = in[c % inCh]; continue; }
+				da::sample_t sum = 0.0f;
+				unsigned count = 0;
+				for (unsigned k = c; k < inCh; k += outCh, ++count) sum += in[k];
+				out[c] = sum / count;
+			}
+		}
+	}
+
+	/// Header of a 16 bit PCM WAV file
+	QByteArray wavHeader(unsigned channels, unsigned rate, unsigned long long frames) {
+		QByteArray header;
+		QDataStream ds(&header, QIODevice::WriteOnly);
+		ds.setByteOrder(QDataStream::LittleEndian);
+		quint32 dataSize = frames * channels * 2;
+		ds.writeRawData("RIFF", 4);
+		ds << quint32(36 + dataSize);
+		ds.writeRawData("WAVEfmt ", 8);
+		ds << quint32(16) << quint16(1) << quint16(channels) << quint32(rate) << quint32(rate * channels * 2) << quint16(channels * 2) << quint16(16);
+		ds.writeRawData("data", 4);
+		ds << dataSize;
+		return header;
+	}
+}
+
+/// Decoder of a single segment with its trimmed beginning removed
+class Timeline::Source {
+public:
+	/// @param from seconds into the segment where the output begins
+	Source(TimelineSegment const& segment, double from = 0.0):
+	  m_mpeg(localFile(segment.fileName)),
+	  m_skip(from > 0.0 ? 0 : toFrames(segment.trimBegin, rate()) * channels())
+	{
+		// Skipping block by block is only fast enough for the trimmed beginning
+		if (from > 0.0) m_mpeg.seek(segment.trimBegin + from);
+	}
+	unsigned rate() { return m_mpeg.audioQueue.getRate(); }
+	unsigned channels() { return m_mpeg.audioQueue.getChannels(); }
+	std::string metadata(std::string const& key) const { return m_mpeg.metadata(key); }
+	void abort() { m_mpeg.audioQueue.setEof(); }
+	/// Skip one block of the trimmed beginning, returns true once everything has been skipped
+	bool skip() {
+		if (m_skip == 0) return true;
+		m_pending.clear();
+		if (!m_mpeg.audioQueue.output(m_pending)) { m_skip = 0; return true; }
+		std::size_t count = std::min<unsigned long long>(m_skip, m_pending.size());
+		m_pending.erase(m_pending.begin(), m_pending.begin() + count);
+		m_skip -= count;
+		return m_skip == 0;
+	}
+	/// Append decoded samples to out, returns false at the end of the file
+	bool output(std::vector<da::sample_t>& out) {
+		while (!skip()) {}
+		if (m_pending.empty()) return m_mpeg.audioQueue.output(out);
+		out.insert(out.end(), m_pending.begin(), m_pending.end());
+		m_pending.clear();
+		return true;
+	}
+private:
+	FFmpeg m_mpeg;
+	std::vector<da::sample_t> m_pending;  ///< Samples left over from skipping
+	unsigned long long m_skip;  ///< Samples still to be skipped
+};
+
+Timeline::Timeline(Segments const& segments): m_segments(segments)
+{
+	init();
+}
+
+Timeline::Timeline(QString const& fileName): m_segments(1, TimelineSegment(fileName))
+{
+	init();
+}
+
+Timeline::~Timeline() {}
+
+void Timeline::init()
+{
+	if (m_segments.empty()) throw std::logic_error("Timeline without segments");
+	m_current = 0;
+	m_rate = m_channels = 0;
+	m_duration = 0.0;
+	m_position = 0;
+	m_aborted = false;
+	// All files are probed up front so that problems come up before anything is output
+	// and so that the file durations are known for the duration estimate (only the headers
+	// are read, the decoders are started when the segments are reached)
+	double begin = 0.0, end = 0.0;
+	for (std::size_t i = 0; i < m_segments.size(); ++i) {
+		TimelineSegment const& s = m_segments[i];
+		FFmpeg::Format format = FFmpeg::probe(localFile(s.fileName));
+		if (format.channels == 0) throw std::runtime_error("No audio channels found in " + s.fileName.toStdString());
+		if (i == 0) { m_rate = format.rate; m_channels = format.channels; }
+		else if (format.rate != m_rate) throw std::runtime_error("All music files on the timeline must have the same sample rate");
+		begin = (s.offset == s.offset ? std::max(begin, s.offset) : end);
+		end = begin + std::max(0.0, std::min(s.length, format.duration - s.trimBegin));
+		m_begins.push_back(begin);
+		m_ends.push_back(end);
+	}
+	m_duration = end;
+	setSource(new Source(m_segments[0]));
+	place();
+}
+
+/// Replace the source being read (NULL for the end), not if aborted
+void Timeline::setSource(Source* source)
+{
+	QScopedPointer<Source> s(source);
+	QMutexLocker locker(&m_mutex);
+	if (m_aborted) s.reset();
+	m_source.swap(s);
+}
+
+/// Find the frame range of the current segment
+/// @param skipped frames of the segment already passed (when seeking into it)
+void Timeline::place(unsigned long long skipped)
+{
+	TimelineSegment const& s = m_segments[m_current];
+	m_begin = m_position;
+	if (s.offset == s.offset) m_begin = std::max(m_begin, toFrames(s.offset, m_rate));
+	m_end = (s.length < getInf() ? m_begin - skipped + toFrames(s.length, m_rate) : endless);
+	// A following segment at a fixed offset cuts this one short
+	if (m_current + 1 < m_segments.size()) {
+		double offset = m_segments[m_current + 1].offset;
+		if (offset == offset) m_end = std::min(m_end, std::max(m_begin, toFrames(offset, m_rate)));
+	}
+}
+
+void Timeline::prefetch()
+{
+	if (m_current + 1 >= m_segments.size()) return;
+	// Start decoding the next segment and skip its trimmed beginning block by block,
+	// so that it is ready to continue the output without any delay
+	if (!m_next) m_next.reset(new Source(m_segments[m_current + 1]));
+	else m_next->skip();
+}
+
+void Timeline::nextSegment()
+{
+	if (++m_current >= m_segments.size()) { setSource(NULL); return; }
+	setSource(m_next ? m_next.take() : new Source(m_segments[m_current]));
+	place();
+}
+
+std::string Timeline::metadata(std::string const& key) const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_source ? m_source->metadata(key) : std::string();
+}
+
+bool Timeline::output(std::vector<da::sample_t>& out)
+{
+	while (m_source) {
+		// Silence before the segment begins
+		if (m_position < m_begin) {
+			unsigned long long frames = std::min(m_begin - m_position, silenceFrames);
+			out.resize(out.size() + frames * m_channels, 0.0f);
+			m_position += frames;
+			return true;
+		}
+		m_buffer.clear();
+		if (m_position >= m_end || !m_source->output(m_buffer)) { nextSegment(); continue; }
+		unsigned channels = m_source->channels();
+		unsigned long long frames = std::min<unsigned long long>(m_buffer.size() / channels, m_end - m_position);
+		std::size_t pos = out.size();
+		out.resize(pos + frames * m_channels);
+		remix(&m_buffer[0], channels, &out[pos], m_channels, frames);
+		m_position += frames;
+		prefetch();
+		return true;
+	}
+	return false;
+}
+
+void Timeline::seek(double time)
+{
+	time = std::max(0.0, time);
+	// The first segment that has not ended by then (the time may also be in the silence before it)
+	std::size_t i = 0;
+	while (i + 1 < m_segments.size() && m_ends[i] <= time) ++i;
+	double into = std::max(0.0, time - m_begins[i]);
+	m_next.reset();
+	m_current = i;
+	m_position = toFrames(time, m_rate);
+	setSource(new Source(m_segments[i], into));
+	place(toFrames(into, m_rate));
+}
+
+void Timeline::abort()
+{
+	QMutexLocker locker(&m_mutex);
+	m_aborted = true;
+	if (m_source) m_source->abort();
+}
+
+bool Timeline::writeWav(QString const& fileName, Progress& progress)
+{
+	QSaveFile file(fileName);
+	if (!file.open(QIODevice::WriteOnly)) throw std::runtime_error("Cannot write " + fileName.toStdString());
+	file.write(wavHeader(m_channels, m_rate, 0));  // Rewritten with the correct size at the end
+	unsigned long long frames = 0;
+	std::vector<da::sample_t> data;
+	std::vector<qint16> pcm;
+	while (output(data)) {
+		if (!progress.update(double(frames) / m_rate, m_duration)) return false;  // Discarded without commit
+		pcm.resize(data.size());
+		for (std::size_t i = 0; i < data.size(); ++i) pcm[i] = qRound(clamp(data[i], -1.0f, 1.0f) * 32767.0f);
+		file.write(reinterpret_cast<char const*>(&pcm[0]), pcm.size() * sizeof(qint16));
+		frames += data.size() / m_channels;
+		data.clear();
+	}
+	file.seek(0);
+	file.write(wavHeader(m_channels, m_rate, frames));
+	if (!file.commit()) throw std::runtime_error("Cannot write " + fileName.toStdString());
+	return true;
+}
+
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "util.hh"
+#include "libda/sample.hpp"
+#include <QMutex>
+#include <QString>
+#include <QScopedPointer>
+#include <string>
+#include <vector>
+
+class FFmpeg;
+
+/// A part of a music file placed on a timeline
+struct TimelineSegment {
+	QString fileName;
+	double offset;  ///< Timeline time where the segment begins (NaN to continue right after the previous segment)
+	double trimBegin;  ///< Seconds skipped from the beginning of the file
+	double length;  ///< Seconds used from the file (infinite for the rest of the file)
+	TimelineSegment(QString const& file = QString(), double offset_ = getNaN(), double trimBegin_ = 0.0, double length_ = getInf()):
+	  fileName(file), offset(offset_), trimBegin(trimBegin_), length(length_) {}
+};
+
+/// Several music files decoded into a single sample-accurate stream
+/** All positions are counted in samples rather than taken from the decoder timestamps,
+  * so consecutive segments follow each other without gaps or overlap. A segment that
+  * begins before the previous one ends cuts the previous one short and a segment that
+  * begins later leaves silence in between. The decoder of the next segment is started
+  * (and its trimmed beginning skipped) while the current one is still being read.
+  * Seeking places the segments by the durations probed from the files.
+ */
+class Timeline {
+public:
+	typedef std::vector<TimelineSegment> Segments;
+
+	/// Progress reporting and cancellation of writeWav()
+	class Progress {
+	public:
+		virtual ~Progress() {}
+		/// Called regularly while writing, return false to stop
+		virtual bool update(double position, double duration) = 0;
+	};
+
+	/// Checks all the files and starts decoding the first one (throws if any cannot be used)
+	Timeline(Segments const& segments);
+	/// A timeline of a single whole file
+	Timeline(QString const& fileName);
+	~Timeline();
+
+	unsigned getRate() const { return m_rate; }
+	unsigned getChannels() const { return m_channels; }
+	/// Duration estimate in seconds
+	double duration() const { return m_duration; }
+	/// Tag of the segment being read (e.g. "title" or "artist"), empty if not available, may be called from any thread
+	std::string metadata(std::string const& key) const;
+	/// Append the next block of interleaved samples to out, returns false at the end of the timeline
+	bool output(std::vector<da::sample_t>& out);
+	/// Continue the output from the given time (in the thread that calls output)
+	void seek(double time);
+	/// End the output, may be called from any thread (wakes up output() waiting for the decoder)
+	void abort();
+	/// Decode the whole timeline into a 16 bit WAV file (throws on errors)
+	/// @return false if stopped by the progress (nothing is written then)
+	bool writeWav(QString const& fileName, Progress& progress);
+
+private:
+	class Source;
+	void init();
+	void setSource(Source* source);
+	void place(unsigned long long skipped = 0);
+	void prefetch();
+	void nextSegment();
+	Segments m_segments;
+	std::vector<double> m_begins, m_ends;  ///< Estimated times of the segments (from the probed durations)
+	std::size_t m_current;  ///< Index of the segment being read
+	QScopedPointer<Source> m_source, m_next;
+	unsigned m_rate, m_channels;
+	double m_duration;
+	unsigned long long m_position;  ///< Timeline position in sample frames
+	unsigned long long m_begin, m_end;  ///< Frame range of the current segment
+	std::vector<da::sample_t> m_buffer;
+	mutable QMutex m_mutex;  ///< For m_source and m_aborted (used by abort and metadata from other threads)
+	bool m_aborted;
+};
+
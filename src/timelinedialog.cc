@@ -0,0 +1,148 @@
+#include "timelinedialog.hh"
+#include <QDialogButtonBox>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QLocale>
+#include <QMessageBox>
+#include <QPushButton>
+#include <QTableWidget>
+#include <QVBoxLayout>
+#include <stdexcept>
+
+namespace {
+	enum Column { COL_FILE, COL_OFFSET, COL_TRIM, COL_LENGTH, COLUMNS };
+}
+
+MusicTimelineDialog::MusicTimelineDialog(QString const& path, QWidget *parent)
+	: QDialog(parent), m_table(new QTableWidget(0, COLUMNS, this)), m_path(path)
+{
+	setWindowTitle(tr("Music timeline"));
+	QStringList headers;
+	headers << tr("File") << tr("Begins at (s)") << tr("Skip from start (s)") << tr("Length (s)");
+	m_table->setHorizontalHeaderLabels(headers);
+	m_table->horizontalHeader()->setSectionResizeMode(COL_FILE, QHeaderView::Stretch);
+	m_table->setSelectionBehavior(QAbstractItemView::SelectRows);
+	m_table->setSelectionMode(QAbstractItemView::SingleSelection);
+	m_table->setWhatsThis(tr("The music files are played one after another in this order. "
+		"A file with an empty begin time follows the previous one right away, one with a time "
+		"begins exactly then, cutting the previous one short or leaving silence before it. "
+		"An empty length uses the rest of the file."));
+
+	QPushButton *add = new QPushButton(tr("&Add files..."), this);
+	QPushButton *remove = new QPushButton(tr("&Remove"), this);
+	QPushButton *up = new QPushButton(tr("Move &up"), this);
+	QPushButton *down = new QPushButton(tr("Move &down"), this);
+	connect(add, SIGNAL(clicked()), this, SLOT(addFiles()));
+	connect(remove, SIGNAL(clicked()), this, SLOT(removeSegment()));
+	connect(up, SIGNAL(clicked()), this, SLOT(moveUp()));
+	connect(down, SIGNAL(clicked()), this, SLOT(moveDown()));
+	QHBoxLayout *rowButtons = new QHBoxLayout;
+	rowButtons->addWidget(add);
+	rowButtons->addWidget(remove);
+	rowButtons->addWidget(up);
+	rowButtons->addWidget(down);
+	rowButtons->addStretch();
+
+	QDialogButtonBox *buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, Qt::Horizontal, this);
+	connect(buttons, SIGNAL(accepted()), this, SLOT(accept()));
+	connect(buttons, SIGNAL(rejected()), this, SLOT(reject()));
+
+	QVBoxLayout *vb = new QVBoxLayout(this);
+	vb->addWidget(m_table);
+	vb->addLayout(rowButtons);
+	vb->addWidget(buttons);
+	setLayout(vb);
+	resize(700, 300);
+}
+
+Timeline::Segments MusicTimelineDialog::segments() const
+{
+	Timeline::Segments result;
+	for (int row = 0; row < m_table->rowCount(); ++row) {
+		QString fileName = m_table->item(row, COL_FILE)->data(Qt::UserRole).toString();
+		double length = seconds(row, COL_LENGTH, getInf());
+		if (length == 0.0) throw std::runtime_error(tr("Row %1: the length must be more than zero.").arg(row + 1).toStdString());
+		result.push_back(TimelineSegment(fileName, seconds(row, COL_OFFSET, getNaN()), seconds(row, COL_TRIM, 0.0), length));
+	}
+	return result;
+}
+
+/// Seconds in a cell, the given value if it is empty
+double MusicTimelineDialog::seconds(int row, int column, double empty) const
+{
+	QTableWidgetItem *item = m_table->item(row, column);
+	QString text = item ? item->text().trimmed() : QString();
+	if (text.isEmpty()) return empty;
+	bool ok = false;
+	double value = text.toDouble(&ok);
+	if (!ok) value = QLocale().toDouble(text, &ok);  // Decimal comma
+	if (!ok || value < 0.0 || value != value || value == getInf())
+		throw std::runtime_error(tr("Row %1: \"%2\" is not a time in seconds.").arg(row + 1).arg(text).toStdString());
+	return value;
+}
+
+void MusicTimelineDialog::accept()
+{
+	try {
+		if (m_table->rowCount() == 0) throw std::runtime_error(tr("Add the music files to join.").toStdString());
+		segments();
+	} catch (std::exception& e) {
+		QMessageBox::warning(this, tr("Music timeline"), e.what());
+		return;
+	}
+	QDialog::accept();
+}
+
+void MusicTimelineDialog::addFiles()
+{
+	QStringList fileNames = QFileDialog::getOpenFileNames(this, tr("Music files to join"),
+			m_path,
+			tr("Music files") + " (*.mp3 *.ogg *.wav *.wma *.flac)");
+	if (fileNames.isEmpty()) return;
+	m_path = QFileInfo(fileNames.front()).path();
+	for (int i = 0; i < fileNames.size(); ++i) addRow(fileNames[i]);
+}
+
+void MusicTimelineDialog::addRow(QString const& fileName)
+{
+	int row = m_table->rowCount();
+	m_table->insertRow(row);
+	QTableWidgetItem *file = new QTableWidgetItem(QFileInfo(fileName).fileName());
+	file->setData(Qt::UserRole, fileName);
+	file->setToolTip(fileName);
+	file->setFlags(file->flags() & ~Qt::ItemIsEditable);
+	m_table->setItem(row, COL_FILE, file);
+	for (int column = COL_OFFSET; column < COLUMNS; ++column) m_table->setItem(row, column, new QTableWidgetItem);
+}
+
+void MusicTimelineDialog::removeSegment()
+{
+	int row = m_table->currentRow();
+	if (row >= 0) m_table->removeRow(row);
+}
+
+void MusicTimelineDialog::moveUp()
+{
+	int row = m_table->currentRow();
+	if (row > 0) swapRows(row, row - 1);
+}
+
+void MusicTimelineDialog::moveDown()
+{
+	int row = m_table->currentRow();
+	if (row >= 0 && row + 1 < m_table->rowCount()) swapRows(row, row + 1);
+}
+
+/// Exchange the contents of two rows, the second one becomes current
+void MusicTimelineDialog::swapRows(int a, int b)
+{
+	for (int column = 0; column < COLUMNS; ++column) {
+		QTableWidgetItem *itemA = m_table->takeItem(a, column);
+		QTableWidgetItem *itemB = m_table->takeItem(b, column);
+		m_table->setItem(a, column, itemB);
+		m_table->setItem(b, column, itemA);
+	}
+	m_table->setCurrentCell(b, m_table->currentColumn());
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "timeline.hh"
+#include <QDialog>
+#include <QString>
+
+class QTableWidget;
+
+/// Editor of the music files joined into a medley (see Timeline)
+/** Each row is a segment: where it begins on the timeline (empty to follow the previous one),
+  * how much of the beginning of the file is skipped and how much of it is used (empty for the
+  * rest of the file). The rows are played in their order.
+ */
+class MusicTimelineDialog: public QDialog
+{
+	Q_OBJECT
+public:
+	/// @param path directory where the file selection begins
+	MusicTimelineDialog(QString const& path, QWidget *parent = NULL);
+	/// The segments of the rows, throws std::runtime_error if a value is not a valid time
+	Timeline::Segments segments() const;
+	/// Directory of the files added last
+	QString path() const { return m_path; }
+
+public slots:
+	void accept();
+	void addFiles();
+	void removeSegment();
+	void moveUp();
+	void moveDown();
+
+private:
+	void addRow(QString const& fileName);
+	void swapRows(int a, int b);
+	double seconds(int row, int column, double empty) const;
+	QTableWidget *m_table;
+	QString m_path;
+};
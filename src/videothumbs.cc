@@ -0,0 +1,85 @@
+#include "videothumbs.hh"
+#include "ffmpeg.hh"
+#include <QElapsedTimer>
+#include <iostream>
+#include <stdexcept>
+
+/*static*/ QMutex VideoThumbnails::s_cacheMutex;
+/*static*/ QCache<QString, QImage> VideoThumbnails::s_tiles(64 * 1024);  // 64 MB
+/*static*/ QHash<QString, std::vector<double> > VideoThumbnails::s_index;
+
+VideoThumbnails::VideoThumbnails(QString const& filename, double videoGap, QObject *parent)
+	: QThread(parent), m_fileName(filename), m_videoGap(videoGap), m_quit()
+{
+	start(QThread::LowPriority); // Launch the thread
+}
+
+void VideoThumbnails::stop()
+{
+	QMutexLocker locker(&m_mutex);
+	m_quit = true;
+}
+
+std::vector<double> VideoThumbnails::times() const
+{
+	std::vector<double> result;
+	{
+		QMutexLocker locker(&m_mutex);
+		result = m_times;
+	}
+	for (std::size_t i = 0; i < result.size(); ++i) result[i] -= m_videoGap;
+	return result;
+}
+
+QImage VideoThumbnails::thumbnail(double time) const
+{
+	QMutexLocker locker(&s_cacheMutex);
+	QImage* image = s_tiles.object(key(time + m_videoGap));
+	return image ? *image : QImage();
+}
+
+bool VideoThumbnails::fromCache()
+{
+	QMutexLocker locker(&s_cacheMutex);
+	QHash<QString, std::vector<double> >::const_iterator it = s_index.find(m_fileName);
+	if (it == s_index.end()) return false;
+	// Some tiles may have been dropped from the cache to make room for other videos
+	for (std::size_t i = 0; i < it->size(); ++i) if (!s_tiles.contains(key((*it)[i]))) return false;
+	QMutexLocker locker2(&m_mutex);
+	m_times = *it;
+	return true;
+}
+
+void VideoThumbnails::run()
+{
+	try {
+		if (!fromCache()) {
+			std::string file(m_fileName.toLocal8Bit().data(), m_fileName.toLocal8Bit().size());
+			VideoKeyframes video(file, Height);
+			QElapsedTimer timer;
+			timer.start();
+			std::vector<double> times;
+			while (video.next()) {
+				QImage image(reinterpret_cast<uchar const*>(&video.data()[0]), video.width(), video.height(), QImage::Format_RGB32);
+				{
+					QMutexLocker locker(&s_cacheMutex);
+					s_tiles.insert(key(video.time()), new QImage(image.copy()), image.byteCount() / 1024);
+				}
+				times.push_back(video.time());
+				{
+					QMutexLocker locker(&m_mutex);
+					if (m_quit) return;
+					m_times.push_back(video.time());
+				}
+				// Do not flood the GUI with repaints
+				if (timer.elapsed() > 500) { emit updated(); timer.restart(); }
+			}
+			QMutexLocker locker(&s_cacheMutex);
+			s_index.insert(m_fileName, times);
+		}
+	} catch (std::exception& e) {
+		std::cerr << std::string("Error loading video: ") + e.what() + '\n' << std::flush;
+	}
+	emit updated();
+}
+
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QThread>
+#include <QMutex>
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <vector>
+
+/// Thumbnails of a music video's keyframes, decoded in background
+/** Thumbnails are stored in a tile cache shared by all instances and keyed by the file
+  * and the keyframe time, so reopening the same video does not decode anything.
+  * All times in the public interface are song times (videoGap applied).
+ */
+class VideoThumbnails: public QThread
+{
+	Q_OBJECT
+public:
+	static const int Height = 54;  ///< Thumbnail height in pixels
+
+	VideoThumbnails(QString const& filename, double videoGap, QObject *parent = NULL);
+	~VideoThumbnails() { stop(); wait(); }
+
+	void stop();
+	/// Song times of the keyframes found so far
+	std::vector<double> times() const;
+	/// Get the thumbnail of the keyframe at the given song time (null if not available)
+	QImage thumbnail(double time) const;
+
+signals:
+	void updated();  ///< More thumbnails available
+
+protected:
+	void run(); // Thread runs here
+
+private:
+	QString key(double videoTime) const { return m_fileName + '@' + QString::number(qRound64(videoTime * 1000.0)); }
+	bool fromCache();
+
+	mutable QMutex m_mutex;
+	QString m_fileName;
+	double m_videoGap;  ///< Video time = song time + videoGap
+	std::vector<double> m_times;  ///< Video times of the keyframes
+	bool m_quit;
+
+	static QMutex s_cacheMutex;
+	static QCache<QString, QImage> s_tiles;  ///< Thumbnails of all videos, cost in kilobytes
+	static QHash<QString, std::vector<double> > s_index;  ///< Keyframe times of fully scanned videos
+};
+
@@ -0,0 +1,104 @@
+#include "analysis.hh"
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+/// Round trip of the analysis cache format
+/** Pitch paths are delta encoded (zigzag varints), so a broken encoder corrupts the cache
+  * without any visible error. Paths with the extremes of the point format (tones below
+  * note 0, the largest jumps, the loudest and quietest levels) and random walks are written
+  * and read back, and every point must come back as it was. Truncated data must be rejected.
+  * Exits with failure if anything differs.
+ */
+
+namespace {
+	static const float hopTime = 512.0f / 44100.0f;
+	static const unsigned randomPaths = 200;
+
+	bool check(bool ok, char const* what) {
+		std::cout << (ok ? "ok      " : "FAILED  ") << what << std::endl;
+		return ok;
+	}
+
+	/// Deterministic pseudo-random numbers in [0, 1)
+	double random(unsigned& seed) {
+		seed = seed * 1103515245 + 12345;
+		return ((seed >> 8) & 0xFFFF) / 65536.0;
+	}
+
+	PitchAnalysis sample() {
+		PitchAnalysis a;
+		a.hopTime = hopTime;
+		a.duration = 123.25;
+		a.loudness = -14.5f;
+		a.loudnessRange = 6.25f;
+		a.truePeak = -0.75f;
+		for (unsigned i = 0; i < 5000; ++i) a.voicing.push_back((i % 256) / 255.0f);
+		// The extremes, with jumps between them
+		PitchPath extremes(1, 0, hopTime);
+		float const notes[] = { -327.68f, 327.67f, -327.68f, 0.0f, -0.01f, -5.5f, 24.0f, 327.67f };
+		float const levels[] = { -128.0f, 127.0f, -128.0f, 0.0f, -1.0f, -60.0f, -3.0f, 127.0f };
+		for (unsigned i = 0; i < sizeof(notes) / sizeof(*notes); ++i) extremes.push_back(notes[i], levels[i]);
+		a.paths.push_back(extremes);
+		// Random walks like sung notes, some of them below note 0 (the analyzer goes down to 45 Hz)
+		unsigned seed = 1;
+		for (unsigned p = 0; p < randomPaths; ++p) {
+			PitchPath path(p % 2, 100000 * random(seed), hopTime);
+			float note = 60.0f * random(seed) - 10.0f, level = -40.0f * random(seed);
+			for (unsigned i = 0, n = 1 + 300 * random(seed); i < n; ++i) {
+				note += 0.4f * (random(seed) - 0.5f);
+				level += 2.0f * (random(seed) - 0.5f);
+				path.push_back(note, level);
+			}
+			a.paths.push_back(path);
+		}
+		return a;
+	}
+
+	bool samePaths(PitchAnalysis const& a, PitchAnalysis const& b) {
+		if (a.paths.size() != b.paths.size()) return false;
+		for (std::size_t p = 0; p < a.paths.size(); ++p) {
+			PitchPath const& pa = a.paths[p];
+			PitchPath const& pb = b.paths[p];
+			if (pa.channel != pb.channel || pa.beginHop() != pb.beginHop() || pa.size() != pb.size()) return false;
+			for (unsigned i = 0; i < pa.size(); ++i) {
+				if (pa[i].note != pb[i].note || pa[i].level != pb[i].level || pa[i].time != pb[i].time) return false;
+			}
+		}
+		return true;
+	}
+}
+
+int main()
+{
+	bool passed = true;
+	try {
+		PitchAnalysis original = sample();
+		std::ostringstream os(std::ios::binary);
+		original.write(os);
+		std::string data = os.str();
+		std::istringstream is(data, std::ios::binary);
+		PitchAnalysis copy;
+		copy.read(is);
+		std::cout << original.paths.size() << " paths in " << data.size() << " bytes" << std::endl;
+		passed &= check(copy.hopTime == original.hopTime && copy.duration == original.duration && copy.loudness == original.loudness
+		  && copy.loudnessRange == original.loudnessRange && copy.truePeak == original.truePeak, "Header values");
+		passed &= check(copy.voicing == original.voicing, "Voicing");
+		passed &= check(samePaths(original, copy), "Pitch paths");
+		PitchPath const& extremes = copy.paths.front();
+		passed &= check(std::abs(extremes[0].note + 327.68f) < 1e-3f && std::abs(extremes[5].note + 5.5f) < 1e-3f,
+		  "Tones below note 0 kept");
+		// Cut in the middle of the paths
+		std::istringstream truncated(data.substr(0, data.size() / 2), std::ios::binary);
+		bool rejected = false;
+		try { PitchAnalysis().read(truncated); } catch (std::runtime_error&) { rejected = true; }
+		passed &= check(rejected, "Truncated data rejected");
+	} catch (std::exception& e) {
+		std::cerr << "Check failed: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
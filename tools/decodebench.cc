@@ -0,0 +1,239 @@
+#include "config.hh"
+#include "ffmpeg.hh"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define INT64_C Q_INT64_C
+#define UINT64_C Q_UINT64_C
+
+extern "C" {
+#include AVCODEC_INCLUDE
+#include AVFORMAT_INCLUDE
+}
+
+#ifndef M_PI
+	#define M_PI 3.141592653589793
+#endif
+
+/// Decoding throughput benchmark of FFmpeg and AudioQueue
+/** Test files of each codec, channel count and sample rate are encoded with libavcodec
+  * (combinations that the encoders of the installed FFmpeg do not support are skipped),
+  * then decoded as the analyzer does, with the consumer reading the queue as fast as it can.
+  * Reported are the realtime factors of the whole pipeline and of the decoder alone, the
+  * throughput of the sample conversion into the queue and the time spent blocked on the queue.
+ */
+
+namespace {
+	struct Codec {
+		char const* name;
+		char const* encoders[3];  ///< Tried in order (native and external library encoders)
+		char const* format;  ///< Container
+		char const* extension;
+		int bitRate;  ///< Per channel, 0 for lossless
+	};
+	static const Codec codecs[] = {
+		{ "WAV", { "pcm_s16le" }, "wav", "wav", 0 },
+		{ "FLAC", { "flac" }, "flac", "flac", 0 },
+		{ "Vorbis", { "libvorbis", "vorbis" }, "ogg", "ogg", 64000 },
+		{ "MP3", { "libmp3lame" }, "mp3", "mp3", 64000 },
+		{ "AAC", { "libfdk_aac", "libfaac", "aac" }, "adts", "aac", 64000 },
+		{ "Opus", { "libopus" }, "ogg", "opus", 48000 }
+	};
+	static const unsigned channelCounts[] = { 1, 2, 6 };
+	static const unsigned rates[] = { 44100, 48000, 96000 };
+
+	/// Test signal: a different chord on each channel with some noise
+	class Signal {
+	public:
+		Signal(unsigned rate, unsigned channels): m_rate(rate), m_channels(channels), m_pos(), m_seed(1) {}
+		float operator()(unsigned ch) {
+			double t = double(m_pos) / m_rate;
+			m_seed = m_seed * 1103515245 + 12345;
+			double value = 0.02 * ((m_seed >> 16) / 32768.0 - 1.0);
+			for (int h = 1; h <= 3; ++h) value += 0.2 / h * std::sin(2.0 * M_PI * (220.0 + 55.0 * ch) * h * t);
+			if (ch + 1 == m_channels) ++m_pos;
+			return value;
+		}
+	private:
+		unsigned m_rate, m_channels;
+		unsigned long long m_pos;
+		unsigned m_seed;
+	};
+
+	bool supported(int const* list, int value) {
+		if (!list) return true;
+		for (; *list; ++list) if (*list == value) return true;
+		return false;
+	}
+
+	/// The first sample format of the encoder that we can produce
+	AVSampleFormat sampleFormat(AVCodec const* codec) {
+		static const AVSampleFormat ours[] = { AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_FLTP };
+		if (!codec->sample_fmts) return AV_SAMPLE_FMT_S16;
+		for (AVSampleFormat const* f = codec->sample_fmts; *f != AV_SAMPLE_FMT_NONE; ++f) {
+			for (unsigned i = 0; i < sizeof(ours) / sizeof(*ours); ++i) if (*f == ours[i]) return *f;
+		}
+		return AV_SAMPLE_FMT_NONE;
+	}
+
+	/// Encode seconds of the test signal into a file
+	/// @return false if this build of FFmpeg cannot encode it
+	bool encode(Codec const& codec, unsigned rate, unsigned channels, double seconds, std::string const& file) {
+		AVOutputFormat* format = av_guess_format(codec.format, NULL, NULL);
+		AVCodec* encoder = NULL;
+		for (unsigned i = 0; i < 3 && codec.encoders[i] && !encoder; ++i) encoder = avcodec_find_encoder_by_name(codec.encoders[i]);
+		if (!format || !encoder || !supported(encoder->supported_samplerates, rate)) return false;
+		AVSampleFormat fmt = sampleFormat(encoder);
+		if (fmt == AV_SAMPLE_FMT_NONE) return false;
+
+		AVFormatContext* oc = avformat_alloc_context();
+		if (!oc) throw std::runtime_error("Cannot allocate output context");
+		oc->oformat = format;
+		AVStream* st = avformat_new_stream(oc, encoder);
+		AVCodecContext* cc = st ? st->codec : NULL;
+		bool ok = false;
+		AVFrame* frame = avcodec_alloc_frame();
+		if (cc && frame) {
+			cc->sample_fmt = fmt;
+			cc->sample_rate = rate;
+			cc->channels = channels;
+			cc->channel_layout = av_get_default_channel_layout(channels);
+			cc->bit_rate = codec.bitRate * channels;
+			cc->time_base.num = 1;
+			cc->time_base.den = rate;
+			cc->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;  // The native AAC and Vorbis encoders
+			if (format->flags & AVFMT_GLOBALHEADER) cc->flags |= CODEC_FLAG_GLOBAL_HEADER;
+			ok = avcodec_open2(cc, encoder, NULL) >= 0;
+		}
+		if (ok) ok = avio_open(&oc->pb, file.c_str(), AVIO_FLAG_WRITE) >= 0;
+		if (ok) ok = avformat_write_header(oc, NULL) >= 0;
+		if (ok) {
+			int frameSize = cc->frame_size > 0 ? cc->frame_size : 1024;
+			bool planar = av_sample_fmt_is_planar(fmt);
+			int bytes = av_get_bytes_per_sample(fmt);
+			std::vector<uint8_t> buffer(av_samples_get_buffer_size(NULL, channels, frameSize, fmt, 1));
+			Signal signal(rate, channels);
+			int64_t pos = 0, total = int64_t(seconds * rate);
+			for (bool flushing = false; ok; ) {
+				AVFrame* input = NULL;
+				if (pos < total) {
+					// Whole frames only, the length is rounded up
+					for (int i = 0; i < frameSize; ++i) {
+						for (unsigned ch = 0; ch < channels; ++ch) {
+							float value = signal(ch);
+							uint8_t* dst = &buffer[bytes * (planar ? ch * frameSize + i : i * channels + ch)];
+							if (fmt == AV_SAMPLE_FMT_S16 || fmt == AV_SAMPLE_FMT_S16P) {
+								int16_t s = int16_t(32767.0f * value);
+								std::memcpy(dst, &s, sizeof(s));
+							} else std::memcpy(dst, &value, sizeof(value));
+						}
+					}
+					avcodec_get_frame_defaults(frame);
+					frame->nb_samples = frameSize;
+					frame->pts = pos;
+					avcodec_fill_audio_frame(frame, channels, fmt, &buffer[0], buffer.size(), 1);
+					input = frame;
+					pos += frameSize;
+				} else if (!(encoder->capabilities & CODEC_CAP_DELAY)) break;
+				else flushing = true;
+				AVPacket packet;
+				av_init_packet(&packet);
+				packet.data = NULL;
+				packet.size = 0;
+				int got = 0;
+				if (avcodec_encode_audio2(cc, &packet, input, &got) < 0) { ok = false; break; }
+				if (!got) {
+					if (flushing) break;
+					continue;
+				}
+				packet.stream_index = st->index;
+				if (packet.pts != int64_t(AV_NOPTS_VALUE)) packet.pts = av_rescale_q(packet.pts, cc->time_base, st->time_base);
+				if (packet.dts != int64_t(AV_NOPTS_VALUE)) packet.dts = av_rescale_q(packet.dts, cc->time_base, st->time_base);
+				packet.duration = av_rescale_q(packet.duration, cc->time_base, st->time_base);
+				if (av_interleaved_write_frame(oc, &packet) < 0) ok = false;
+			}
+			if (ok) ok = av_write_trailer(oc) >= 0;
+		}
+		if (oc->pb) avio_close(oc->pb);
+		if (frame) av_free(frame);
+		if (cc && cc->codec) avcodec_close(cc);
+		avformat_free_context(oc);
+		return ok;
+	}
+
+	/// Decode a file as the analyzer does and print the results
+	void decode(std::string const& file, Codec const& codec, unsigned rate, unsigned channels) {
+		QElapsedTimer timer;
+		timer.start();
+		FFmpeg ffmpeg(file);
+		std::vector<da::sample_t> data;
+		unsigned long long samples = 0;
+		while (ffmpeg.audioQueue.output(data)) {
+			samples += data.size();
+			data.clear();
+		}
+		double wall = timer.nsecsElapsed() * 1e-9;
+		AudioQueue::Stats stats = ffmpeg.audioQueue.stats();
+		double audio = double(samples) / (rate * channels);
+		double convert = (stats.input - stats.inputBlocked) * 1e-9;
+		double decoding = std::max(1e-9, wall - stats.input * 1e-9);  // Decoder thread time outside input()
+		std::cout << std::left << std::setw(7) << codec.name << std::right
+		  << std::setw(2) << channels << " ch " << std::setw(6) << rate << " Hz" << std::fixed << std::setprecision(1);
+		if (!samples) {
+			std::cout << "  (decoding failed)" << std::endl;
+			return;
+		}
+		std::cout
+		  << std::setw(9) << audio / wall << "x realtime"
+		  << std::setw(9) << audio / decoding << "x decode"
+		  << std::setw(9) << samples / std::max(1e-9, convert) * 1e-6 << " MS/s convert"
+		  << std::setw(8) << std::setprecision(0) << stats.inputBlocked * 1e-6 << " ms blocked in"
+		  << std::setw(8) << stats.outputBlocked * 1e-6 << " ms blocked out" << std::endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	QCoreApplication app(argc, argv);
+	double seconds = 30.0;
+	if (argc > 1) seconds = std::max(1.0, std::atof(argv[1]));
+	QTemporaryDir dir;
+	if (!dir.isValid()) {
+		std::cerr << "Cannot create a temporary directory" << std::endl;
+		return EXIT_FAILURE;
+	}
+	// Encoding is done while no decoder is running, so FFmpeg's lock is not needed
+	av_register_all();
+	av_log_set_level(AV_LOG_ERROR);
+	std::cout << "Decoding " << seconds << " s of audio per file" << std::endl;
+	try {
+		for (unsigned c = 0; c < sizeof(codecs) / sizeof(*codecs); ++c) {
+			for (unsigned ch = 0; ch < sizeof(channelCounts) / sizeof(*channelCounts); ++ch) {
+				for (unsigned r = 0; r < sizeof(rates) / sizeof(*rates); ++r) {
+					std::string file = QString("%1/%2-%3-%4.%5").arg(dir.path()).arg(codecs[c].name)
+					  .arg(channelCounts[ch]).arg(rates[r]).arg(codecs[c].extension).toStdString();
+					if (!encode(codecs[c], rates[r], channelCounts[ch], seconds, file)) {
+						std::cout << std::left << std::setw(7) << codecs[c].name << std::right << std::setw(2) << channelCounts[ch]
+						  << " ch " << std::setw(6) << rates[r] << " Hz  (no encoder)" << std::endl;
+						continue;
+					}
+					decode(file, codecs[c], rates[r], channelCounts[ch]);
+				}
+			}
+		}
+	} catch (std::exception& e) {
+		std::cerr << "Benchmark failed: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,256 @@
+#include "song.hh"
+#include "songwriter.hh"
+#include <QCoreApplication>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QScopedPointer>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+/// Throughput benchmark of the song file parsers and writers
+/** Every song of the corpus (directories given on the command line and/or generated
+  * charts) is parsed and written in every format. Each written file is also parsed and
+  * written again, which must reproduce it byte by byte, so that optimizations of the
+  * parsers or writers cannot change their output unnoticed.
+ */
+
+// Allocation counting: glibc lets the program replace malloc, elsewhere only operator new is seen
+namespace { unsigned long long allocations = 0; }
+#ifdef __GLIBC__
+extern "C" {
+	void* __libc_malloc(std::size_t size);
+	void* __libc_calloc(std::size_t n, std::size_t size);
+	void* __libc_realloc(void* ptr, std::size_t size);
+	void* malloc(std::size_t size) { ++allocations; return __libc_malloc(size); }
+	void* calloc(std::size_t n, std::size_t size) { ++allocations; return __libc_calloc(n, size); }
+	void* realloc(void* ptr, std::size_t size) { ++allocations; return __libc_realloc(ptr, size); }
+}
+#else
+void* operator new(std::size_t size) {
+	++allocations;
+	if (void* ptr = std::malloc(size ? size : 1)) return ptr;
+	throw std::bad_alloc();
+}
+void operator delete(void* ptr) throw() { std::free(ptr); }
+#endif
+
+namespace {
+	static const int generatedSizes[] = { 100, 1000, 10000 };  ///< Notes per generated chart
+
+	template <typename Writer> void write(Song const& song, QString const& dir) { Writer(song, dir); }
+
+	struct Format {
+		char const* name;
+		char const* fileName;  ///< The file to parse (INI also writes notes.mid)
+		void (*writer)(Song const&, QString const&);
+	};
+	static const Format formats[] = {
+		{ "XML", "notes.xml", write<SingStarXMLWriter> },
+		{ "TXT", "notes.txt", write<UltraStarTXTWriter> },
+		{ "INI", "song.ini", write<FoFMIDIWriter> },
+		{ "LRC", "song.lrc", write<LRCWriter> }
+	};
+	static const unsigned formatCount = sizeof(formats) / sizeof(*formats);
+
+	/// Totals of one format and direction
+	struct Stats {
+		unsigned long long bytes, songs, allocations;
+		qint64 nsecs;
+		Stats(): bytes(), songs(), allocations(), nsecs() {}
+		void print(char const* what) const {
+			if (!songs) return;
+			double sec = std::max(1e-9, nsecs * 1e-9);
+			std::cout << "  " << std::left << std::setw(7) << what << std::right << std::fixed
+			  << std::setw(9) << std::setprecision(2) << bytes / sec / 1e6 << " MB/s"
+			  << std::setw(10) << std::setprecision(1) << songs / sec << " songs/s"
+			  << std::setw(10) << allocations / songs << " allocs/song" << std::endl;
+		}
+	};
+
+	/// Total size of the files of a directory
+	qint64 dirSize(QString const& dir) {
+		qint64 size = 0;
+		QFileInfoList files = QDir(dir).entryInfoList(QDir::Files);
+		for (int i = 0; i < files.size(); ++i) size += files[i].size();
+		return size;
+	}
+
+	/// Whether two directories contain identical files
+	bool sameFiles(QString const& a, QString const& b) {
+		QStringList files = QDir(a).entryList(QDir::Files);
+		if (files != QDir(b).entryList(QDir::Files)) return false;
+		for (int i = 0; i < files.size(); ++i) {
+			QFile fa(a + "/" + files[i]), fb(b + "/" + files[i]);
+			if (!fa.open(QIODevice::ReadOnly) || !fb.open(QIODevice::ReadOnly)) return false;
+			if (fa.readAll() != fb.readAll()) return false;
+		}
+		return true;
+	}
+
+	/// Size of a song file (and the MIDI file that goes with INI)
+	qint64 songSize(QString const& file, int format) {
+		QFileInfo finfo(file);
+		qint64 size = finfo.size();
+		if (format == 2) size += QFileInfo(finfo.path() + "/notes.mid").size();
+		return size;
+	}
+
+	Song* parse(QString const& file) {
+		QFileInfo finfo(file);
+		return new Song(finfo.path() + "/", finfo.fileName());
+	}
+
+	/// A chart with a wandering melody, phrases of eight notes and some golden and freestyle notes
+	void generate(Song& song, int notes) {
+		song.title = QString("Generated %1").arg(notes);
+		song.artist = "Composer";
+		song.bpm = 240;
+		VocalTrack track(TrackName::LEAD_VOCAL);
+		unsigned seed = notes;
+		int pitch = 24;
+		double t = 1.0;
+		for (int i = 0; i < notes; ++i) {
+			seed = seed * 1103515245 + 12345;
+			Note note(QString("la%1 ").arg(i % 97));
+			if (i % 8 == 0 && i > 0) { note.lineBreak = true; t += 1.0; }
+			note.begin = t;
+			note.end = t + 0.0625 * (2 + (seed >> 16) % 6);
+			pitch = std::max(12, std::min(36, pitch + int((seed >> 20) % 5) - 2));
+			note.note = note.notePrev = pitch;
+			if ((seed >> 24) % 16 == 0) note.type = Note::GOLDEN;
+			else if ((seed >> 24) % 16 == 1) note.type = Note::FREESTYLE;
+			t = note.end + 0.0625;
+			track.notes.push_back(note);
+			track.noteMin = std::min(track.noteMin, pitch);
+			track.noteMax = std::max(track.noteMax, pitch);
+		}
+		track.beginTime = track.notes.front().begin;
+		track.endTime = track.notes.back().end;
+		song.insertVocalTrack(TrackName::LEAD_VOCAL, track);
+	}
+
+	int formatOf(QString const& file) {
+		QString name = QFileInfo(file).fileName();
+		for (unsigned f = 0; f < formatCount; ++f) {
+			if (name == formats[f].fileName) return f;
+		}
+		if (name.endsWith(".txt")) return 1;
+		if (name.endsWith(".lrc")) return 3;
+		return -1;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	QCoreApplication app(argc, argv);
+	QStringList dirs;
+	bool generated = false;
+	int rounds = 3;
+	QStringList args = app.arguments();
+	for (int i = 1; i < args.size(); ++i) {
+		if (args[i] == "--generate") generated = true;
+		else if (args[i] == "--rounds" && i + 1 < args.size()) rounds = std::max(1, args[++i].toInt());
+		else if (args[i].startsWith("-")) {
+			std::cerr << "Usage: " << argv[0] << " [--generate] [--rounds N] [CORPUSDIR...]" << std::endl;
+			return EXIT_FAILURE;
+		}
+		else dirs << args[i];
+	}
+	if (dirs.isEmpty()) generated = true;
+
+	QTemporaryDir work;
+	if (!work.isValid()) {
+		std::cerr << "Cannot create a temporary directory" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// Collect the corpus
+	QStringList corpus;
+	for (int i = 0; i < dirs.size(); ++i) {
+		QDirIterator it(dirs[i], QStringList() << "*.txt" << "*.xml" << "*.ini" << "*.lrc", QDir::Files, QDirIterator::Subdirectories);
+		while (it.hasNext()) corpus << it.next();
+	}
+	if (generated) {
+		for (unsigned i = 0; i < sizeof(generatedSizes) / sizeof(*generatedSizes); ++i) {
+			Song song;
+			generate(song, generatedSizes[i]);
+			for (unsigned f = 0; f < formatCount; ++f) {
+				QString dir = work.path() + QString("/generated/%1/%2").arg(generatedSizes[i]).arg(formats[f].name);
+				formats[f].writer(song, dir);
+				corpus << dir + "/" + formats[f].fileName;
+			}
+		}
+	}
+
+	Stats parsing[formatCount], writing[formatCount];
+	unsigned skipped = 0, mismatches = 0;
+	for (int c = 0; c < corpus.size(); ++c) {
+		int format = formatOf(corpus[c]);
+		if (format < 0) { ++skipped; continue; }
+		// Parse (files that are not songs, e.g. other XML, are skipped)
+		QScopedPointer<Song> song;
+		try {
+			QElapsedTimer timer;
+			unsigned long long allocs = allocations;
+			timer.start();
+			for (int r = 0; r < rounds; ++r) song.reset(parse(corpus[c]));
+			Stats& s = parsing[format];
+			s.nsecs += timer.nsecsElapsed();
+			s.allocations += allocations - allocs;
+			s.bytes += rounds * songSize(corpus[c], format);
+			s.songs += rounds;
+		} catch (std::exception&) {
+			++skipped;
+			continue;
+		}
+		// Write in every format and check the round trip
+		for (unsigned f = 0; f < formatCount; ++f) {
+			QString dir = work.path() + QString("/out/%1").arg(formats[f].name);
+			QDir(dir).removeRecursively();
+			QElapsedTimer timer;
+			unsigned long long allocs = allocations;
+			timer.start();
+			for (int r = 0; r < rounds; ++r) formats[f].writer(*song, dir);
+			Stats& s = writing[f];
+			s.nsecs += timer.nsecsElapsed();
+			s.allocations += allocations - allocs;
+			s.bytes += rounds * dirSize(dir);
+			s.songs += rounds;
+			QString again = dir + "-again";
+			QDir(again).removeRecursively();
+			try {
+				QScopedPointer<Song> parsed(parse(dir + "/" + formats[f].fileName));
+				formats[f].writer(*parsed, again);
+			} catch (std::exception& e) {
+				std::cerr << corpus[c].toStdString() << ": " << formats[f].name << " output cannot be parsed: " << e.what() << std::endl;
+				++mismatches;
+				continue;
+			}
+			if (!sameFiles(dir, again)) {
+				std::cerr << corpus[c].toStdString() << ": " << formats[f].name << " output changes in a round trip" << std::endl;
+				++mismatches;
+			}
+		}
+	}
+
+	std::cout << corpus.size() - skipped << " songs (" << skipped << " files skipped), " << rounds << " rounds" << std::endl;
+	for (unsigned f = 0; f < formatCount; ++f) {
+		std::cout << formats[f].name << std::endl;
+		parsing[f].print("parse");
+		writing[f].print("export");
+	}
+	if (mismatches) {
+		std::cout << mismatches << " round trip failures" << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
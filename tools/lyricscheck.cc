@@ -0,0 +1,114 @@
+#include "notegraphwidget.hh"
+#include "operation.hh"
+#include "song.hh"
+#include <QApplication>
+#include <QFile>
+#include <QList>
+#include <QScrollArea>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+/// Import of duets into the note graph, checked against the undo stack
+/** An UltraStar duet with lines of both singers (P3) is parsed, and the notes sung by both
+  * must end up in the tracks of both singers. Then its tracks are imported to the note graph
+  * as a duet without lead vocals (the last track is the one edited). The import must be a
+  * single undo action, so the count of the COMBINER must match the operations before it.
+  * Exits with failure if anything differs.
+ */
+
+/// The operations that the note graph gives to the undo stack
+class OperationLog: public QObject
+{
+	Q_OBJECT
+public:
+	QList<Operation> ops;
+public slots:
+	void add(Operation const& op) { ops << op; }
+};
+
+namespace {
+	static char const* duet =
+	  "#TITLE:Duet\n#ARTIST:Composer\n#BPM:300\n#GAP:0\n"
+	  "P1\n: 0 4 10 One \n: 8 4 10 two \n"
+	  "P2\n: 4 4 12 Uno \n: 12 4 12 dos \n"
+	  "P3\n: 20 4 14 All \n: 24 4 14 together \n"
+	  "E\n";
+	static const unsigned notesPerSinger = 4;  ///< Two of their own and two of both
+
+	bool check(bool ok, char const* what) {
+		std::cout << (ok ? "ok      " : "FAILED  ") << what << std::endl;
+		return ok;
+	}
+
+	void writeDuet(QString const& fileName) {
+		QFile f(fileName);
+		if (!f.open(QIODevice::WriteOnly)) throw std::runtime_error("Cannot write " + fileName.toStdString());
+		QTextStream(&f) << duet;
+	}
+
+	/// Notes other than line breaks
+	unsigned countNotes(VocalTrack const& track) {
+		unsigned count = 0;
+		for (Notes::const_iterator it = track.notes.begin(); it != track.notes.end(); ++it) {
+			if (it->type != Note::SLEEP) ++count;
+		}
+		return count;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	QTemporaryDir dir;
+	if (!dir.isValid()) {
+		std::cerr << "Cannot create a temporary directory" << std::endl;
+		return EXIT_FAILURE;
+	}
+	qputenv("QT_QPA_PLATFORM", "offscreen");
+	QApplication app(argc, argv);
+	bool passed = true;
+	try {
+		writeDuet(dir.path() + "/duet.txt");
+		Song song(dir.path() + "/", "duet.txt");
+		VocalTracks const& parsed = song.getVocalTracks();
+		VocalTracks::const_iterator first = parsed.find(TrackName::vocalPart(0));
+		VocalTracks::const_iterator second = parsed.find(TrackName::vocalPart(1));
+		bool bothParts = parsed.size() == 2 && first != parsed.end() && second != parsed.end();
+		passed &= check(bothParts, "P1 and P2 parsed as the two singers");
+		if (!bothParts) return EXIT_FAILURE;
+		passed &= check(countNotes(first->second) == notesPerSinger && countNotes(second->second) == notesPerSinger,
+		  "P3 notes added to both singers");
+		passed &= check(first->second.notes.back().syllable == "together " && second->second.notes.back().syllable == "together ",
+		  "P3 notes in time order");
+
+		// A duet without lead vocals
+		VocalTracks tracks;
+		tracks.insert(std::make_pair(TrackName::HARMONIC_1, first->second));
+		tracks.insert(std::make_pair(TrackName::HARMONIC_2, second->second));
+		QScrollArea view;
+		NoteGraphWidget* graph = new NoteGraphWidget(NULL);
+		view.setWidget(graph);
+		OperationLog log;
+		QObject::connect(graph, SIGNAL(operationDone(const Operation&)), &log, SLOT(add(const Operation&)));
+		graph->setLyrics(tracks);
+		int clear = -1, combiner = -1;
+		for (int i = 0; i < log.ops.size(); ++i) {
+			if (log.ops[i].op() == "CLEAR") clear = i;
+			if (log.ops[i].op() == "COMBINER") combiner = i;
+		}
+		passed &= check(clear >= 0 && combiner > clear && log.ops[combiner].i(1) == combiner - clear - 1,
+		  "COMBINER counts the operations of the import");
+		VocalTracks imported = graph->getVocalTracks();
+		passed &= check(imported.size() == 2 && imported.count(TrackName::HARMONIC_1) && imported.count(TrackName::HARMONIC_2)
+		  && countNotes(imported.find(TrackName::HARMONIC_1)->second) == notesPerSinger
+		  && countNotes(imported.find(TrackName::HARMONIC_2)->second) == notesPerSinger, "Both singers imported");
+	} catch (std::exception& e) {
+		std::cerr << "Check failed: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#include "lyricscheck.moc"
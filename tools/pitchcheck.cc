@@ -0,0 +1,70 @@
+#include "pitch.hh"
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/// Levels of the analyzer on synthetic tones, with and without zero padding
+/** Pure sines of known amplitude are analyzed with the 1024 sample frame (zero padded to the
+  * FFT size) and with the 2048 sample frame (not padded). The strongest peak must have the
+  * level of the sine in both, and the tone found must be equally strong in both, so that the
+  * padding makes no difference. The sines are at bin centers of both frames, where the
+  * window loses nothing between bins. Exits with failure if a peak is off by more than half
+  * a dB, or if the tones differ by more than a dB (their levels are sums over the bins of a
+  * lobe, which the padding samples at different points).
+ */
+
+namespace {
+	static const double rate = 44100.0;
+	static const double amplitude = 0.5;
+	static const unsigned bins[] = { 3, 5, 10, 20 };  ///< Frequencies in bins of the 1024 sample frame
+	static const double maxPeakError = 0.5;  ///< dB
+	static const double maxToneError = 1.0;  ///< dB
+
+	struct Levels {
+		double peak;  ///< The strongest peak (dB)
+		double tone;  ///< The strongest tone (dB)
+	};
+
+	/// Analyze a single frame of a sine
+	Levels analyze(double freq, unsigned frameSize) {
+		Analyzer analyzer(rate, "", Analyzer::INTERPOLATION, frameSize);
+		std::vector<float> pcm(analyzer.processSize());
+		for (std::size_t i = 0; i < pcm.size(); ++i) pcm[i] = amplitude * std::sin(2.0 * M_PI * freq * i / rate);
+		analyzer.process(pcm.begin());
+		Levels l = { 0.0, 0.0 };
+		Analyzer::Peaks const& peaks = analyzer.getPeaks();
+		for (std::size_t k = 0; k < peaks.size(); ++k) l.peak = std::max(l.peak, peaks[k].level);
+		Moment::Tones const& tones = analyzer.getMoments().back().m_tones;
+		for (Moment::Tones::const_iterator it = tones.begin(); it != tones.end(); ++it) l.tone = std::max(l.tone, it->level);
+		l.peak = level2dB(l.peak);
+		l.tone = level2dB(l.tone);
+		return l;
+	}
+
+	/// @return the levels of a sine were right
+	bool check(double freq) {
+		// A Hamming windowed sine peaks at half of the amplitude times the mean of the window
+		double expected = level2dB(0.5 * 0.53836 * amplitude);
+		Levels padded = analyze(freq, 1024);
+		Levels unpadded = analyze(freq, 2048);
+		bool passed = std::abs(padded.peak - expected) <= maxPeakError && std::abs(unpadded.peak - expected) <= maxPeakError
+		  && std::abs(padded.tone - unpadded.tone) <= maxToneError;
+		std::cout << std::fixed << std::setprecision(2) << std::setw(7) << freq << " Hz:"
+		  << "  peak " << std::setw(6) << padded.peak - expected << " / " << std::setw(6) << unpadded.peak - expected << " dB,"
+		  << "  tone " << std::setw(6) << padded.tone << " / " << std::setw(6) << unpadded.tone << " dB"
+		  << (passed ? "" : "  FAILED") << std::endl;
+		return passed;
+	}
+}
+
+int main()
+{
+	bool passed = true;
+	std::cout << "Levels of " << level2dB(amplitude) << " dBFS sines padded / not padded (peaks relative to the sine)" << std::endl;
+	for (unsigned i = 0; i < sizeof(bins) / sizeof(*bins); ++i) {
+		if (!check(bins[i] * rate / 1024)) passed = false;
+	}
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,170 @@
+#include "audiodevice.hh"
+#include "playback.hh"
+#include "synth.hh"
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QThread>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+/// Playback timing on a simulated sound card, so that it can be checked without sound hardware
+/** A click track (a single full scale sample every half second) is played through the
+  * PlaybackEngine on a VirtualAudioDevice, with callbacks late by a random jitter and with
+  * stalls that make the device run out of samples. Each click found in the recording was
+  * heard at a known device frame, where the position reported by the engine must be the
+  * time of that click (cursor error). Beeps mixed in with the music stopped give the latency
+  * of the voices (synth notes and piano keys). A device that only plays at 48 kHz makes the
+  * engine resample the music, where the clicks get spread over two frames and the cursor
+  * must still be right. Exits with failure if the cursor is off by more than a millisecond
+  * or if the device ran out of samples without stalls.
+ */
+
+namespace {
+	static const unsigned rate = 44100;
+	static const unsigned period = 256;  ///< Frames per device callback
+	static const double songLength = 20.0;  ///< Seconds of clicks
+	static const double clickInterval = 0.5;
+	static const short clickLevel = 30000;
+	static const double clickGap = 0.01;  ///< Seconds after a click where another one is not looked for
+	static const int beeps = 20;
+	static const qint64 maxCursorError = 1;  ///< Milliseconds (the resolution of the position)
+
+	struct Scenario {
+		char const* name;
+		unsigned jitter;  ///< Frames of lateness at most
+		double stallInterval;  ///< Seconds between stalls (0 for none)
+		double stallLength;  ///< Seconds without callbacks
+		unsigned deviceRate;  ///< The only rate of the device (0 for any)
+	};
+	static const Scenario scenarios[] = {
+		{ "ideal", 0, 0.0, 0.0, 0 },
+		{ "jitter", 441, 0.0, 0.0, 0 },  // Up to 10 ms late
+		{ "stalls", 0, 3.0, 0.1, 0 },
+		{ "both", 441, 3.0, 0.1, 0 },
+		{ "48kHz", 441, 3.0, 0.1, 48000 }
+	};
+
+	/// A 16 bit stereo WAV file of silence with clicks at every clickInterval (none at zero)
+	void writeClicks(QString const& fileName) {
+		quint32 frames = songLength * rate;
+		QFile f(fileName);
+		if (!f.open(QIODevice::WriteOnly)) throw std::runtime_error("Cannot write " + fileName.toStdString());
+		QDataStream ds(&f);
+		ds.setByteOrder(QDataStream::LittleEndian);
+		quint32 dataSize = frames * AudioDevice::bytesPerFrame;
+		ds.writeRawData("RIFF", 4);
+		ds << quint32(36 + dataSize);
+		ds.writeRawData("WAVEfmt ", 8);
+		ds << quint32(16) << quint16(1) << quint16(2) << quint32(rate) << quint32(rate * 4) << quint16(4) << quint16(16);
+		ds.writeRawData("data", 4);
+		ds << dataSize;
+		unsigned interval = clickInterval * rate;
+		for (quint32 i = 0; i < frames; ++i) {
+			qint16 s = (i > 0 && i % interval == 0 ? clickLevel : 0);
+			ds << s << s;
+		}
+	}
+
+	/// Let the decoder thread get ahead, so that the device never waits for it (and the results do not depend on the machine)
+	void waitForMusic(PlaybackEngine const& engine) {
+		while (engine.bufferedMusic() < 0.2) QThread::msleep(1);
+	}
+
+	struct Stats {
+		double sum, max;
+		unsigned count;
+		Stats(): sum(), max(), count() {}
+		void add(double value) { sum += value; max = std::max(max, value); ++count; }
+		double mean() const { return count ? sum / count : 0.0; }
+	};
+
+	/// Play the click track and the beeps in a scenario, print the results
+	/// @return the scenario passed
+	bool run(Scenario const& s, QString const& music) {
+		VirtualAudioDevice* device = new VirtualAudioDevice(period, 1);
+		device->setJitter(s.jitter);
+		device->setFixedRate(s.deviceRate);
+		PlaybackEngine engine(NULL, device);
+		engine.setMedia(music);
+		engine.init();
+		waitForMusic(engine);
+		const unsigned deviceRate = device->rate();
+		// The click track, checking the position whenever a click is heard
+		Stats cursor;
+		unsigned clicks = 0;
+		double nextStall = s.stallInterval;
+		unsigned long long begin = device->clock();
+		unsigned long long lastClick = 0;
+		engine.play();
+		while (device->clock() - begin < (songLength + 1.0) * deviceRate) {
+			waitForMusic(engine);
+			double t = double(device->clock() - begin) / deviceRate;
+			if (s.stallInterval > 0.0 && t >= nextStall) {
+				device->stall(s.stallLength * deviceRate);
+				nextStall += s.stallInterval;
+			}
+			device->advance(1);
+			if (device->recording()[2 * (device->clock() - 1)] < clickLevel / 2) continue;
+			if (lastClick && device->clock() - lastClick < clickGap * deviceRate) continue;  // The same click resampled
+			lastClick = device->clock();
+			// The position is of the frame after the click, which is less than a millisecond later
+			qint64 expected = qRound64(++clicks * clickInterval * 1000.0);
+			cursor.add(std::abs(double(engine.position() - expected)));
+		}
+		unsigned underruns = device->underruns();
+		engine.pause();
+		// Beeps at times that fall on different parts of the periods
+		Stats voice;
+		QByteArray beep;
+		Synth::createBuffer(beep, 9, 0.05);
+		for (int i = 0; i < beeps; ++i) {
+			device->advance(deviceRate / 4 + 37 * i);
+			unsigned long long mixed = device->clock();
+			engine.mix(beep, Synth::SampleRate);
+			device->advance(deviceRate / 4);
+			std::vector<short> const& rec = device->recording();
+			for (unsigned long long f = mixed; f < device->clock(); ++f) {
+				if (rec[2 * f] == 0) continue;
+				voice.add(1000.0 * (f - mixed) / deviceRate);
+				break;
+			}
+		}
+		bool passed = clicks == unsigned(songLength / clickInterval - 0.5) && cursor.max <= maxCursorError
+		  && (s.stallInterval > 0.0 || underruns == 0) && voice.count == unsigned(beeps);
+		std::cout << std::left << std::setw(7) << s.name << std::right << std::fixed << std::setprecision(2)
+		  << std::setw(4) << clicks << " clicks, cursor error mean " << std::setw(5) << cursor.mean() << " ms, max " << std::setw(5) << cursor.max << " ms"
+		  << "  voice latency mean " << std::setw(6) << voice.mean() << " ms, max " << std::setw(6) << voice.max << " ms"
+		  << std::setw(4) << underruns << " underruns" << (passed ? "" : "  FAILED") << std::endl;
+		return passed;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	QCoreApplication app(argc, argv);
+	QTemporaryDir dir;
+	if (!dir.isValid()) {
+		std::cerr << "Cannot create a temporary directory" << std::endl;
+		return EXIT_FAILURE;
+	}
+	bool passed = true;
+	try {
+		QString music = dir.path() + "/clicks.wav";
+		writeClicks(music);
+		std::cout << "Music at " << rate << " Hz, device period " << period << " frames" << std::endl;
+		for (unsigned i = 0; i < sizeof(scenarios) / sizeof(*scenarios); ++i) {
+			if (!run(scenarios[i], music)) passed = false;
+		}
+	} catch (std::exception& e) {
+		std::cerr << "Benchmark failed: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
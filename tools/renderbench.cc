@@ -0,0 +1,247 @@
+#include "analysis.hh"
+#include "editorapp.hh"
+#include "notegraphwidget.hh"
+#include "notelabel.hh"
+#include "renderstats.hh"
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QScrollArea>
+#include <QScrollBar>
+#include <QTemporaryDir>
+#include <QThread>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#ifndef RENDER_STATS
+	#error "The benchmark needs the GUI library built with RENDER_STATS (the rendering counters)"
+#endif
+
+#ifndef M_PI
+	#define M_PI 3.141592653589793
+#endif
+
+/// Frame time benchmark of the note graph, rendered with the offscreen platform
+/** Synthetic songs with dense pitch paths are scrolled through, zoomed out and in,
+  * box selected and played (moving cursor), one step per 20 ms frame. A frame takes
+  * the time of the step, the repaint and all events handled until the next frame
+  * (delayed note pixmap updates, pitch images from the renderer thread).
+ */
+
+namespace {
+	static const int songSizes[] = { 100, 1000, 10000 };  ///< Notes per song
+	static const int frameMs = 20;  ///< Frame interval (as the playback cursor)
+	static const int maxFrames = 250;  ///< Per sequence
+	static const float hopTime = 512.0f / 44100.0f;  ///< As the pitch analyzer
+
+	struct Frame {
+		double ms;
+		int pixmaps, pixels;
+	};
+
+	/// The melody of a song (a phrase every eight notes)
+	VocalTrack generate(int notes) {
+		VocalTrack track(TrackName::LEAD_VOCAL);
+		unsigned seed = notes;
+		int pitch = 24;
+		double t = 1.0;
+		for (int i = 0; i < notes; ++i) {
+			seed = seed * 1103515245 + 12345;
+			Note note(QString("la%1 ").arg(i % 97));
+			if (i % 8 == 0) { note.lineBreak = true; t += 1.0; }
+			note.begin = t;
+			note.end = t + 0.1 * (2 + (seed >> 16) % 4);
+			pitch = std::max(12, std::min(36, pitch + int((seed >> 20) % 5) - 2));
+			note.note = note.notePrev = pitch;
+			if ((seed >> 24) % 16 == 0) note.type = Note::GOLDEN;
+			t = note.end + 0.05;
+			track.notes.push_back(note);
+			track.noteMin = std::min(track.noteMin, pitch);
+			track.noteMax = std::max(track.noteMax, pitch);
+		}
+		track.beginTime = track.notes.front().begin;
+		track.endTime = track.notes.back().end;
+		return track;
+	}
+
+	/// Pitch paths of the melody with vibrato and two harmonics, as the analyzer would find them
+	PitchAnalysis analysis(VocalTrack const& track) {
+		PitchAnalysis result;
+		result.hopTime = hopTime;
+		result.duration = track.endTime + 5.0;
+		result.voicing.assign(std::size_t(result.duration / hopTime), 1.0f);
+		Notes const& notes = track.notes;
+		for (std::size_t i = 0; i < notes.size(); ++i) {
+			unsigned begin = notes[i].begin / hopTime, end = notes[i].end / hopTime;
+			for (unsigned channel = 0; channel < 3; ++channel) {
+				PitchPath path(channel, begin, hopTime);
+				for (unsigned hop = begin; hop < end; ++hop) {
+					float vibrato = 0.3f * std::sin(2.0f * M_PI * 5.5f * hop * hopTime);
+					path.push_back(notes[i].note + 12 * (channel == 1) + 19 * (channel == 2) + vibrato, -6.0f - 12.0f * channel);
+				}
+				if (!path.empty()) result.paths.push_back(path);
+			}
+		}
+		return result;
+	}
+
+	/// A song shown in a scrolled note graph
+	class Bench {
+	public:
+		Bench(int notes, QString const& dir): m_notes(notes), m_piano(&m_player) {
+			m_view.resize(1280, 720);
+			m_graph = new NoteGraphWidget(NULL);
+			m_view.setWidget(m_graph);
+			QObject::connect(m_view.horizontalScrollBar(), SIGNAL(valueChanged(int)), m_graph, SLOT(updatePitch()));
+			m_view.show();
+			// The pitch paths come from the analysis cache (of an empty file)
+			VocalTrack track = generate(notes);
+			QString music = dir + QString("/%1.wav").arg(notes);
+			QFile f(music);
+			if (f.open(QIODevice::WriteOnly)) f.write("RIFF");
+			f.close();
+			analysis(track).save(music);
+			m_graph->setLyrics(track);
+			m_graph->analyzeMusic(music);
+			// All note pixmaps, the analysis loaded and the first pitch image before measuring
+			for (int i = 0; i < m_graph->noteLabels().size(); ++i) m_graph->noteLabels()[i]->createPixmap();
+			QElapsedTimer timer;
+			timer.start();
+			while (timer.elapsed() < 2000) {
+				QCoreApplication::processEvents();
+				QThread::usleep(1000);
+			}
+		}
+
+		void scroll() {
+			begin("scroll");
+			QScrollBar* bar = m_view.horizontalScrollBar();
+			int step = std::max(1, std::max(bar->maximum() / maxFrames, m_view.width() / 4));
+			for (int x = 0; x <= bar->maximum() && frames() < maxFrames; x += step) {
+				bar->setValue(x);
+				frame();
+			}
+			bar->setValue(0);
+			end();
+		}
+
+		void zoom() {
+			begin("zoom");
+			for (int i = 0; i < 12; ++i) { m_graph->zoom(-1); frame(); }
+			for (int i = 0; i < 18; ++i) { m_graph->zoom(1); frame(); }
+			m_graph->zoom(getNaN());
+			frame();
+			end();
+		}
+
+		void boxSelect() {
+			begin("select");
+			int x = m_view.horizontalScrollBar()->value(), y = m_view.verticalScrollBar()->value();
+			for (int i = 1; i <= 40; ++i) {
+				// A growing box from the top left corner of the view, as dragged with the mouse
+				m_graph->boxSelect(QPoint(x, y), QPoint(x + i * m_view.width() / 40, y + i * m_view.height() / 40));
+				m_piano.updateSelection(m_graph);
+				frame();
+			}
+			m_graph->selectNote(NULL);
+			end();
+		}
+
+		void playback() {
+			begin("playback");
+			for (int i = 0; i < maxFrames; ++i) {
+				m_graph->updateMusicPos(i * frameMs, false);
+				frame();
+			}
+			end();
+		}
+
+	private:
+		void begin(char const* name) {
+			m_name = name;
+			m_frames.clear();
+			RenderStats::pixmaps.fetchAndStoreRelaxed(0);
+			RenderStats::pixels.fetchAndStoreRelaxed(0);
+			m_timer.start();
+		}
+
+		int frames() const { return m_frames.size(); }
+
+		/// Repaint and handle the events until the next frame, the step was done since m_timer was started
+		void frame() {
+			m_view.viewport()->repaint();
+			qint64 busy = m_timer.nsecsElapsed();
+			QElapsedTimer tick;
+			tick.start();
+			while (tick.elapsed() < frameMs) {
+				QElapsedTimer work;
+				work.start();
+				QCoreApplication::processEvents();
+				busy += work.nsecsElapsed();
+				QThread::usleep(500);
+			}
+			Frame f;
+			f.ms = busy * 1e-6;
+			f.pixmaps = RenderStats::pixmaps.fetchAndStoreRelaxed(0);
+			f.pixels = RenderStats::pixels.fetchAndStoreRelaxed(0);
+			m_frames.push_back(f);
+			m_timer.start();
+		}
+
+		/// Print percentiles of the frame times and the mean work per frame
+		void end() {
+			if (m_frames.empty()) return;
+			std::vector<double> ms;
+			double pixmaps = 0.0, pixels = 0.0;
+			for (std::size_t i = 0; i < m_frames.size(); ++i) {
+				ms.push_back(m_frames[i].ms);
+				pixmaps += m_frames[i].pixmaps;
+				pixels += m_frames[i].pixels;
+			}
+			std::sort(ms.begin(), ms.end());
+			std::size_t n = ms.size();
+			std::cout << std::setw(6) << m_notes << " notes  " << std::left << std::setw(9) << m_name << std::right << std::fixed << std::setprecision(1)
+			  << " p50 " << std::setw(6) << ms[n / 2] << " ms"
+			  << "  p90 " << std::setw(6) << ms[n * 9 / 10] << " ms"
+			  << "  p99 " << std::setw(6) << ms[n * 99 / 100] << " ms"
+			  << "  max " << std::setw(6) << ms.back() << " ms"
+			  << "  " << std::setw(7) << pixmaps / n << " pixmaps"
+			  << "  " << std::setw(7) << std::setprecision(2) << pixels / n * 1e-6 << " Mpx per frame" << std::endl;
+		}
+
+		int m_notes;
+		QScrollArea m_view;
+		NoteGraphWidget* m_graph;  ///< Owned by the view
+		PlaybackEngine m_player;  ///< Never opens an output here
+		Piano m_piano;
+		char const* m_name;
+		std::vector<Frame> m_frames;
+		QElapsedTimer m_timer;
+	};
+}
+
+int main(int argc, char** argv)
+{
+	QTemporaryDir dir;
+	if (!dir.isValid()) {
+		std::cerr << "Cannot create a temporary directory" << std::endl;
+		return EXIT_FAILURE;
+	}
+	// No display needed and the analysis cache of the songs goes away with them (on freedesktop systems)
+	qputenv("QT_QPA_PLATFORM", "offscreen");
+	qputenv("XDG_CACHE_HOME", QFile::encodeName(dir.path() + "/cache"));
+	QApplication app(argc, argv);
+	app.setApplicationName("composer-renderbench");
+	for (unsigned i = 0; i < sizeof(songSizes) / sizeof(*songSizes); ++i) {
+		Bench bench(songSizes[i], dir.path());
+		bench.scroll();
+		bench.zoom();
+		bench.boxSelect();
+		bench.playback();
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+#include "pitch.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/// Pitch latency of the resonator bank against the FFT analyzer
+/** A voice-like tone (a fundamental with two weaker harmonics, faded in over 5 ms so that the
+  * click of a hard start does not fill the spectrum) starts after silence, and every analyzer
+  * is fed the same samples. The latency is the number of samples that an analyzer has taken in
+  * after the start of the tone when its strongest tone has settled: from then on it is within
+  * 10 cents of the fundamental. The tones start at several points of the 512 sample hop of
+  * Analyzer and the mean latencies are printed. The resonator bank must find every tone, no
+  * later than Analyzer with the 2048 sample frame. Exits with failure otherwise.
+ */
+
+namespace {
+	static const double rate = 44100.0;
+	static const double freqs[] = { 82.41, 110.0, 220.0, 440.0, 880.0 };  ///< E2 to A5
+	static const unsigned onset = 10000;  ///< Samples of silence before the first tone
+	static const unsigned onsets = 8;  ///< Tones started at different points of the FFT hop
+	static const unsigned length = 20000;  ///< Samples of tone
+	static const unsigned fadeIn = 220;  ///< Samples
+	static const double maxCents = 10.0;
+
+	std::vector<float> voice(double freq, unsigned start) {
+		std::vector<float> pcm(start + length);
+		for (unsigned i = start; i < pcm.size(); ++i) {
+			double t = 2.0 * M_PI * freq * (i - start) / rate;
+			double gain = std::min(1.0, double(i - start) / fadeIn);
+			pcm[i] = gain * (0.3 * std::sin(t) + 0.15 * std::sin(2.0 * t) + 0.08 * std::sin(3.0 * t));
+		}
+		return pcm;
+	}
+
+	/// The strongest tone of a moment (NULL if none)
+	Tone const* strongest(Moment const& m) {
+		Tone const* best = NULL;
+		for (Moment::Tones::const_iterator it = m.m_tones.begin(); it != m.m_tones.end(); ++it) {
+			if (!best || it->level > best->level) best = &*it;
+		}
+		return best;
+	}
+
+	/// Latency in ms from the moments and the samples taken in before each of them, NaN if never settled
+	double latency(ToneTracker::Moments const& moments, std::vector<unsigned> const& taken, double freq, unsigned start) {
+		double result = getNaN();
+		unsigned i = 0;
+		for (ToneTracker::Moments::const_iterator it = moments.begin(); it != moments.end(); ++it, ++i) {
+			if (taken[i] <= start) continue;
+			Tone const* t = strongest(*it);
+			bool right = t && std::abs(1200.0 * std::log(t->freq / freq) / std::log(2.0)) <= maxCents;
+			if (!right) result = getNaN();
+			else if (result != result) result = 1000.0 * (taken[i] - start) / rate;
+		}
+		return result;
+	}
+
+	double analyzerLatency(std::vector<float> const& pcm, double freq, unsigned start, Analyzer::Precision precision, unsigned frameSize) {
+		Analyzer analyzer(rate, "", precision, frameSize);
+		std::vector<unsigned> taken;
+		for (unsigned pos = 0; pos + analyzer.processSize() <= pcm.size(); pos += analyzer.processStep()) {
+			analyzer.process(pcm.begin() + pos);
+			taken.push_back(pos + analyzer.processSize());
+		}
+		return latency(analyzer.getMoments(), taken, freq, start);
+	}
+
+	double resonatorLatency(std::vector<float> const& pcm, double freq, unsigned start) {
+		ResonatorAnalyzer analyzer(rate);
+		analyzer.process(pcm.begin(), pcm.end());
+		std::vector<unsigned> taken;
+		for (unsigned i = 0; i < analyzer.getMoments().size(); ++i) taken.push_back((i + 1) * analyzer.processStep());
+		return latency(analyzer.getMoments(), taken, freq, start);
+	}
+}
+
+int main()
+{
+	bool passed = true;
+	std::cout << "Latency (ms) of settled tones: resonators (at most " << 1000.0 * ResonatorAnalyzer(rate).latency()
+	  << " ms), 2048 interpolated, 4096 reassigned" << std::endl;
+	for (unsigned i = 0; i < sizeof(freqs) / sizeof(*freqs); ++i) {
+		// Mean latencies (NaN if any tone was missed)
+		double resonator = 0.0, interpolated = 0.0, reassigned = 0.0;
+		for (unsigned j = 0; j < onsets; ++j) {
+			unsigned start = onset + j * 512 / onsets;
+			std::vector<float> pcm = voice(freqs[i], start);
+			resonator += resonatorLatency(pcm, freqs[i], start) / onsets;
+			interpolated += analyzerLatency(pcm, freqs[i], start, Analyzer::INTERPOLATION, 2048) / onsets;
+			reassigned += analyzerLatency(pcm, freqs[i], start, Analyzer::REASSIGNMENT, 4096) / onsets;
+		}
+		// NaN fails the comparison, and a missing tone from the FFT analyzer does not excuse the resonators
+		bool ok = resonator <= interpolated || (resonator == resonator && interpolated != interpolated);
+		std::cout << std::fixed << std::setprecision(1) << std::setw(7) << freqs[i] << " Hz:"
+		  << std::setw(8) << resonator << std::setw(8) << interpolated << std::setw(8) << reassigned
+		  << (ok ? "" : "  FAILED") << std::endl;
+		passed &= ok;
+	}
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,104 @@
+#include "pitch.hh"
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+/// Tone tracking of a sung note with vibrato and dropouts
+/** Ten seconds of a voice-like tone (a fundamental with two weaker harmonics and a little
+  * noise) at 220 Hz with a vibrato of a semitone at 5.5 Hz, silenced for 30 ms every 1.3
+  * seconds, are analyzed. The paths of at least three moments are counted (the shorter ones
+  * are not rendered). With the frame of the editor (2048 samples, interpolated) the
+  * fundamental must be followed by at most one path per part between the dropouts, covering
+  * nearly all of the moments. With the 4096 sample frame (reassigned) the vibrato spreads
+  * over several peaks and the tracker must still keep the number of paths down (the first
+  * tone within half a semitone, as was used before, made 2810 of them). Exits with failure
+  * otherwise.
+ */
+
+namespace {
+	static const double rate = 44100.0;
+	static const double seconds = 10.0;
+	static const double dropoutInterval = 1.3;
+	static const double dropoutLength = 0.03;
+	static const unsigned minPathLength = 3;  ///< Moments (as in PitchVis)
+	static const double maxCoverageLoss = 0.05;  ///< Part of the moments where the fundamental may be lost
+	static const unsigned maxPathsPerPart = 3;  ///< All paths of the 2048 frame, per part between dropouts
+	static const unsigned maxReassignedPaths = 1000;
+
+	bool check(bool ok, char const* what) {
+		std::cout << (ok ? "ok      " : "FAILED  ") << what << std::endl;
+		return ok;
+	}
+
+	/// Deterministic pseudo-random numbers in [0, 1)
+	double random(unsigned& seed) {
+		seed = seed * 1103515245 + 12345;
+		return ((seed >> 8) & 0xFFFF) / 65536.0;
+	}
+
+	double fundamental(double t) { return 220.0 * std::pow(2.0, std::sin(2.0 * M_PI * 5.5 * t) / 12.0); }
+
+	std::vector<float> voice() {
+		std::vector<float> pcm(seconds * rate);
+		double phase = 0.0;
+		unsigned seed = 1;
+		for (std::size_t i = 0; i < pcm.size(); ++i) {
+			double t = i / rate;
+			phase += 2.0 * M_PI * fundamental(t) / rate;
+			double gain = (std::fmod(t, dropoutInterval) < dropoutLength ? 0.0 : 0.3);
+			pcm[i] = gain * (std::sin(phase) + 0.5 * std::sin(2.0 * phase) + 0.3 * std::sin(3.0 * phase)) + 0.01 * (random(seed) - 0.5);
+		}
+		return pcm;
+	}
+
+	struct Paths {
+		unsigned moments;
+		unsigned count;  ///< Paths of at least minPathLength
+		unsigned fundamental;  ///< Those mostly within half a semitone of the fundamental
+		unsigned covered;  ///< Moments on them
+		Paths(): moments(), count(), fundamental(), covered() {}
+	};
+
+	Paths analyze(std::vector<float> const& pcm, Analyzer::Precision precision, unsigned frameSize) {
+		Analyzer analyzer(rate, "", precision, frameSize);
+		for (std::size_t pos = 0; pos + analyzer.processSize() <= pcm.size(); pos += analyzer.processStep()) analyzer.process(pcm.begin() + pos);
+		// The pitch of a moment is that of the middle of its frame
+		const double center = 0.5 * analyzer.processSize() / rate;
+		const double hop = analyzer.processStep() / rate;
+		Paths p;
+		ToneTracker::Moments const& moments = analyzer.getMoments();
+		for (ToneTracker::Moments::const_iterator mit = moments.begin(); mit != moments.end(); ++mit, ++p.moments) {
+			for (Moment::Tones::const_iterator it = mit->m_tones.begin(); it != mit->m_tones.end(); ++it) {
+				if (it->prev) continue;  // Not the beginning of a path
+				unsigned length = 0, near = 0;
+				double t = mit->time() + center;
+				for (Tone const* tone = &*it; tone; tone = tone->next, t += hop, ++length) {
+					if (std::abs(12.0 * std::log(tone->freq / fundamental(t)) / std::log(2.0)) < 0.5) ++near;
+				}
+				if (length < minPathLength) continue;
+				++p.count;
+				if (2 * near > length) { ++p.fundamental; p.covered += length; }
+			}
+		}
+		return p;
+	}
+}
+
+int main()
+{
+	bool passed = true;
+	std::vector<float> pcm = voice();
+	const unsigned parts = std::ceil(seconds / dropoutInterval);  // Each begins after a dropout (the first one at the start)
+	Paths interpolated = analyze(pcm, Analyzer::INTERPOLATION, 2048);
+	Paths reassigned = analyze(pcm, Analyzer::REASSIGNMENT, 4096);
+	std::cout << "2048 interpolated: " << interpolated.count << " paths, " << interpolated.fundamental << " on the fundamental covering "
+	  << interpolated.covered << " of " << interpolated.moments << " moments" << std::endl;
+	std::cout << "4096 reassigned:   " << reassigned.count << " paths" << std::endl;
+	passed &= check(interpolated.fundamental >= 1 && interpolated.fundamental <= parts, "Fundamental followed across the vibrato");
+	passed &= check(interpolated.covered >= (1.0 - maxCoverageLoss) * interpolated.moments && interpolated.covered <= interpolated.moments,
+	  "Fundamental found in nearly every moment, once");
+	passed &= check(interpolated.count <= maxPathsPerPart * parts, "Few paths with the 2048 frame");
+	passed &= check(reassigned.count <= maxReassignedPaths, "Few paths with the 4096 frame");
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
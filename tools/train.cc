@@ -0,0 +1,168 @@
+#include "analysis.hh"
+#include "chartlint.hh"
+#include "song.hh"
+#include "songwriter.hh"
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#ifndef M_PI
+	#define M_PI 3.141592653589793
+#endif
+
+/// Headless training workload for profile-guided optimization
+/** Synthesizes a song (a sung melody over a quiet chord, noise between the phrases),
+  * analyzes it and round trips a chart of the melody through every writer and parser.
+  * The times printed are also useful for comparing builds.
+ */
+
+namespace {
+	static const unsigned rate = 44100;
+	static const double noteLength = 0.4;  ///< Seconds per melody note
+	static const int melody[] = { 24, 26, 28, 29, 31, 29, 28, 26, 24, 31, 33, 31, 29, 28, 26, 24 };  ///< Editor note numbers (33 = A4)
+	static const unsigned melodyNotes = sizeof(melody) / sizeof(*melody);
+	static const unsigned phrases = 8;
+
+	/// Analysis that never stops
+	struct NoProgress: public PitchAnalysis::Progress {
+		bool update(double, double) { return true; }
+	};
+
+	double noteFreq(int note) { return 440.0 * std::pow(2.0, (note - 33) / 12.0); }
+
+	/// Write a stereo 16 bit WAV file with the melody on the left and the backing on the right
+	void synthesize(QString const& fileName) {
+		std::vector<qint16> pcm;
+		double phase = 0.0;
+		unsigned seed = 1;
+		for (unsigned p = 0; p < phrases; ++p) {
+			for (unsigned n = 0; n <= melodyNotes; ++n) {
+				bool rest = (n == melodyNotes);  // Breathing pause with noise after each phrase
+				double freq = noteFreq(melody[n % melodyNotes]);
+				for (unsigned i = 0; i < noteLength * rate; ++i) {
+					double t = double(i) / rate;
+					double voice = 0.0, backing = 0.0;
+					if (rest) {
+						seed = seed * 1103515245 + 12345;
+						voice = 0.05 * ((seed >> 16) / 32768.0 - 1.0);
+					} else {
+						// Harmonics falling off, 5.5 Hz vibrato and a short attack
+						phase += 2.0 * M_PI * freq * (1.0 + 0.005 * std::sin(2.0 * M_PI * 5.5 * t)) / rate;
+						for (int h = 1; h <= 6; ++h) voice += std::sin(h * phase) / (h * h);
+						voice *= 0.4 * std::min(1.0, t / 0.03);
+					}
+					for (int c = 0; c < 3; ++c) backing += 0.05 * std::sin(2.0 * M_PI * noteFreq(12 + 4 * c) * (p * (melodyNotes + 1) * noteLength + n * noteLength + t));
+					pcm.push_back(qint16(32767.0 * voice));
+					pcm.push_back(qint16(32767.0 * backing));
+				}
+			}
+		}
+		QFile f(fileName);
+		if (!f.open(QIODevice::WriteOnly)) throw std::runtime_error("Cannot write " + fileName.toStdString());
+		QDataStream ds(&f);
+		ds.setByteOrder(QDataStream::LittleEndian);
+		quint32 dataSize = pcm.size() * 2;
+		ds.writeRawData("RIFF", 4);
+		ds << quint32(36 + dataSize);
+		ds.writeRawData("WAVEfmt ", 8);
+		ds << quint32(16) << quint16(1) << quint16(2) << quint32(rate) << quint32(rate * 4) << quint16(4) << quint16(16);
+		ds.writeRawData("data", 4);
+		ds << dataSize;
+		for (std::size_t i = 0; i < pcm.size(); ++i) ds << pcm[i];
+	}
+
+	/// The chart of the synthesized melody
+	void buildChart(Song& song, QString const& music) {
+		song.title = "Training";
+		song.artist = "Composer";
+		song.music["EDITOR"] = music;
+		VocalTrack track(TrackName::LEAD_VOCAL);
+		for (unsigned p = 0; p < phrases; ++p) {
+			for (unsigned n = 0; n < melodyNotes; ++n) {
+				Note note(QString("la%1 ").arg(n));
+				note.begin = (p * (melodyNotes + 1) + n) * noteLength;
+				note.end = note.begin + 0.9 * noteLength;
+				note.note = note.notePrev = melody[n];
+				note.lineBreak = (n == 0 && p > 0);
+				track.notes.push_back(note);
+				track.noteMin = std::min(track.noteMin, note.note);
+				track.noteMax = std::max(track.noteMax, note.note);
+			}
+		}
+		track.beginTime = track.notes.front().begin;
+		track.endTime = track.notes.back().end;
+		song.insertVocalTrack(TrackName::LEAD_VOCAL, track);
+	}
+
+	/// Write the chart in every format and parse them back
+	void roundTrip(Song const& song, QString const& dir) {
+		SingStarXMLWriter(song, dir + "/xml");
+		UltraStarTXTWriter(song, dir + "/txt");
+		FoFMIDIWriter(song, dir + "/ini");
+		LRCWriter(song, dir + "/lrc");
+		char const* files[] = { "xml/notes.xml", "txt/notes.txt", "ini/song.ini", "lrc/song.lrc" };
+		for (unsigned i = 0; i < sizeof(files) / sizeof(*files); ++i) {
+			QFileInfo finfo(dir + "/" + files[i]);
+			Song parsed(finfo.path() + "/", finfo.fileName());
+			if (parsed.getVocalTrack().notes.empty()) throw std::runtime_error(std::string("No notes parsed back from ") + files[i]);
+		}
+	}
+
+	void report(char const* phase, QElapsedTimer& timer) {
+		std::cout << phase << ": " << timer.restart() << " ms" << std::endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	QCoreApplication app(argc, argv);
+	app.setApplicationName("composer-train");  // Keeps the analysis cache apart from the editor's
+	if (argc < 2) {
+		std::cerr << "Usage: " << argv[0] << " WORKDIR [ROUNDS]" << std::endl;
+		return EXIT_FAILURE;
+	}
+	QString dir = QString::fromLocal8Bit(argv[1]);
+	int rounds = (argc > 2 ? std::max(1, std::atoi(argv[2])) : 1);
+	try {
+		QDir().mkpath(dir);
+		QString music = dir + "/training.wav";
+		QElapsedTimer total, timer;
+		total.start();
+		timer.start();
+		synthesize(music);
+		report("synthesize", timer);
+		Song song;
+		buildChart(song, music);
+		for (int r = 0; r < rounds; ++r) {
+			PitchAnalysis analysis;
+			NoProgress progress;
+			analysis.analyze(music, progress);
+			report("analyze", timer);
+			analysis.save(music);
+			if (!analysis.load(music)) throw std::runtime_error("Analysis cache round trip failed");
+			report("cache", timer);
+			ChartLint lint(analysis);
+			std::ostringstream os;
+			ChartLint::report(os, song.getVocalTrack().notes, lint.check(song.getVocalTrack().notes));
+			report("check", timer);
+			roundTrip(song, dir);
+			report("export and parse", timer);
+		}
+		std::cout << "total: " << total.elapsed() << " ms" << std::endl;
+	} catch (std::exception& e) {
+		std::cerr << "Training failed: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+